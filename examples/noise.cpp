@@ -76,9 +76,7 @@ void NoiseWorld::update(float dt) {
         update_texture(sprite.texture, im);
     }
 
-    for (auto *system : systems()) {
-        system->update(this, dt);
-    }
+    update_systems(dt);
 }
 
 } // examples
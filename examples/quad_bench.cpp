@@ -0,0 +1,178 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+// Compares the batched sprite transform in quad.h with the per sprite loop
+// that SpriteRenderer used before, for 100k sprites with and without
+// rotation.
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "two.h"
+#include "quad.h"
+#include "mathf.h"
+#include "noise.h"
+#include "debug.h"
+
+namespace two {
+
+namespace examples {
+
+struct SpriteData {
+    float2 position;
+    float2 scale;
+    float2 origin;
+    float2 size;
+    float rotation;
+};
+
+struct Output {
+    std::vector<SDL_Rect> dst;
+    std::vector<uint8_t> visible;
+};
+
+// The per sprite loop from SpriteRenderer::draw before quad.h.
+static void transform_per_sprite(const std::vector<SpriteData> &sprites,
+                                 const QuadProjection &p, Output &out) {
+    float2 v[4];
+    out.dst.resize(sprites.size());
+    out.visible.resize(sprites.size());
+
+    for (size_t i = 0; i < sprites.size(); ++i) {
+        auto &s = sprites[i];
+        v[0] = s.position;
+        v[1] = {v[0].x + s.scale.x, v[0].y};
+        v[2] = {v[0].x + s.scale.x, v[0].y + s.scale.y};
+        v[3] = {v[0].x, v[0].y + s.scale.y};
+
+        auto woffset = (s.origin * s.scale) + s.position;
+        for (auto &c : v) {
+            c -= woffset;
+        }
+
+        float theta = s.rotation * DegToRad;
+        float st = sinf(theta);
+        float ct = cosf(theta);
+        for (auto &c : v) {
+            float2 r;
+            r.x = ct*c.x - st*c.y + s.position.x;
+            r.y = st*c.x + ct*c.y + s.position.y;
+            c = float2(int2(r * p.tilesize) + p.offset);
+        }
+
+        auto box_min = vmin(vmin(v[0], v[1]), vmin(v[2], v[3]));
+        auto box_max = vmax(vmax(v[0], v[1]), vmax(v[2], v[3]));
+        out.visible[i] = !(box_min.x > p.screen.x || box_min.y > p.screen.y
+                           || box_max.x < 0.0f || box_max.y < 0.0f);
+
+        float2 ws = float2(int2(s.position * p.tilesize) + p.offset);
+        auto scale = s.scale * s.size * p.scale;
+        auto offset = ws - s.origin * scale;
+        out.dst[i] = SDL_Rect{int(offset.x), int(offset.y),
+                              int(scale.x), int(scale.y)};
+    }
+}
+
+static float range(Xorshift64 &rng, float min, float max) {
+    return min + (max - min) * rng.randf();
+}
+
+template <typename F>
+static double time_ms(int iterations, F f) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - begin).count()
+           / iterations;
+}
+
+static void run_benchmark(const char *name, bool rotated) {
+    constexpr size_t Count = 100000;
+    constexpr int Iterations = 50;
+
+    Xorshift64 rng{0x2f8a41};
+    std::vector<SpriteData> sprites(Count);
+    for (auto &s : sprites) {
+        s.position = float2{range(rng, -60.0f, 60.0f),
+                            range(rng, -40.0f, 40.0f)};
+        s.scale = float2{range(rng, 0.5f, 2.0f), range(rng, 0.5f, 2.0f)};
+        s.origin = float2{0.5f, 0.5f};
+        s.size = float2{16.0f, 16.0f};
+        s.rotation = rotated ? range(rng, -720.0f, 720.0f) : 0.0f;
+    }
+
+    QuadProjection projection;
+    projection.tilesize = float2{16.0f, 16.0f};
+    projection.scale = 1.0f;
+    projection.offset = int2{400, 300};
+    projection.screen = int2{800, 600};
+
+    Output reference;
+    auto per_sprite_ms = time_ms(Iterations, [&]() {
+        transform_per_sprite(sprites, projection, reference);
+    });
+    log("%s: per sprite %.3fms", name, per_sprite_ms);
+
+    QuadBatch batch;
+    for (auto &s : sprites) {
+        batch.push(s.position, s.scale, s.origin, s.size, s.rotation);
+    }
+
+    const SimdLevel levels[]{SimdLevel::Scalar, SimdLevel::SSE2,
+                             SimdLevel::AVX2};
+    const char *level_names[]{"scalar", "sse2", "avx2"};
+    for (int l = 0; l < 3; ++l) {
+        if (int(levels[l]) > int(simd_level())) {
+            log("%s: %s not supported", name, level_names[l]);
+            continue;
+        }
+        auto ms = time_ms(Iterations, [&]() {
+            transform_quads(batch, projection, levels[l]);
+        });
+
+        size_t dst_diff = 0, cull_diff = 0;
+        for (size_t i = 0; i < Count; ++i) {
+            auto &d = reference.dst[i];
+            if (d.x != batch.dst_x[i] || d.y != batch.dst_y[i]
+                || d.w != batch.dst_w[i] || d.h != batch.dst_h[i]) {
+                ++dst_diff;
+            }
+            if (reference.visible[i] != batch.visible[i]) {
+                ++cull_diff;
+            }
+        }
+        log("%s: %s %.3fms (%.1fx), %zu rects differ, %zu culled "
+            "differently", name, level_names[l], ms, per_sprite_ms / ms,
+            dst_diff, cull_diff);
+    }
+}
+
+} // examples
+
+} // two
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+    two::examples::run_benchmark("unrotated", false);
+    two::examples::run_benchmark("rotated", true);
+    return 0;
+}
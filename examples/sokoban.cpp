@@ -132,7 +132,7 @@ public:
 void Collision::update(World *world, float) {
     TWO_PROFILE_FUNC();
     for (auto e : world->view<Move, Tag, Transform, Sprite>()) {
-        auto position = world->unpack<Transform>(e).position;
+        auto position = world->read<Transform>(e).position;
         auto direction = world->unpack<Move>(e).direction;
         auto &sprite = world->unpack<Sprite>(e);
         world->remove_component<Move>(e);
@@ -151,7 +151,7 @@ void Collision::update(World *world, float) {
     auto &room = world->unpack_one<Room>();
     room.win = true;
     for (auto e : world->view<Transform, Target>()) {
-        auto position = world->unpack<Transform>(e).position;
+        auto position = world->read<Transform>(e).position;
         auto crate = room.at(position, 1);
         if (crate == NullEntity) {
             // Nothing on the target
@@ -234,7 +234,7 @@ void Sokoban::load() {
     bind<WinEvent>(&Sokoban::win, this);
 
     auto player = view_one<Player>().value();
-    auto ptf = unpack<Transform>(player);
+    auto ptf = read<Transform>(player);
     auto p2 = make_entity(player);
     auto &tf = unpack<Transform>(p2);
     auto &sp = unpack<Sprite>(p2);
@@ -338,9 +338,7 @@ bool Sokoban::win(const WinEvent &) {
 }
 
 void Sokoban::update(float dt) {
-    for (auto *system : systems()) {
-        system->update(this, dt);
-    }
+    update_systems(dt);
 }
 
 class TitleScreen : public World {
@@ -0,0 +1,275 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#include "atlas.h"
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <climits>
+#include <algorithm>
+
+#include "SDL.h"
+#include "mathf.h"
+#include "debug.h"
+#include "image.h"
+#include "two.h"
+
+namespace two {
+
+SkylinePacker::SkylinePacker(int width, int height) : w{width}, h{height} {
+    clear();
+}
+
+void SkylinePacker::clear() {
+    skyline.clear();
+    skyline.push_back(Segment{0, 0, w});
+    used = int2{0, 0};
+    used_area = 0;
+}
+
+int SkylinePacker::fit(size_t index, const int2 &size) const {
+    int x = skyline[index].x;
+    if (x + size.x > w) {
+        return -1;
+    }
+    // The rectangle rests on the highest segment under it
+    int y = skyline[index].y;
+    int remaining = size.x;
+    for (size_t i = index; remaining > 0; ++i) {
+        if (i == skyline.size()) {
+            return -1;
+        }
+        y = std::max(y, skyline[i].y);
+        if (y + size.y > h) {
+            return -1;
+        }
+        remaining -= skyline[i].width;
+    }
+    return y;
+}
+
+Optional<int2> SkylinePacker::pack(const int2 &size) {
+    if (size.x <= 0 || size.y <= 0) {
+        return int2{0, 0};
+    }
+
+    size_t best_index = 0;
+    int best_top = INT_MAX;
+    int best_width = INT_MAX;
+    int best_y = 0;
+    for (size_t i = 0; i < skyline.size(); ++i) {
+        int y = fit(i, size);
+        if (y < 0) {
+            continue;
+        }
+        // Lowest top edge, then the narrowest segment to waste less space
+        int top = y + size.y;
+        if (top < best_top
+                || (top == best_top && skyline[i].width < best_width)) {
+            best_index = i;
+            best_top = top;
+            best_width = skyline[i].width;
+            best_y = y;
+        }
+    }
+    if (best_top == INT_MAX) {
+        return {};
+    }
+
+    int2 position{skyline[best_index].x, best_y};
+    skyline.insert(skyline.begin() + best_index,
+                   Segment{position.x, best_top, size.x});
+
+    // Cut the segments that are now under the rectangle
+    for (size_t i = best_index + 1; i < skyline.size();) {
+        const auto &prev = skyline[i - 1];
+        auto &segment = skyline[i];
+        int overlap = prev.x + prev.width - segment.x;
+        if (overlap <= 0) {
+            break;
+        }
+        segment.x += overlap;
+        segment.width -= overlap;
+        if (segment.width > 0) {
+            break;
+        }
+        skyline.erase(skyline.begin() + i);
+    }
+
+    // Merge neighbours at the same height
+    for (size_t i = 0; i + 1 < skyline.size();) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+            continue;
+        }
+        ++i;
+    }
+
+    used.x = std::max(used.x, position.x + size.x);
+    used.y = std::max(used.y, best_top);
+    used_area += int64_t(size.x) * int64_t(size.y);
+    return position;
+}
+
+// Copies the edge pixels of the sprite at `rect` into the padding around it.
+static void extrude(Image *page, const SDL_Rect &rect, int padding) {
+    int x0 = std::max(rect.x - padding, 0);
+    int x1 = std::min(rect.x + rect.w + padding, page->width());
+    int y0 = std::max(rect.y - padding, 0);
+    int y1 = std::min(rect.y + rect.h + padding, page->height());
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            bool inside = x >= rect.x && x < rect.x + rect.w
+                          && y >= rect.y && y < rect.y + rect.h;
+            if (inside) {
+                continue;
+            }
+            int2 edge{clampi(x, rect.x, rect.x + rect.w - 1),
+                      clampi(y, rect.y, rect.y + rect.h - 1)};
+            page->write(int2{x, y}, page->read(edge));
+        }
+    }
+}
+
+Optional<std::vector<Sprite>> pack_atlas(
+        const std::vector<const Image *> &images,
+        const AtlasOptions &options) {
+    TWO_PROFILE_FUNC();
+    int2 page_size = options.page_size;
+    // May be packed on a loading thread, so the renderer is not queried
+    auto &max_size = render_info().max_texture_size;
+    // Zero means there is no limit
+    if (max_size.x > 0) {
+        page_size.x = std::min(page_size.x, max_size.x);
+    }
+    if (max_size.y > 0) {
+        page_size.y = std::min(page_size.y, max_size.y);
+    }
+    int padding = std::max(options.padding, 0);
+
+    // Packing the tallest images first leaves fewer gaps in the skyline
+    std::vector<size_t> order(images.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (images[a]->height() != images[b]->height()) {
+            return images[a]->height() > images[b]->height();
+        }
+        return images[a]->width() > images[b]->width();
+    });
+
+    struct Placement {
+        size_t page;
+        SDL_Rect rect;
+    };
+    std::vector<Placement> placements(images.size());
+    std::vector<SkylinePacker> pages;
+
+    for (auto index : order) {
+        const auto *im = images[index];
+        // Padding on every side, so sprites are 2 * padding apart and
+        // padding away from the page edges
+        int2 size{im->width() + 2 * padding, im->height() + 2 * padding};
+        if (size.x > page_size.x || size.y > page_size.y) {
+            log_error("Image %zu (%dx%d) does not fit in an atlas page "
+                      "(%dx%d)", index, im->width(), im->height(),
+                      page_size.x, page_size.y);
+            return {};
+        }
+
+        Optional<int2> position;
+        size_t page = 0;
+        for (; page < pages.size(); ++page) {
+            position = pages[page].pack(size);
+            if (position.has_value) {
+                break;
+            }
+        }
+        if (!position.has_value) {
+            pages.emplace_back(page_size.x, page_size.y);
+            position = pages.back().pack(size);
+            ASSERT(position.has_value);
+        }
+        auto xy = position.value();
+        placements[index] = Placement{page, SDL_Rect{xy.x + padding,
+                                                     xy.y + padding,
+                                                     im->width(),
+                                                     im->height()}};
+    }
+
+    std::vector<Sprite> sprites(images.size());
+    for (size_t page = 0; page < pages.size(); ++page) {
+        const auto &used = pages[page].used_size();
+        Image page_im(used.x, used.y, Image::RGBA32);
+
+        for (size_t i = 0; i < images.size(); ++i) {
+            const auto &placement = placements[i];
+            if (placement.page != page) {
+                continue;
+            }
+            const auto *im = images[i];
+            const Image *src = im;
+            if (im->get_pixelformat() != Image::RGBA32) {
+                src = im->convert(Image::RGBA32);
+            }
+            page_im.paste(src, int2{placement.rect.x, placement.rect.y});
+            if (src != im) {
+                delete src;
+            }
+            if (options.extrude && padding > 0 && placement.rect.w > 0
+                    && placement.rect.h > 0) {
+                extrude(&page_im, placement.rect, padding);
+            }
+        }
+
+        auto texture = make_texture(&page_im);
+        for (size_t i = 0; i < images.size(); ++i) {
+            const auto &placement = placements[i];
+            if (placement.page != page) {
+                continue;
+            }
+            const auto &r = placement.rect;
+            sprites[i] = Sprite{texture, Rect{float(r.x), float(r.y),
+                                              float(r.w), float(r.h)}};
+        }
+    }
+    return sprites;
+}
+
+Optional<std::vector<Sprite>> pack_atlas(
+        const std::vector<std::string> &image_assets,
+        const AtlasOptions &options) {
+    std::vector<std::unique_ptr<Image>> loaded;
+    std::vector<const Image *> images;
+    for (const auto &asset : image_assets) {
+        auto *im = load_image(asset);
+        if (im == nullptr) {
+            log_error("Could not load image %s for atlas", asset.c_str());
+            return {};
+        }
+        loaded.emplace_back(im);
+        images.push_back(im);
+    }
+    return pack_atlas(images, options);
+}
+
+} // two
@@ -0,0 +1,113 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#ifndef TWO_ATLAS_H
+#define TWO_ATLAS_H
+
+#include <vector>
+#include <string>
+
+#include "mathf.h"
+#include "image.h"
+#include "optional.h"
+#include "sprite.h"
+
+namespace two {
+
+// Packs rectangles into a fixed size area using the skyline bottom-left
+// heuristic. The skyline is the top edge of everything packed so far, each
+// rectangle is placed where its top would be lowest.
+class SkylinePacker {
+public:
+    SkylinePacker(int width, int height);
+
+    // Returns the top left corner of the area reserved for a rectangle of
+    // `size`, or nothing if there is no room left for it.
+    Optional<int2> pack(const int2 &size);
+
+    // Removes all rectangles.
+    void clear();
+
+    inline int width() const { return w; }
+    inline int height() const { return h; }
+
+    // Smallest size that contains every rectangle packed so far.
+    inline const int2 &used_size() const { return used; }
+
+    // Fraction of the area covered by rectangles.
+    inline float occupancy() const {
+        return float(used_area) / float(int64_t(w) * int64_t(h));
+    }
+
+private:
+    struct Segment {
+        int x;
+        int y;
+        int width;
+    };
+
+    int w, h;
+    int2 used{0, 0};
+    int64_t used_area = 0;
+    std::vector<Segment> skyline;
+
+    // Returns the y position of a rectangle of `size` placed on the
+    // segment at `index`, or -1 if it does not fit there.
+    int fit(size_t index, const int2 &size) const;
+};
+
+struct AtlasOptions {
+    // Largest size of an atlas texture in pixels. The size is also limited
+    // by the largest texture the renderer supports. The last page only
+    // uses as much of this size as it needs.
+    int2 page_size{2048, 2048};
+
+    // Pixels between sprites and around the edges of a page. With linear
+    // filtering neighbouring sprites can bleed into each other, a padding
+    // of 1 or 2 pixels prevents this.
+    int padding = 1;
+
+    // Fill the padding around each sprite with its edge pixels instead of
+    // leaving it transparent, so filtering at the edges of a sprite samples
+    // its own colors.
+    bool extrude = true;
+};
+
+// Packs many images into as few atlas textures as possible. Returns one
+// sprite per image, in the same order, each referencing the texture and
+// rect it was packed into. Sprites that share a texture can be drawn
+// without switching textures. It is safe to free the images once the
+// atlas is created. Returns nothing if an image is larger than a page.
+//
+//     std::vector<const Image *> images{player, enemy, crate};
+//     auto sprites = pack_atlas(images);
+//
+Optional<std::vector<Sprite>> pack_atlas(
+    const std::vector<const Image *> &images,
+    const AtlasOptions &options = AtlasOptions{});
+
+// Loads image assets and packs them with `pack_atlas`. Returns nothing if
+// an image could not be loaded or packed.
+Optional<std::vector<Sprite>> pack_atlas(
+    const std::vector<std::string> &image_assets,
+    const AtlasOptions &options = AtlasOptions{});
+
+} // two
+
+#endif // TWO_ATLAS_H
@@ -0,0 +1,246 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#ifndef TWO_CACHE_H
+#define TWO_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+
+#include "debug.h"
+
+namespace two {
+
+struct ResourceCacheStats {
+    // Lookups that returned a resource that was already loaded.
+    uint64_t hits;
+    // Lookups that had to load the resource.
+    uint64_t misses;
+    // Resources currently alive in the cache.
+    uint32_t resources;
+};
+
+// Shares loaded resources by asset path. The cache only holds weak
+// references, a resource is freed as usual once nothing else references
+// it and the next lookup loads it again.
+//
+//     auto font = font_cache().get(path, [&]() { return parse(path); });
+//
+// It is safe to use a cache from multiple threads. Loaders are called
+// without holding the lock since they may need to wait for the main
+// thread, so two threads missing the same key at once can both load it.
+// Only the first resource is kept and returned to both.
+template <typename T>
+class ResourceCache {
+public:
+    // Returns the resource for `key`, calling `load` if it is not loaded.
+    // `load` returns a `std::shared_ptr<T>`, null resources are returned
+    // but not cached.
+    template <typename Load>
+    std::shared_ptr<T> get(const std::string &key, Load load);
+
+    // Returns the resource for `key` or null if it is not loaded. Does not
+    // count as a hit or miss.
+    std::shared_ptr<T> find(const std::string &key) const;
+
+    // Returns the key a resource is cached with, or an empty string if
+    // the resource is not in the cache.
+    std::string key_of(const std::shared_ptr<T> &resource) const;
+
+    // Caches a resource that was loaded without `get`, unless a resource
+    // is already loaded for `key`. Returns the cached resource.
+    std::shared_ptr<T> insert(const std::string &key,
+                              const std::shared_ptr<T> &resource);
+
+    // Stops sharing the resource for `key`. Existing references are not
+    // affected.
+    void remove(const std::string &key);
+
+    // Removes entries of resources that have been freed.
+    void prune();
+
+    ResourceCacheStats stats() const;
+
+    void reset_stats();
+
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<T>> entries;
+    // Key of each cached resource. May refer to resources that have been
+    // freed until the next prune, see `key_of`.
+    std::unordered_map<const T *, std::string> keys;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t prune_size = 64;
+
+    void prune_locked();
+    std::shared_ptr<T> insert_locked(const std::string &key,
+                                     const std::shared_ptr<T> &resource);
+};
+
+template <typename T>
+template <typename Load>
+std::shared_ptr<T> ResourceCache<T>::get(const std::string &key, Load load) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            auto resource = it->second.lock();
+            if (resource != nullptr) {
+                ++hits;
+                return resource;
+            }
+        }
+        ++misses;
+    }
+
+    std::shared_ptr<T> loaded = load();
+    if (loaded == nullptr) {
+        return loaded;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // May have been loaded by another thread in the meantime
+    return insert_locked(key, loaded);
+}
+
+template <typename T>
+std::shared_ptr<T> ResourceCache<T>::insert(
+        const std::string &key, const std::shared_ptr<T> &resource) {
+    ASSERT(resource != nullptr);
+    std::lock_guard<std::mutex> lock(mutex);
+    return insert_locked(key, resource);
+}
+
+template <typename T>
+std::shared_ptr<T> ResourceCache<T>::insert_locked(
+        const std::string &key, const std::shared_ptr<T> &resource) {
+    auto &entry = entries[key];
+    auto cached = entry.lock();
+    if (cached != nullptr) {
+        return cached;
+    }
+    entry = resource;
+    keys[resource.get()] = key;
+    if (entries.size() >= prune_size) {
+        prune_locked();
+    }
+    return resource;
+}
+
+template <typename T>
+std::shared_ptr<T> ResourceCache<T>::find(const std::string &key) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return nullptr;
+    }
+    return it->second.lock();
+}
+
+template <typename T>
+std::string ResourceCache<T>::key_of(
+        const std::shared_ptr<T> &resource) const {
+    if (resource == nullptr) {
+        return std::string{};
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = keys.find(resource.get());
+    if (it == keys.end()) {
+        return std::string{};
+    }
+    // The address may belong to a freed resource that was cached before
+    auto entry = entries.find(it->second);
+    if (entry == entries.end() || entry->second.lock() != resource) {
+        return std::string{};
+    }
+    return it->second;
+}
+
+template <typename T>
+void ResourceCache<T>::remove(const std::string &key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return;
+    }
+    auto resource = it->second.lock();
+    if (resource != nullptr) {
+        keys.erase(resource.get());
+    }
+    entries.erase(it);
+}
+
+template <typename T>
+void ResourceCache<T>::prune() {
+    std::lock_guard<std::mutex> lock(mutex);
+    prune_locked();
+}
+
+template <typename T>
+void ResourceCache<T>::prune_locked() {
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->second.expired()) {
+            it = entries.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    for (auto it = keys.begin(); it != keys.end();) {
+        auto entry = entries.find(it->second);
+        if (entry == entries.end() || entry->second.lock().get() != it->first) {
+            it = keys.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    // Expired entries are only removed once the map has doubled in size
+    // so a cache of many short lived resources does not grow forever.
+    prune_size = std::max(entries.size() * 2, size_t(64));
+}
+
+template <typename T>
+ResourceCacheStats ResourceCache<T>::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    ResourceCacheStats stats;
+    stats.hits = hits;
+    stats.misses = misses;
+    stats.resources = 0;
+    for (const auto &entry : entries) {
+        if (!entry.second.expired()) {
+            ++stats.resources;
+        }
+    }
+    return stats;
+}
+
+template <typename T>
+void ResourceCache<T>::reset_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    hits = 0;
+    misses = 0;
+}
+
+} // two
+
+#endif // TWO_CACHE_H
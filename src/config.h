@@ -29,7 +29,7 @@
 
 #if defined(__clang__) || defined(__GNUC__)
 #define TWO_PRETTY_FUNCTION __PRETTY_FUNCTION__
-#elif defined(MSVC)
+#elif defined(_MSC_VER)
 #define TWO_PRETTY_FUNCTION __FUNCSIG__
 #else
 #define TWO_PRETTY_FUNCTION __func__
@@ -27,6 +27,7 @@
 namespace two {
 
 void Profiler::append(const TimeStamp &ts) {
+    std::lock_guard<std::mutex> lock(mutex);
     if (entries.size() < MaxEntries) {
         entries.push_back(ts);
         return;
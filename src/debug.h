@@ -23,6 +23,7 @@
 #include <vector>
 #include <cstdlib>
 #include <chrono>
+#include <mutex>
 
 #include "SDL_log.h"
 
@@ -104,11 +105,14 @@ public:
 
     std::vector<TimeStamp> entries;
 
-    // Append a new entry.
+    // Append a new entry. May be called from any thread.
     void append(const TimeStamp &ts);
 
     // Should be called every frame.
-    inline void clear() { entries.clear(); }
+    inline void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
 
     // Create a file for writting the profile data. A session is only
     // required if you are writing to a json file with `save()`.
@@ -127,6 +131,9 @@ public:
 private:
     FILE *fp = nullptr;
 
+    // Entries may be appended by worker threads.
+    std::mutex mutex;
+
     int total_entries = 0;
 
     // Format for each timestamp.
@@ -20,6 +20,10 @@
 
 #include <tuple>
 #include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <queue>
+#include <functional>
 
 #include "SDL_render.h"
 #include "debug.h"
@@ -32,15 +36,144 @@
 
 namespace two {
 
+namespace internal {
+
+std::string parse_type_name(const char *signature) {
+    std::string s{signature};
+    // GCC and clang: "... type_name() [with T = Name]"
+    auto begin = s.find("T = ");
+    if (begin != std::string::npos) {
+        begin += 4;
+        auto end = s.find_first_of("];", begin);
+        return s.substr(begin, end - begin);
+    }
+    // MSVC: "... type_name<struct Name>(void)"
+    begin = s.find("type_name<");
+    auto end = s.rfind(">(");
+    if (begin != std::string::npos && end != std::string::npos) {
+        begin += 10;
+        auto name = s.substr(begin, end - begin);
+        for (const char *prefix : {"struct ", "class ", "enum "}) {
+            if (name.compare(0, strlen(prefix), prefix) == 0) {
+                return name.substr(strlen(prefix));
+            }
+        }
+        return name;
+    }
+    return s;
+}
+
+uint64_t next_array_id() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Worlds may be loaded on different threads so access to the factories
+// is synchronized. Factories are only added when a component type is
+// registered.
+static std::mutex component_factories_mutex;
+
+static std::unordered_map<uint32_t, ComponentFactory> &component_factories() {
+    static std::unordered_map<uint32_t, ComponentFactory> factories;
+    return factories;
+}
+
+void add_component_factory(uint32_t serial_id, ComponentFactory factory) {
+    std::lock_guard<std::mutex> lock(component_factories_mutex);
+    component_factories().emplace(std::make_pair(serial_id, factory));
+}
+
+ComponentFactory find_component_factory(uint32_t serial_id) {
+    std::lock_guard<std::mutex> lock(component_factories_mutex);
+    auto it = component_factories().find(serial_id);
+    if (it == component_factories().end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+} // internal
+
+// "TWOS"
+static constexpr uint32_t SnapshotMagic = 0x534f5754;
+static constexpr uint32_t SnapshotVersion = 2;
+
 void System::load(World *) {}
 void System::update(World *, float) {}
 void System::draw(World *) {}
 void System::unload(World *) {}
 
+World::World() {
+    // Active is always the first component type so that its index is the
+    // same in every world.
+    register_component<Active>();
+}
+
 void World::load() {}
-void World::update(float) {}
+
+void World::update(float dt) {
+    update_systems(dt);
+}
+
 void World::unload() {}
 
+Timer World::after(float seconds, const std::function<void()> &callback,
+                   Entity entity) {
+    return timer_wheel.schedule(seconds, 0.0f, callback, entity);
+}
+
+Timer World::every(float seconds, const std::function<void()> &callback,
+                   Entity entity) {
+    ASSERT(seconds > 0.0f);
+    return timer_wheel.schedule(seconds, seconds, callback, entity);
+}
+
+bool World::cancel_timer(Timer timer) {
+    return timer_wheel.cancel(timer);
+}
+
+void World::update_timers(float dt) {
+    timer_wheel.advance(dt);
+}
+
+// Most updates a system with an `update_interval` runs in one frame.
+static constexpr int MaxSystemCatchUp = 4;
+
+void World::update_systems(float dt) {
+    // Systems may add other systems while updating
+    for (size_t i = 0; i < active_systems.size(); ++i) {
+        auto *system = active_systems[i];
+        if (!system->enabled) {
+            continue;
+        }
+        if (system->update_interval <= 0.0f) {
+            TWO_PROFILE_EVENT(system->name());
+            system->update(this, dt);
+            continue;
+        }
+        // A long frame only catches up a few intervals, otherwise a slow
+        // system could fall further behind each frame.
+        system->time_since_update = std::min(
+            system->time_since_update + dt,
+            system->update_interval * float(MaxSystemCatchUp));
+        while (system->time_since_update >= system->update_interval) {
+            TWO_PROFILE_EVENT(system->name());
+            system->update(this, system->update_interval);
+            system->time_since_update -= system->update_interval;
+        }
+    }
+}
+
+void World::draw_systems() {
+    for (auto *system : active_systems) {
+        if (!system->enabled) {
+            continue;
+        }
+        TWO_PROFILE_EVENT(system->name());
+        system->draw(this);
+    }
+}
+
 Entity World::make_entity() {
     auto entity = make_inactive_entity();
     pack(entity, Active{});
@@ -54,6 +187,12 @@ Entity World::make_entity(Entity prefab) {
 }
 
 Entity World::make_inactive_entity() {
+    internal::FrameLog::EntityOp op;
+    op.kind = internal::FrameLog::EntityOp::Create;
+    op.index = uint32_t(entities.size());
+    op.alive_count = uint32_t(alive_count);
+    op.reused = !unused_entities.empty();
+
     Entity entity;
     if (unused_entities.empty()) {
         ASSERTS(alive_count < TWO_ENTITY_MAX, "Too many entities");
@@ -73,12 +212,17 @@ Entity World::make_inactive_entity() {
     }
     entities.push_back(entity);
     ++alive_count;
+
+    if (recorder != nullptr) {
+        op.entity = entity;
+        recorder->current.ops.push_back(op);
+    }
     return entity;
 }
 
 void World::copy_entity(Entity dst, Entity src) {
-    auto &dst_mask = entity_masks[dst];
-    auto &src_mask = entity_masks[src];
+    auto &dst_mask = mutable_mask(dst);
+    const auto &src_mask = get_mask(src);
     for (const auto &type_it : component_types) {
         if (!src_mask.test(type_it.second)) {
             continue;
@@ -107,12 +251,13 @@ void World::copy_entity(Entity dst, Entity src) {
 
 void World::destroy_entity(Entity entity) {
     ASSERT(entity != NullEntity);
+    timer_wheel.cancel_owner(entity);
     for (auto &a : components) {
         if (a != nullptr) {
             a->remove(entity);
         }
     }
-    entity_masks[entity] = 0;
+    mutable_mask(entity).reset();
 
     DestroyedEntity destroyed;
     destroyed.entity = entity;
@@ -133,6 +278,14 @@ void World::destroy_entity(Entity entity) {
     }
     auto rem = std::find(entities.begin(), entities.end(), entity);
     ASSERT(rem != entities.end());
+
+    if (recorder != nullptr) {
+        internal::FrameLog::EntityOp op;
+        op.kind = internal::FrameLog::EntityOp::Destroy;
+        op.entity = entity;
+        op.index = uint32_t(std::distance(entities.begin(), rem));
+        recorder->current.ops.push_back(op);
+    }
     std::swap(*rem, entities.back());
     entities.pop_back();
 
@@ -145,6 +298,13 @@ void World::collect_unused_entities() {
         return;
     }
     TWO_PROFILE_FUNC();
+    if (recorder != nullptr) {
+        internal::FrameLog::EntityOp op;
+        op.kind = internal::FrameLog::EntityOp::Collect;
+        op.entity = NullEntity;
+        op.index = uint32_t(destroyed_entities.size());
+        recorder->current.ops.push_back(op);
+    }
     for (const auto &destroyed : destroyed_entities) {
         for (auto *cache : destroyed.caches) {
             // In most cases the cache will have no diffs since if this cache
@@ -173,6 +333,7 @@ void World::destroy_system(System *system) {
     auto index = std::distance(active_systems.begin(), pos);
     active_systems.erase(pos);
     active_system_types.erase(active_system_types.begin() + index);
+    rebuild_system_index();
 }
 
 void World::destroy_systems() {
@@ -182,6 +343,515 @@ void World::destroy_systems() {
     }
     active_systems.clear();
     active_system_types.clear();
+    system_index.clear();
+}
+
+void World::add_system(System *system, type_id_t type, const char *name) {
+    ASSERT(active_systems.size() == active_system_types.size());
+    system->system_name = name;
+    active_systems.push_back(system);
+    active_system_types.push_back(type);
+    if (system_order.empty()) {
+        // Only the first system of a type is in the index
+        system_index.emplace(std::make_pair(type, active_systems.size() - 1));
+        return;
+    }
+    // Constraints between types never form a cycle, see add_system_order,
+    // so neither do the edges between systems.
+    bool sorted = sort_systems();
+    ASSERT(sorted);
+    UNUSED(sorted);
+}
+
+void World::add_system_order(type_id_t before, type_id_t after,
+                             const char *before_name, const char *after_name) {
+    // Checked between types rather than systems, since a cycle between
+    // types that have no systems yet would fail once they are added.
+    if (system_order_reaches(after, before)) {
+        log_warn("Cannot order %s before %s, constraints have a cycle",
+                 before_name, after_name);
+        return;
+    }
+    system_order.push_back(SystemOrder{before, after});
+    bool sorted = sort_systems();
+    ASSERT(sorted);
+    UNUSED(sorted);
+}
+
+bool World::system_order_reaches(type_id_t from, type_id_t to) const {
+    std::vector<type_id_t> stack{from};
+    std::unordered_set<type_id_t> visited{from};
+    while (!stack.empty()) {
+        auto type = stack.back();
+        stack.pop_back();
+        if (type == to) {
+            return true;
+        }
+        for (const auto &order : system_order) {
+            if (order.before == type && visited.insert(order.after).second) {
+                stack.push_back(order.after);
+            }
+        }
+    }
+    return false;
+}
+
+bool World::sort_systems() {
+    ASSERT(active_systems.size() == active_system_types.size());
+    auto count = active_systems.size();
+
+    // Edges between individual systems, since there may be multiple
+    // systems of the same type.
+    std::vector<std::vector<size_t>> edges(count);
+    std::vector<size_t> incoming(count, 0);
+    for (const auto &order : system_order) {
+        for (size_t i = 0; i < count; ++i) {
+            if (active_system_types[i] != order.before) {
+                continue;
+            }
+            for (size_t j = 0; j < count; ++j) {
+                if (active_system_types[j] != order.after) {
+                    continue;
+                }
+                edges[i].push_back(j);
+                ++incoming[j];
+            }
+        }
+    }
+
+    // Kahn's algorithm, always taking the ready system that was added
+    // first keeps the sort stable.
+    std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>>
+        ready;
+    for (size_t i = 0; i < count; ++i) {
+        if (incoming[i] == 0) {
+            ready.push(i);
+        }
+    }
+    std::vector<size_t> sorted;
+    sorted.reserve(count);
+    while (!ready.empty()) {
+        auto i = ready.top();
+        ready.pop();
+        sorted.push_back(i);
+        for (auto j : edges[i]) {
+            if (--incoming[j] == 0) {
+                ready.push(j);
+            }
+        }
+    }
+    if (sorted.size() != count) {
+        return false;
+    }
+
+    std::vector<System *> systems(count);
+    std::vector<type_id_t> types(count);
+    for (size_t i = 0; i < count; ++i) {
+        systems[i] = active_systems[sorted[i]];
+        types[i] = active_system_types[sorted[i]];
+    }
+    active_systems = std::move(systems);
+    active_system_types = std::move(types);
+    rebuild_system_index();
+    return true;
+}
+
+void World::rebuild_system_index() {
+    system_index.clear();
+    for (size_t i = 0; i < active_system_types.size(); ++i) {
+        // Only the first system of a type is in the index
+        system_index.emplace(std::make_pair(active_system_types[i], i));
+    }
+}
+
+void World::save_snapshot(SnapshotWriter &writer) {
+    TWO_PROFILE_FUNC();
+    writer.write(SnapshotMagic);
+    writer.write(SnapshotVersion);
+    writer.write(uint32_t(alive_count));
+
+    writer.write(uint32_t(entities.size()));
+    writer.write((const void *)entities.data(),
+                 sizeof(Entity) * entities.size());
+
+    // Destroyed entities no longer have any components so their ids
+    // can be reused as soon as the snapshot is loaded.
+    writer.write(uint32_t(unused_entities.size() + destroyed_entities.size()));
+    writer.write((const void *)unused_entities.data(),
+                 sizeof(Entity) * unused_entities.size());
+    for (const auto &destroyed : destroyed_entities) {
+        writer.write(destroyed.entity);
+    }
+
+    writer.write(uint32_t(component_type_index));
+    for (size_t i = 0; i < component_type_index; ++i) {
+        auto &a = components[i];
+        writer.write(a->serial_id());
+        writer.write(a->component_size());
+
+        // Block size is written after the block so that component types
+        // that are unknown when loading can be skipped.
+        auto size_offset = writer.size();
+        writer.write(uint64_t(0));
+        auto block_start = writer.size();
+
+        if (!a->save(writer)) {
+            E_MSG("component #%lu cannot be serialized", i);
+            continue;
+        }
+        writer.write_at(size_offset, uint64_t(writer.size() - block_start));
+    }
+}
+
+// Every id below `alive_count` is either alive or unused, exactly once.
+static bool valid_entity_ids(size_t alive_count,
+                             const std::vector<Entity> &entities,
+                             const std::vector<Entity> &unused_entities) {
+    if (alive_count > TWO_ENTITY_MAX
+        || entities.size() + unused_entities.size() != alive_count) {
+        return false;
+    }
+    std::vector<bool> seen(alive_count, false);
+    for (const auto *ids : {&entities, &unused_entities}) {
+        for (auto entity : *ids) {
+            if (entity >= alive_count || seen[entity]) {
+                return false;
+            }
+            seen[entity] = true;
+        }
+    }
+    return true;
+}
+
+bool World::load_snapshot(SnapshotReader &reader) {
+    TWO_PROFILE_FUNC();
+    if (reader.read<uint32_t>() != SnapshotMagic
+        || reader.read<uint32_t>() != SnapshotVersion) {
+        log_error("Invalid snapshot");
+        return false;
+    }
+
+    entity_masks.clear();
+    for (auto &a : components) {
+        if (a != nullptr) {
+            a->clear();
+        }
+    }
+    destroyed_entities.clear();
+
+    alive_count = reader.read<uint32_t>();
+
+    auto entity_count = reader.read<uint32_t>();
+    bool valid = reader.ok() && entity_count <= TWO_ENTITY_MAX;
+    entities.resize(valid ? entity_count : 0);
+    reader.read((void *)entities.data(), sizeof(Entity) * entities.size());
+
+    auto unused_count = reader.read<uint32_t>();
+    valid = valid && reader.ok() && unused_count <= TWO_ENTITY_MAX;
+    unused_entities.resize(valid ? unused_count : 0);
+    reader.read((void *)unused_entities.data(),
+                sizeof(Entity) * unused_entities.size());
+    valid = valid && reader.ok()
+            && valid_entity_ids(alive_count, entities, unused_entities);
+
+    auto block_count = reader.read<uint32_t>();
+    std::vector<Entity> loaded;
+
+    for (uint32_t i = 0; valid && i < block_count; ++i) {
+        auto id = reader.read<uint32_t>();
+        auto size = reader.read<uint32_t>();
+        auto block_size = reader.read<uint64_t>();
+        auto block_start = reader.tell();
+
+        if (!reader.ok() || block_size == 0) {
+            // Component type could not be serialized when saved
+            continue;
+        }
+        ComponentType type;
+        auto *a = find_serialized_component(id, type);
+        if (a == nullptr || a->component_size() != size) {
+            log_warn("Snapshot: skipping unknown component type %x", id);
+            reader.skip(block_size);
+            continue;
+        }
+        loaded.clear();
+        if (!a->load(reader, loaded)
+            || reader.tell() - block_start != block_size) {
+            valid = false;
+            break;
+        }
+        for (auto entity : loaded) {
+            if (entity >= TWO_ENTITY_MAX) {
+                valid = false;
+                break;
+            }
+            mutable_mask(entity).set(type);
+        }
+    }
+
+    if (!valid || !reader.ok()) {
+        log_error("Snapshot is corrupted");
+        for (auto &a : components) {
+            if (a != nullptr) {
+                a->clear();
+            }
+        }
+        entity_masks.clear();
+        entities.clear();
+        unused_entities.clear();
+        alive_count = 0;
+        rebuild_view_caches();
+        restart_recording();
+        return false;
+    }
+    rebuild_view_caches();
+    restart_recording();
+    return true;
+}
+
+std::unique_ptr<World> World::clone() const {
+    TWO_PROFILE_FUNC();
+    std::unique_ptr<World> world(new World);
+    world->copy_state(*this);
+    return world;
+}
+
+void World::restore(const World &world) {
+    TWO_PROFILE_FUNC();
+    ASSERT(&world != this);
+    copy_state(world);
+    rebuild_view_caches();
+    restart_recording();
+}
+
+void World::copy_state(const World &world) {
+    // Worlds cloned from each other register component types in the same
+    // order, in which case the existing registry and cached views are kept.
+    bool same_types = world.component_type_index <= component_type_index;
+    for (const auto &type_it : world.component_types) {
+        auto match = component_types.find(type_it.first);
+        if (match == component_types.end()
+            || match->second != type_it.second) {
+            same_types = false;
+            break;
+        }
+    }
+    if (!same_types) {
+        // Cached view masks would refer to the wrong component types
+        view_cache.clear();
+        component_types = world.component_types;
+        component_type_index = world.component_type_index;
+        for (auto &a : components) {
+            a.reset();
+        }
+    }
+    for (size_t i = 0; i < component_type_index; ++i) {
+        if (i < world.component_type_index) {
+            components[i] = world.components[i]->clone();
+        } else {
+            // Registered after the other world was cloned
+            components[i]->clear();
+        }
+    }
+    entity_masks = world.entity_masks;
+    alive_count = world.alive_count;
+    entities = world.entities;
+    unused_entities = world.unused_entities;
+
+    // The other world's destroyed entities no longer have components,
+    // only its caches still refer to them.
+    for (const auto &destroyed : world.destroyed_entities) {
+        unused_entities.push_back(destroyed.entity);
+    }
+    destroyed_entities.clear();
+}
+
+IComponentArray *World::find_serialized_component(uint32_t serial_id,
+                                                  ComponentType &type) {
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < component_type_index; ++i) {
+            if (components[i]->serial_id() == serial_id) {
+                type = ComponentType(i);
+                return components[i].get();
+            }
+        }
+        // Component type has not been used in this world yet
+        auto factory = internal::find_component_factory(serial_id);
+        if (factory == nullptr) {
+            return nullptr;
+        }
+        factory(this);
+    }
+    return nullptr;
+}
+
+void World::rebuild_view_caches() {
+    TWO_PROFILE_FUNC();
+    for (auto &cached : view_cache) {
+        cached.second.entities.clear();
+        cached.second.diffs.clear();
+        cached.second.lookup.clear();
+    }
+    // Single pass over all entities, every cache is filled at once.
+    for (auto entity : entities) {
+        const auto &mask = get_mask(entity);
+        for (auto &cached : view_cache) {
+            if ((mask & cached.first) != cached.first) {
+                continue;
+            }
+            cached.second.entities.push_back(entity);
+            cached.second.lookup.insert(entity);
+        }
+    }
+}
+
+void World::start_recording(size_t frames) {
+    ASSERT(frames > 0);
+    recorder.reset(new Recorder);
+    recorder->frames.resize(frames);
+    recorder->current.frame = 1;
+    track_changes(&recorder->current);
+}
+
+void World::stop_recording() {
+    track_changes(nullptr);
+    recorder.reset();
+}
+
+void World::commit_frame() {
+    if (recorder == nullptr) {
+        return;
+    }
+    TWO_PROFILE_FUNC();
+    auto &log = recorder->current;
+
+    // Components that were unpacked but not changed do not need to be
+    // restored.
+    size_t kept = 0;
+    for (const auto &change : log.changes) {
+        if (change.existed
+            && components[change.type]->unchanged(
+                change.entity, log.data, change.offset, change.size)) {
+            continue;
+        }
+        log.changes[kept++] = change;
+    }
+    log.changes.resize(kept);
+
+    // Reuse the memory of the oldest frame for the next one
+    auto frame = log.frame;
+    std::swap(log, recorder->frames[recorder->next]);
+    log.clear();
+    log.frame = frame + 1;
+
+    recorder->next = (recorder->next + 1) % recorder->frames.size();
+    recorder->count = std::min(recorder->count + 1, recorder->frames.size());
+}
+
+bool World::rewind(size_t frames) {
+    if (recorder == nullptr || frames > recorder->count) {
+        return false;
+    }
+    TWO_PROFILE_FUNC();
+    auto &log = recorder->current;
+    log.paused = true;
+
+    undo_frame(log);
+    for (size_t i = 0; i < frames; ++i) {
+        auto size = recorder->frames.size();
+        recorder->next = (recorder->next + size - 1) % size;
+        auto &committed = recorder->frames[recorder->next];
+        undo_frame(committed);
+        committed.clear();
+    }
+    recorder->count -= frames;
+
+    // Components restored in this frame must be recorded again
+    auto frame = log.frame;
+    log.clear();
+    log.frame = frame + 1;
+    log.paused = false;
+
+    rebuild_view_caches();
+    return true;
+}
+
+void World::track_changes(internal::FrameLog *log) {
+    for (size_t i = 0; i < component_type_index; ++i) {
+        components[i]->track_changes(log, ComponentType(i));
+    }
+}
+
+void World::restart_recording() {
+    if (recorder == nullptr) {
+        return;
+    }
+    auto frame = recorder->current.frame;
+    recorder->current.clear();
+    recorder->current.frame = frame + 1;
+    for (auto &committed : recorder->frames) {
+        committed.clear();
+    }
+    recorder->next = 0;
+    recorder->count = 0;
+    // Component arrays may have been replaced
+    track_changes(&recorder->current);
+}
+
+void World::undo_frame(const internal::FrameLog &log) {
+    using EntityOp = internal::FrameLog::EntityOp;
+
+    // Read in place, the log is not changed while it is undone
+    SnapshotReader reader(log.data);
+    // Each component is only recorded once per frame, so the order they
+    // are restored in does not matter.
+    for (const auto &change : log.changes) {
+        auto *a = components[change.type].get();
+        if (change.existed) {
+            reader.seek(change.offset);
+            a->restore(change.entity, reader);
+            mutable_mask(change.entity).set(change.type);
+        } else {
+            a->remove(change.entity);
+            mutable_mask(change.entity).reset(change.type);
+        }
+    }
+    ASSERT(reader.ok());
+
+    for (auto it = log.ops.rbegin(); it != log.ops.rend(); ++it) {
+        const auto &op = *it;
+        switch (op.kind) {
+        case EntityOp::Create:
+            // Same as destroying it, the re-simulation may give the id
+            // to a different entity
+            timer_wheel.cancel_owner(op.entity);
+            entities.resize(op.index);
+            alive_count = op.alive_count;
+            if (op.reused) {
+                unused_entities.push_back(op.entity);
+            }
+            break;
+        case EntityOp::Destroy:
+            ASSERT(!destroyed_entities.empty()
+                   && destroyed_entities.back().entity == op.entity);
+            destroyed_entities.pop_back();
+            entities.push_back(op.entity);
+            std::swap(entities[op.index], entities.back());
+            break;
+        case EntityOp::Collect: {
+            // Ids were recycled in the order they were destroyed
+            ASSERT(op.index <= unused_entities.size());
+            auto first = unused_entities.end() - op.index;
+            for (auto id = first; id != unused_entities.end(); ++id) {
+                DestroyedEntity destroyed;
+                destroyed.entity = *id;
+                destroyed_entities.emplace_back(std::move(destroyed));
+            }
+            unused_entities.erase(first, unused_entities.end());
+            break;
+        }
+        }
+    }
 }
 
 void World::apply_diffs_to_cache(EntityCache *cache) {
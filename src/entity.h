@@ -29,10 +29,15 @@
 #include <memory>
 #include <algorithm>
 #include <climits>
+#include <limits>
+#include <string>
+#include <functional>
 
 #include "debug.h"
 #include "optional.h"
 #include "mathf.h"
+#include "snapshot.h"
+#include "timer.h"
 
 // Allows size of entity types (identifiers) to be configured
 #ifndef TWO_ENTITY_INT_TYPE
@@ -72,6 +77,10 @@ struct TypeIdInfo {
 template <typename T>
 const T *const TypeIdInfo<T>::value = nullptr;
 
+// Extracts the type name from a function signature generated by
+// `TWO_PRETTY_FUNCTION` in `type_name()`.
+std::string parse_type_name(const char *signature);
+
 } // internal
 
 // Compile time id for a given type.
@@ -85,6 +94,16 @@ constexpr type_id_t type_id() {
           typename std::remove_reference<T>::type>::type>::type>::type>::value;
 }
 
+// Returns a readable name for T. The name is generated by the compiler so
+// it may differ between compilers, but it will not change between builds
+// unless the type is renamed.
+template <typename T>
+const char *type_name() {
+    static const std::string name =
+        internal::parse_type_name(TWO_PRETTY_FUNCTION);
+    return name.c_str();
+}
+
 // A unique identifier representing each entity in the world.
 using Entity = TWO_ENTITY_INT_TYPE;
 static_assert(std::is_integral<Entity>(), "Entity must be integral");
@@ -111,14 +130,40 @@ struct Active {};
 
 class World;
 
+namespace internal {
+struct FrameLog;
+} // internal
+
 // Base class for all systems. The lifetime of systems is managed by a World.
 class System {
 public:
+    // Disabled systems are not updated or drawn by `World::update_systems`
+    // and `World::draw_systems`.
+    bool enabled = true;
+
+    // Seconds between updates, 0 to update every frame. A system with an
+    // interval is updated with `dt` equal to the interval, as many times as
+    // the interval fits in the time passed, at most 4 times per frame so a
+    // long frame does not cause a burst of updates. Useful to run expensive
+    // systems such as AI at a lower rate than the rest of the world.
+    float update_interval = 0.0f;
+
     virtual ~System() = default;
     virtual void load(World *world);
     virtual void update(World *world, float dt);
     virtual void draw(World *world);
     virtual void unload(World *world);
+
+    // Type name of the system, used by the profiler.
+    inline const char *name() const { return system_name; }
+
+private:
+    friend class World;
+
+    const char *system_name = "System";
+
+    // Time since the system was last updated, see `update_interval`.
+    float time_since_update = 0.0f;
 };
 
 class IComponentArray {
@@ -126,10 +171,192 @@ public:
     virtual ~IComponentArray() = default;
     virtual void remove(Entity entity) = 0;
     virtual void copy(Entity dst, Entity src) = 0;
+
+    // Removes all components.
+    virtual void clear() = 0;
+
+    // Identifies the component type in a snapshot. Unlike `type_id` this
+    // value is the same between different runs of the program.
+    virtual uint32_t serial_id() const = 0;
+
+    // Size of a single component.
+    virtual uint32_t component_size() const = 0;
+
+    // Writes all components and the entities they belong to as contiguous
+    // blocks. Returns false if the component type cannot be serialized,
+    // see `Serializer`.
+    virtual bool save(SnapshotWriter &writer) const = 0;
+
+    // Replaces all components with the ones saved by `save`. Entities
+    // that now own a component are appended to `loaded`.
+    virtual bool load(SnapshotReader &reader, std::vector<Entity> &loaded) = 0;
+
+    // Returns a copy of this array that shares its pages with this array.
+    // See `World::clone`.
+    virtual std::unique_ptr<IComponentArray> clone() const = 0;
+
+    // Records the previous value of each component the first time it is
+    // changed in a frame. Pass nullptr to stop recording. See
+    // `World::start_recording`.
+    virtual void track_changes(internal::FrameLog *log, ComponentType type) = 0;
+
+    // Adds or replaces a component with one recorded in a frame log.
+    virtual void restore(Entity entity, SnapshotReader &reader) = 0;
+
+    // Returns true if the component attached to an entity is the same as
+    // the one recorded at `offset` in a frame log.
+    virtual bool unchanged(Entity entity, SnapshotWriter &data,
+                           size_t offset, size_t size) = 0;
+};
+
+namespace internal {
+
+// Largest power of two number of items that fit in `bytes`, at least 1.
+constexpr size_t page_capacity(size_t item_size, size_t bytes = 4096) {
+    return item_size * 2 > bytes ? 1 : 2 * page_capacity(item_size * 2, bytes);
+}
+
+// A list of fixed size pages that may be shared between worlds created
+// with `World::clone()`. Pages are copied the first time they are modified
+// while shared, pages that are only read are never copied.
+template <typename Page>
+class PageTable {
+public:
+    // Returns nullptr if the page has not been created.
+    inline const Page *get(size_t index) const {
+        return index < pages.size() ? pages[index].get() : nullptr;
+    }
+
+    // Returns a page that is not shared with any other table, creating or
+    // copying the page if needed.
+    inline Page *get_mut(size_t index) {
+        if (index >= pages.size()) {
+            pages.resize(index + 1);
+        }
+        auto &page = pages[index];
+        if (page == nullptr) {
+            page = std::make_shared<Page>();
+        } else if (page.use_count() > 1) {
+            page = std::make_shared<Page>(*page);
+        }
+        return page.get();
+    }
+
+    inline size_t size() const { return pages.size(); }
+
+    inline void pop_back() { pages.pop_back(); }
+
+    inline void clear() { pages.clear(); }
+
+private:
+    std::vector<std::shared_ptr<Page>> pages;
 };
 
+// Changes made to a world during a single frame. See
+// `World::start_recording`.
+struct FrameLog {
+    // A component before it was first changed in the frame.
+    struct Change {
+        Entity entity;
+        ComponentType type;
+        // False if the entity did not have the component.
+        bool existed;
+        // Location of the serialized component in `data`.
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct EntityOp {
+        enum Kind { Create, Destroy, Collect };
+        Kind kind;
+        Entity entity;
+        // Create: size of the entity list before the entity was added.
+        // Destroy: index of the entity in the entity list.
+        // Collect: number of entity ids that were recycled.
+        uint32_t index;
+        // Create: alive count before the entity was created.
+        uint32_t alive_count;
+        // Create: the id was taken from the unused entities.
+        bool reused;
+    };
+
+    // Changes are only recorded once per entity in each frame.
+    uint32_t frame = 0;
+
+    // Set while a frame is being undone.
+    bool paused = false;
+
+    std::vector<Change> changes;
+
+    // In the order they happened.
+    std::vector<EntityOp> ops;
+
+    SnapshotWriter data;
+
+    inline void clear() {
+        changes.clear();
+        ops.clear();
+        data.reset();
+    }
+};
+
+// Recording state of a component array. Copies of an array, such as the
+// ones made by `World::clone`, do not record changes.
+struct ChangeTracker {
+    FrameLog *log = nullptr;
+    ComponentType type = 0;
+
+    // Frame in which each entity's component was last recorded.
+    std::vector<uint32_t> touched;
+
+    ChangeTracker() = default;
+    ChangeTracker(const ChangeTracker &) {}
+    ChangeTracker &operator=(const ChangeTracker &) {
+        log = nullptr;
+        touched.clear();
+        return *this;
+    }
+};
+
+// Returns a number that has not been returned before.
+uint64_t next_array_id();
+
+// Versions of the pages in a component array, see
+// `ComponentArray::page_version`. Copies of an array get a new id so an
+// index built from one array is never mistaken for an index of another.
+struct PageVersions {
+    uint64_t id = next_array_id();
+    uint64_t counter = 0;
+    std::vector<uint64_t> versions;
+
+    PageVersions() = default;
+    PageVersions(const PageVersions &other)
+        : id{next_array_id()}
+        , counter{other.counter}
+        , versions{other.versions} {}
+
+    PageVersions &operator=(const PageVersions &other) {
+        id = next_array_id();
+        counter = other.counter;
+        versions = other.versions;
+        return *this;
+    }
+
+    inline void touch(size_t page) {
+        if (page >= versions.size()) {
+            versions.resize(page + 1, 0);
+        }
+        versions[page] = ++counter;
+    }
+};
+
+} // internal
+
 // Manages all instances of a component type and keeps track of which
 // entity a component is attached to.
+//
+// Components are packed into fixed size pages, so the array stays dense
+// and arrays can be cloned by sharing pages. See `World::clone`.
 template <typename T>
 class ComponentArray : public IComponentArray {
 public:
@@ -140,17 +367,24 @@ public:
     // number of entities.
     using PackedSizeType = TWO_ENTITY_INT_TYPE;
 
-    // Approximate amount of memory used when the array is initialized,
-    // used to reduce the amount of initial allocations.
-    static constexpr int MinSize = 2048;
+    static_assert(TWO_ENTITY_MAX - 1 < std::numeric_limits<PackedSizeType>::max(),
+                  "TWO_ENTITY_INT_TYPE is too small for TWO_ENTITY_MAX");
 
-    ComponentArray();
+    // Number of components in each page.
+    static constexpr size_t PageSize = internal::page_capacity(sizeof(T));
+
+    // Number of entities in each page of the entity to packed index map.
+    static constexpr size_t SparsePageSize = 256;
 
     // Returns a component of type T given an Entity.
     // Note: References returned by this function are only guaranteed to be
     // valid during the frame in which the component was read, after
     // that the component may become invalidated. Don't hold reference.
-    inline T &read(Entity entity);
+    inline const T &read(Entity entity) const;
+
+    // Same as `read` but the component may be modified. If the page holding
+    // the component is shared with a cloned array the page is copied first.
+    inline T &modify(Entity entity);
 
     // Returns the memory contents of a component. May be useful for debugging,
     // prefer using the non virtual `read`. The memory returned is only
@@ -172,30 +406,106 @@ public:
 
     void copy(Entity dst, Entity src) override;
 
+    void clear() override;
+
+    uint32_t serial_id() const override;
+
+    uint32_t component_size() const override { return sizeof(T); }
+
+    bool save(SnapshotWriter &writer) const override;
+
+    bool load(SnapshotReader &reader, std::vector<Entity> &loaded) override;
+
+    std::unique_ptr<IComponentArray> clone() const override;
+
+    void track_changes(internal::FrameLog *log, ComponentType type) override;
+
+    void restore(Entity entity, SnapshotReader &reader) override;
+
+    bool unchanged(Entity entity, SnapshotWriter &data,
+                   size_t offset, size_t size) override;
+
     inline bool contains(Entity entity) const;
 
     // Returns the number of valid components in the packed array.
     size_t count() const { return packed_count; };
 
+    // Components are stored in pages of `PageSize` components. Systems that
+    // keep their own index of components can compare page versions with
+    // the ones they last saw and only look at pages that have changed.
+    inline size_t page_count() const { return pages.size(); }
+
+    // Number of components in a page.
+    inline size_t page_size(size_t page) const {
+        return pages.get(page)->components.size();
+    }
+
+    inline const T *page_components(size_t page) const {
+        return pages.get(page)->components.data();
+    }
+
+    // The entity each component in a page belongs to.
+    inline const Entity *page_entities(size_t page) const {
+        return pages.get(page)->entities;
+    }
+
+    // Changes every time a component in the page is added, removed or
+    // accessed with `modify`. Versions are never reused by an array.
+    inline uint64_t page_version(size_t page) const {
+        return page_versions.versions[page];
+    }
+
+    // Identifies this array, copies of an array have a different id.
+    inline uint64_t id() const { return page_versions.id; }
+
 private:
-    // All instances of component type T are stored in a contiguous vector.
-    std::vector<T> packed_array;
+    static constexpr PackedSizeType InvalidIndex =
+        std::numeric_limits<PackedSizeType>::max();
+
+    struct Page {
+        // Components are only constructed when they are added so T does
+        // not need a default constructor.
+        std::vector<T> components;
+
+        // Maps an index in the page to an Entity.
+        Entity entities[PageSize];
+
+        Page() { components.reserve(PageSize); }
+    };
 
-    // Maps an Entity id to an index in the packed array.
-    std::unordered_map<Entity, PackedSizeType> entity_to_packed;
+    struct SparsePage {
+        // Maps an Entity id to an index in the packed array.
+        PackedSizeType packed[SparsePageSize];
 
-    // Maps an index in the packed component array to an Entity.
-    std::unordered_map<PackedSizeType, Entity> packed_to_entity;
+        SparsePage() { std::fill_n(packed, SparsePageSize, InvalidIndex); }
+    };
+
+    // All instances of component type T, the first `packed_count` entries
+    // are valid.
+    internal::PageTable<Page> pages;
 
-    // Number of valid entries in the packed array, other entries beyond
-    // this count may be uninitialized or invalid data.
+    // Indexed by Entity id.
+    internal::PageTable<SparsePage> sparse;
+
+    // Number of valid entries in the packed array.
     size_t packed_count = 0;
+
+    internal::ChangeTracker tracker;
+
+    internal::PageVersions page_versions;
+
+    inline PackedSizeType packed_index(Entity entity) const;
+
+    // Records a component before it is changed if the world is recording.
+    inline void record_change(Entity entity);
+
+    inline void set_packed_index(Entity entity, PackedSizeType index);
 };
 
 // A world holds a collection of systems, components and entities.
 class World {
 public:
-    World() = default;
+    World();
 
     World(const World &) = delete;
     World &operator=(const World &) = delete;
@@ -209,13 +519,21 @@ public:
     virtual void load();
 
     // Called once per per frame after all events have been handled and
-    // before draw.
+    // before draw. By default calls `update_systems()`.
     //
-    // > Systems are not updated on their own, you should call update
-    // on systems here. Note that you should not call `draw()` on
-    // each system since that is handled in the main loop.
+    // > When overriding this function call `update_systems()` to update
+    // systems. Note that you should not call `draw()` on each system
+    // since that is handled in the main loop.
     virtual void update(float dt);
 
+    // Updates each enabled system in order, following each system's
+    // `update_interval`. If `TWO_PERFORMANCE_PROFILING` is enabled each
+    // update is timed with the system's name.
+    void update_systems(float dt);
+
+    // Draws each enabled system in order. Called by the main loop.
+    void draw_systems();
+
     // Called before a world is unloaded.
     //
     // > Note: When overriding this function you need to call unload
@@ -295,11 +613,22 @@ public:
     template <typename Component>
     inline Component &unpack(Entity entity);
 
+    // Same as `unpack` but the component cannot be modified. Prefer this
+    // function when only reading a component, unlike `unpack` it will never
+    // copy memory shared with a cloned world (see `clone()`).
+    template <typename Component>
+    inline const Component &read(Entity entity) const;
+
     // Returns true if a component of the given type is associated with an
     // entity. This is a cheap operation.
     template <typename Component>
     inline bool has_component(Entity entity);
 
+    // Returns the array holding every component of a type, or nullptr if
+    // the type has not been registered.
+    template <typename Component>
+    inline const ComponentArray<Component> *component_array() const;
+
     // Removes a component from an entity. Removing components invalidates
     // the cache.
     //
@@ -372,14 +701,31 @@ public:
     template <class T>
     T* make_system(T *system);
 
-    // Adds a system to the world before another system if it exists.
-    // `Before` is an existing system.
-    // `T` is the system to be added before an existing system.
+    // Adds a system to the world that will always run before systems of
+    // type `Before`, including ones added later. See `order_systems`.
     template <class Before, class T, typename... Args>
     T *make_system_before(Args &&...args);
 
+    // Adds a system to the world that will always run after systems of
+    // type `After`, including ones added later. See `order_systems`.
+    template <class After, class T, typename... Args>
+    T *make_system_after(Args &&...args);
+
+    // Makes systems of type `Before` always update and draw before systems
+    // of type `After`, including systems added later. Systems are sorted
+    // with a stable topological sort, so systems that are not constrained
+    // keep the order they were added in. A constraint that would create a
+    // cycle is ignored with a warning.
+    //
+    // > Systems are reordered when a system or a constraint is added. If
+    // this happens during an update some systems may be skipped or updated
+    // twice in that frame.
+    template <class Before, class After>
+    void order_systems();
+
     // Returns the first system that matches the given type.
     // System returned will be `nullptr` if it is not found.
+    // This is a constant time lookup.
     template <class T>
     T *get_system();
 
@@ -402,6 +748,81 @@ public:
     template <typename Component>
     inline ComponentType find_or_register_component();
 
+    // Creates a new world with a copy of all entities and components in
+    // this world. Components are stored in pages that are shared between
+    // both worlds until either world modifies them, so cloning is cheap and
+    // a clone only uses memory for the pages that are written to after it
+    // was created. Use `read()` instead of `unpack()` where possible to
+    // avoid copying pages that are only read.
+    //
+    // The clone is a plain World, systems are not cloned. A clone may be
+    // used to simulate ahead by adding systems to it, or kept as an undo
+    // state and applied back with `restore()`.
+    //
+    //     undo_stack.push_back(world->clone());
+    //     ...
+    //     world->restore(*undo_stack.back());
+    //     undo_stack.pop_back();
+    //
+    std::unique_ptr<World> clone() const;
+
+    // Replaces all entities and components in this world with the ones in
+    // another world, sharing pages the same way as `clone()`. Systems are
+    // not changed and cached views are rebuilt.
+    void restore(const World &world);
+
+    // Writes all entities and components to a snapshot. Component types
+    // that cannot be serialized (see `Serializer`) are skipped. Systems
+    // are not part of the snapshot.
+    void save_snapshot(SnapshotWriter &writer);
+
+    // Replaces all entities and components in the world with the ones in
+    // a snapshot created with `save_snapshot`. Entity masks and cached
+    // views are rebuilt once all components are loaded. Returns false if
+    // the snapshot is invalid, in which case the world will be empty.
+    bool load_snapshot(SnapshotReader &reader);
+
+    // Starts recording every change made to entities and components so
+    // that the world can be rewound with `rewind()`. Only the components
+    // that are written to are recorded, the first time they change in a
+    // frame, so the cost of recording is proportional to the number of
+    // writes rather than the size of the world. The last `frames` frames
+    // are kept in a ring buffer.
+    //
+    // Components are recorded with their `Serializer`, component types that
+    // cannot be serialized are not recorded and will not be rewound.
+    //
+    //     world->start_recording(8);
+    //     ...
+    //     // Rollback to the last confirmed frame and simulate again
+    //     world->rewind(frames_since_confirmed);
+    //     for (auto &input : inputs) world->update(dt);
+    //
+    void start_recording(size_t frames);
+
+    // Stops recording and discards all recorded frames.
+    void stop_recording();
+
+    inline bool is_recording() const { return recorder != nullptr; }
+
+    // Number of complete frames that can be rewound.
+    inline size_t recorded_frames() const {
+        return recorder != nullptr ? recorder->count : 0;
+    }
+
+    // Ends the current recorded frame. Components that were changed but
+    // have the same value they had at the start of the frame are dropped.
+    // Called by the main loop after `collect_unused_entities()`, does
+    // nothing if the world is not recording.
+    void commit_frame();
+
+    // Undoes all changes made since the last committed frame and then undoes
+    // `frames` committed frames. Returns false without changing the world
+    // if fewer frames have been recorded. Cached views are rebuilt, so
+    // entities in a view may be in a different order than before. Timers
+    // are not rewound, see `after()`.
+    bool rewind(size_t frames);
+
     // Recycles entity ids so that they can be safely reused. This function
     // exists to ensure we don't reuse entity ids that are still present in
     // some cache even though the entity has been destroyed. This can happen
@@ -409,6 +830,34 @@ public:
     // Called at the end of each frame.
     void collect_unused_entities();
 
+    // Calls `callback` once after `seconds`. If `entity` is not
+    // `NullEntity` the timer is cancelled when the entity is destroyed.
+    // Timers are advanced by the main loop before `update()`. They are not
+    // saved in snapshots, are not copied by `clone()` and are not rewound
+    // by `rewind()`: rewinding the creation of an entity cancels its
+    // timers, and timers cancelled by destroying an entity are not
+    // restored when the destruction is rewound.
+    //
+    //     world->after(0.5f, [world, e]() { world->destroy_entity(e); }, e);
+    //
+    Timer after(float seconds, const std::function<void()> &callback,
+                Entity entity = NullEntity);
+
+    // Same as `after()` but calls `callback` every `seconds` until the
+    // timer is cancelled.
+    Timer every(float seconds, const std::function<void()> &callback,
+                Entity entity = NullEntity);
+
+    // Cancels a timer. Returns false if the timer has already fired or
+    // has been cancelled.
+    bool cancel_timer(Timer timer);
+
+    // Advances timers by `dt` seconds and calls the callbacks of timers
+    // that expire. Called by the main loop before `update()`.
+    void update_timers(float dt);
+
+    inline TimerWheel &timers() { return timer_wheel; }
+
 private:
     // Used to speed up entity lookups
     struct EntityCache {
@@ -435,9 +884,22 @@ private:
     std::vector<System *> active_systems;
 
     // Kept separate since most of the time we just want to iterate through
-    // all the systems and do not need to know their types.
+    // all the systems and do not need to know their types. Always the same
+    // size and order as `active_systems`.
     std::vector<type_id_t> active_system_types;
 
+    // Maps a system type to the index of the first system of that type in
+    // `active_systems`. Rebuilt when systems are added, removed or sorted.
+    std::unordered_map<type_id_t, size_t> system_index;
+
+    struct SystemOrder {
+        type_id_t before;
+        type_id_t after;
+    };
+
+    // Constraints added with `order_systems`.
+    std::vector<SystemOrder> system_order;
+
     // Contains available entity ids. When creating entities check if this
     // is not empty, otherwise use alive_count + 1 as the new id.
     std::vector<Entity> unused_entities;
@@ -455,23 +917,130 @@ private:
     // Index with component index from component_types[type]
     std::array<std::unique_ptr<IComponentArray>, TWO_COMPONENT_MAX> components;
 
-    // Masks for all entities.
-    std::array<EntityMask, TWO_ENTITY_MAX> entity_masks = {0};
+    struct MaskPage {
+        static constexpr size_t Size = 256;
+        EntityMask masks[Size];
+    };
+
+    // Masks for all entities, indexed by entity id.
+    internal::PageTable<MaskPage> entity_masks;
+
+    // Timers added with `after` and `every`, owned by an entity or by 0.
+    TimerWheel timer_wheel;
 
     std::unordered_map<type_id_t, ComponentType> component_types;
 
+    struct Recorder {
+        // Changes in the frame that has not been committed yet.
+        internal::FrameLog current;
+
+        // Ring buffer of committed frames.
+        std::vector<internal::FrameLog> frames;
+
+        // Index in `frames` where the next frame will be committed.
+        size_t next = 0;
+        size_t count = 0;
+    };
+
+    // Only exists while recording, see `start_recording`.
+    std::unique_ptr<Recorder> recorder;
+
     void apply_diffs_to_cache(EntityCache *cache);
     void invalidate_cache(EntityCache *cache, EntityCache::Diff &&diff);
+
+    inline EntityMask &mutable_mask(Entity entity);
+
+    // Copies entities and components from another world sharing pages.
+    void copy_state(const World &world);
+
+    // Rebuilds all cached views from the entity masks.
+    void rebuild_view_caches();
+
+    // Points every component array at the current frame log.
+    void track_changes(internal::FrameLog *log);
+
+    // Discards recorded frames after the world has been replaced by
+    // `restore` or `load_snapshot`.
+    void restart_recording();
+
+    // Reverts all changes in a frame log.
+    void undo_frame(const internal::FrameLog &log);
+
+    // Adds a system to the end of the system list and sorts systems if
+    // there are ordering constraints.
+    void add_system(System *system, type_id_t type, const char *name);
+
+    // Adds an ordering constraint, see `order_systems`.
+    void add_system_order(type_id_t before, type_id_t after,
+                          const char *before_name, const char *after_name);
+
+    // Sorts systems by their ordering constraints. Returns false if the
+    // constraints have a cycle, in which case the order is unchanged.
+    bool sort_systems();
+
+    // True if systems of type `to` must run after systems of type `from`
+    // through one or more constraints, or if both are the same type.
+    bool system_order_reaches(type_id_t from, type_id_t to) const;
+
+    void rebuild_system_index();
+
+    // Finds the component array for a type saved in a snapshot, the
+    // component will be registered if needed.
+    IComponentArray *find_serialized_component(uint32_t serial_id,
+                                               ComponentType &type);
+};
+
+namespace internal {
+
+using ComponentFactory = void (*)(World *world);
+
+// Remembers how to register a component type given its `serial_id` so
+// that snapshots can be loaded into a world that has not used a component
+// type yet.
+void add_component_factory(uint32_t serial_id, ComponentFactory factory);
+
+ComponentFactory find_component_factory(uint32_t serial_id);
+
+// Loads a block of components into an empty vector. Only defined for
+// components that can be serialized since T must be default constructible.
+template <typename T, bool Enabled = Serializer<T>::enabled>
+struct PackedSerializer {
+    static bool load(SnapshotReader &, std::vector<T> &, size_t) {
+        return false;
+    }
+};
+
+template <typename T>
+struct PackedSerializer<T, true> {
+    static bool load(SnapshotReader &reader,
+                     std::vector<T> &components,
+                     size_t count) {
+        components.resize(count);
+        Serializer<T>::load(reader, components.data(), count);
+        return reader.ok();
+    }
 };
 
+} // internal
+
 inline const EntityMask &World::get_mask(Entity entity) const {
-    return entity_masks[entity];
+    static const EntityMask empty;
+    const auto *page = entity_masks.get(entity / MaskPage::Size);
+    if (page == nullptr) {
+        return empty;
+    }
+    return page->masks[entity % MaskPage::Size];
+}
+
+inline EntityMask &World::mutable_mask(Entity entity) {
+    return entity_masks.get_mut(entity / MaskPage::Size)
+        ->masks[entity % MaskPage::Size];
 }
 
 template <typename Component>
 Component &World::pack(Entity entity, const Component &component) {
-    auto current_mask = entity_masks[entity];
-    auto &mask = entity_masks[entity];
+    auto current_mask = get_mask(entity);
+    auto &mask = mutable_mask(entity);
 
     // Component may not have been regisered yet
     auto type = find_or_register_component<Component>();
@@ -517,6 +1086,17 @@ inline Component &World::unpack(Entity entity) {
 
     auto type = component_types[type_id<Component>()];
     auto *a = static_cast<ComponentArray<Component> *>(components[type].get());
+    return a->modify(entity);
+}
+
+template <typename Component>
+inline const Component &World::read(Entity entity) const {
+    auto type_it = component_types.find(type_id<Component>());
+    // Assume component was registered when it was packed
+    ASSERT(type_it != component_types.end());
+
+    const auto *a = static_cast<const ComponentArray<Component> *>(
+        components[type_it->second].get());
     return a->read(entity);
 }
 
@@ -534,6 +1114,16 @@ inline bool World::has_component(Entity entity) {
     return a->contains(entity);
 }
 
+template <typename Component>
+inline const ComponentArray<Component> *World::component_array() const {
+    auto type_it = component_types.find(type_id<Component>());
+    if (type_it == component_types.end()) {
+        return nullptr;
+    }
+    return static_cast<const ComponentArray<Component> *>(
+        components[type_it->second].get());
+}
+
 template <typename Component>
 void World::remove_component(Entity entity) {
     // Assume component was registered when it was packed
@@ -560,7 +1150,7 @@ void World::remove_component(Entity entity) {
         E_MSG("%s no longer includes entity #%x",
               cached.first.to_string().c_str(), entity);
     }
-    entity_masks[entity].reset(type);
+    mutable_mask(entity).reset(type);
 }
 
 inline void World::set_active(Entity entity, bool active) {
@@ -613,7 +1203,7 @@ const std::vector<Entity> &World::view(bool include_inactive) {
     std::unordered_set<Entity> lookup;
 
     for (auto entity : entities) {
-        if ((mask & entity_masks[entity]) == mask) {
+        if ((mask & get_mask(entity)) == mask) {
             cache.push_back(entity);
             lookup.insert(entity);
         }
@@ -654,31 +1244,30 @@ T *World::make_system(T *system) {
                   active_systems.end(), system) == active_systems.end(),
         "%p points to a system already in the world", (void *)system);
 
-    active_systems.push_back(system);
-    active_system_types.push_back(type_id<T>());
+    add_system(system, type_id<T>(), type_name<T>());
     system->load(this);
     return system;
 }
 
 template <class Before, class T, typename... Args>
 T *World::make_system_before(Args &&...args) {
-    static_assert(std::is_convertible<T *, System *>(),
-                  "Type cannot be converted to a System");
-    ASSERT(active_systems.size() == active_system_types.size());
+    order_systems<T, Before>();
+    return make_system<T>(std::forward<Args>(args)...);
+}
 
-    auto pos = std::find(active_system_types.begin(),
-                         active_system_types.end(),
-                         type_id<Before>());
+template <class After, class T, typename... Args>
+T *World::make_system_after(Args &&...args) {
+    order_systems<After, T>();
+    return make_system<T>(std::forward<Args>(args)...);
+}
 
-    auto *system = new T(std::forward<Args>(args)...);
-    if (pos == active_system_types.end()) {
-        log("not found");
-        return system;
-    }
-    size_t index = std::distance(pos, active_system_types.end()) - 1;
-    active_systems.insert(active_systems.begin() + index, system);
-    active_system_types.insert(pos, type_id<T>());
-    return system;
+template <class Before, class After>
+void World::order_systems() {
+    static_assert(std::is_convertible<Before *, System *>()
+                  && std::is_convertible<After *, System *>(),
+                  "Type cannot be converted to a System");
+    add_system_order(type_id<Before>(), type_id<After>(),
+                     type_name<Before>(), type_name<After>());
 }
 
 template <class T>
@@ -687,15 +1276,11 @@ T *World::get_system() {
                   "Type cannot be converted to a System");
     ASSERT(active_systems.size() == active_system_types.size());
 
-    auto pos = std::find(active_system_types.begin(),
-                         active_system_types.end(),
-                         type_id<T>());
-
-    if (pos == active_system_types.end()) {
+    auto match = system_index.find(type_id<T>());
+    if (match == system_index.end()) {
         return nullptr;
     }
-    auto index = std::distance(active_system_types.begin(), pos);
-    return static_cast<T *>(active_systems[index]);
+    return static_cast<T *>(active_systems[match->second]);
 }
 
 template <class T>
@@ -722,6 +1307,18 @@ void World::register_component() {
     component_types.emplace(std::make_pair(type_id<Component>(), i));
     components[i] = std::unique_ptr<ComponentArray<Component>>(
         new ComponentArray<Component>);
+
+    if (recorder != nullptr) {
+        components[i]->track_changes(&recorder->current, ComponentType(i));
+    }
+
+    if (Serializer<Component>::enabled) {
+        internal::add_component_factory(
+            components[i]->serial_id(),
+            [](World *world) {
+                world->find_or_register_component<Component>();
+            });
+    }
 }
 
 template <typename Component>
@@ -735,75 +1332,256 @@ inline ComponentType World::find_or_register_component() {
 }
 
 template <typename T>
-inline ComponentArray<T>::ComponentArray() {
-    packed_array.reserve(next_pow2(MinSize / sizeof(T)));
+constexpr size_t ComponentArray<T>::PageSize;
+
+template <typename T>
+constexpr size_t ComponentArray<T>::SparsePageSize;
+
+template <typename T>
+constexpr typename ComponentArray<T>::PackedSizeType
+ComponentArray<T>::InvalidIndex;
+
+template <typename T>
+inline typename ComponentArray<T>::PackedSizeType
+ComponentArray<T>::packed_index(Entity entity) const {
+    const auto *page = sparse.get(entity / SparsePageSize);
+    if (page == nullptr) {
+        return InvalidIndex;
+    }
+    return page->packed[entity % SparsePageSize];
+}
+
+template <typename T>
+inline void ComponentArray<T>::set_packed_index(Entity entity,
+                                                PackedSizeType index) {
+    sparse.get_mut(entity / SparsePageSize)->packed[entity % SparsePageSize]
+        = index;
+}
+
+template <typename T>
+inline void ComponentArray<T>::record_change(Entity entity) {
+    auto *log = tracker.log;
+    if (LIKELY(log == nullptr) || log->paused
+        || tracker.touched[entity] == log->frame) {
+        return;
+    }
+    tracker.touched[entity] = log->frame;
+
+    internal::FrameLog::Change change;
+    change.entity = entity;
+    change.type = tracker.type;
+    change.existed = contains(entity);
+    change.offset = uint32_t(log->data.size());
+    if (change.existed) {
+        Serializer<T>::save(log->data, &read(entity), 1);
+    }
+    change.size = uint32_t(log->data.size()) - change.offset;
+    log->changes.push_back(change);
+}
+
+template <typename T>
+inline const T &ComponentArray<T>::read(Entity entity) const {
+    ASSERTS(contains(entity), "Missing component for Entity #%x", entity);
+    auto pos = packed_index(entity);
+    return pages.get(pos / PageSize)->components[pos % PageSize];
 }
 
 template <typename T>
-inline T &ComponentArray<T>::read(Entity entity) {
-    ASSERTS(entity_to_packed.find(entity) != entity_to_packed.end(),
-            "Missing component for Entity #%x", entity);
-    return packed_array[entity_to_packed[entity]];
+inline T &ComponentArray<T>::modify(Entity entity) {
+    ASSERTS(contains(entity), "Missing component for Entity #%x", entity);
+    record_change(entity);
+    auto pos = packed_index(entity);
+    page_versions.touch(pos / PageSize);
+    return pages.get_mut(pos / PageSize)->components[pos % PageSize];
 }
 
 template <typename T>
 T &ComponentArray<T>::write(Entity entity, const T &component) {
-    if (entity_to_packed.find(entity) != entity_to_packed.end()) {
+    record_change(entity);
+    if (contains(entity)) {
         // Replace component
-        auto pos = entity_to_packed[entity];
-        packed_array[pos] = component;
-        return packed_array[pos];
+        auto &current = modify(entity);
+        current = component;
+        return current;
     }
 
     ASSERT(packed_count < TWO_ENTITY_MAX);
 
     auto pos = packed_count++;
-    entity_to_packed[entity] = pos;
-    packed_to_entity[pos] = entity;
+    set_packed_index(entity, PackedSizeType(pos));
 
-    if (pos < packed_array.size())
-        packed_array[pos] = component;
-    else
-        packed_array.push_back(component);
-
-    return packed_array[pos];
+    auto *page = pages.get_mut(pos / PageSize);
+    page_versions.touch(pos / PageSize);
+    page->entities[pos % PageSize] = entity;
+    page->components.push_back(component);
+    return page->components.back();
 }
 
 template <typename T>
 void ComponentArray<T>::remove(Entity entity) {
-    if (entity_to_packed.find(entity) == entity_to_packed.end()) {
+    if (!contains(entity)) {
         // This is a no-op since calling this as a virtual member function
         // means there is no way for the caller to check if the entity
         // contains a component. `contains` is not virtual as it needs to
         // be fast.
         return;
     }
+    record_change(entity);
+
     // Move the last component into the empty slot to keep the array packed
     auto last = packed_count - 1;
-    auto removed = entity_to_packed[entity];
-    packed_array[removed] = packed_array[last];
-
-    // Need to know which entity "owns" the component we just moved
-    auto moved_entity = packed_to_entity[last];
-    packed_to_entity[removed] = moved_entity;
-
-    // Update the entity that has its component moved to reference
-    // the new location in the packed array
-    entity_to_packed[moved_entity] = removed;
+    auto removed = packed_index(entity);
+
+    auto *last_page = pages.get_mut(last / PageSize);
+    page_versions.touch(last / PageSize);
+    if (removed != last) {
+        auto *page = pages.get_mut(removed / PageSize);
+        page_versions.touch(removed / PageSize);
+        page->components[removed % PageSize] = last_page->components.back();
+
+        // Need to know which entity "owns" the component we just moved
+        auto moved_entity = last_page->entities[last % PageSize];
+        page->entities[removed % PageSize] = moved_entity;
+
+        // Update the entity that has its component moved to reference
+        // the new location in the packed array
+        set_packed_index(moved_entity, removed);
+    }
+    last_page->components.pop_back();
+    if (last_page->components.empty()) {
+        pages.pop_back();
+    }
 
-    entity_to_packed.erase(entity);
-    packed_to_entity.erase(last);
+    set_packed_index(entity, InvalidIndex);
     --packed_count;
 }
 
 template <typename T>
 void ComponentArray<T>::copy(Entity dst, Entity src) {
-    write(dst, read(src));
+    // Copy first since `write` may move the page holding `src`
+    T component = read(src);
+    write(dst, component);
+}
+
+template <typename T>
+void ComponentArray<T>::clear() {
+    pages.clear();
+    sparse.clear();
+    packed_count = 0;
+}
+
+template <typename T>
+uint32_t ComponentArray<T>::serial_id() const {
+    static const uint32_t id = internal::hash_string(type_name<T>());
+    return id;
+}
+
+template <typename T>
+bool ComponentArray<T>::save(SnapshotWriter &writer) const {
+    if (!Serializer<T>::enabled) {
+        return false;
+    }
+    writer.write(uint32_t(packed_count));
+    for (size_t i = 0; i < pages.size(); ++i) {
+        const auto *page = pages.get(i);
+        writer.write((const void *)page->entities,
+                     sizeof(Entity) * page->components.size());
+    }
+    for (size_t i = 0; i < pages.size(); ++i) {
+        const auto *page = pages.get(i);
+        Serializer<T>::save(writer, page->components.data(),
+                            page->components.size());
+    }
+    return true;
+}
+
+template <typename T>
+bool ComponentArray<T>::load(SnapshotReader &reader,
+                             std::vector<Entity> &loaded) {
+    clear();
+    if (!Serializer<T>::enabled) {
+        return false;
+    }
+    auto count = reader.read<uint32_t>();
+    if (!reader.ok() || count > TWO_ENTITY_MAX) {
+        return false;
+    }
+    auto first = loaded.size();
+    loaded.resize(first + count);
+    reader.read((void *)(loaded.data() + first), sizeof(Entity) * count);
+
+    for (size_t pos = 0; pos < count; pos += PageSize) {
+        auto n = std::min(size_t(count) - pos, PageSize);
+        auto *page = pages.get_mut(pos / PageSize);
+        page_versions.touch(pos / PageSize);
+        if (!internal::PackedSerializer<T>::load(reader, page->components, n)) {
+            clear();
+            return false;
+        }
+        std::copy_n(loaded.data() + first + pos, n, page->entities);
+    }
+    packed_count = count;
+    for (size_t i = 0; i < count; ++i) {
+        auto entity = loaded[first + i];
+        if (entity >= TWO_ENTITY_MAX) {
+            clear();
+            return false;
+        }
+        set_packed_index(entity, PackedSizeType(i));
+    }
+    return true;
+}
+
+template <typename T>
+std::unique_ptr<IComponentArray> ComponentArray<T>::clone() const {
+    // Pages are shared, not copied
+    return std::unique_ptr<IComponentArray>(new ComponentArray<T>(*this));
+}
+
+template <typename T>
+void ComponentArray<T>::track_changes(internal::FrameLog *log,
+                                      ComponentType type) {
+    if (log != nullptr && !Serializer<T>::enabled) {
+        log_warn("%s cannot be recorded, see Serializer", type_name<T>());
+        return;
+    }
+    tracker.log = log;
+    tracker.type = type;
+    if (log == nullptr) {
+        tracker.touched = std::vector<uint32_t>();
+    } else if (tracker.touched.empty()) {
+        tracker.touched.resize(TWO_ENTITY_MAX, 0);
+    }
+}
+
+template <typename T>
+void ComponentArray<T>::restore(Entity entity, SnapshotReader &reader) {
+    std::vector<T> component;
+    if (internal::PackedSerializer<T>::load(reader, component, 1)) {
+        write(entity, component[0]);
+    }
+}
+
+template <typename T>
+bool ComponentArray<T>::unchanged(Entity entity, SnapshotWriter &data,
+                                  size_t offset, size_t size) {
+    if (!contains(entity)) {
+        return false;
+    }
+    // Components are not required to be comparable so the serialized
+    // bytes are compared instead.
+    auto end = data.size();
+    Serializer<T>::save(data, &read(entity), 1);
+    bool same = data.size() - end == size
+                && memcmp(data.data().data() + offset,
+                          data.data().data() + end, size) == 0;
+    data.truncate(end);
+    return same;
 }
 
 template <typename T>
 inline bool ComponentArray<T>::contains(Entity entity) const {
-    return entity_to_packed.find(entity) != entity_to_packed.end();
+    return packed_index(entity) != InvalidIndex;
 }
 
 } // two
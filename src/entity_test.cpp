@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "entity.h"
 #include "debug.h"
@@ -39,15 +41,15 @@ void pview(World &world, bool include_inactive = false) {
 
 class Printer : public System {
 public:
-    void load(World &) override {
+    void load(World *) override {
         log( "%s", "warming up...");
     }
 
-    void update(World &, float) override {
+    void update(World *, float) override {
         log("%s", "brrrr...");
     }
 
-    void unload(World &) override {
+    void unload(World *) override {
         log("%s", "done.");
     }
 };
@@ -106,15 +108,183 @@ void run_entity_test() {
     world.get_all_systems<Printer>(vec);
 
     for (auto *system : world.systems()) {
-        system->update(world, 0);
-        system->update(world, 0);
-        system->update(world, 0);
-        system->update(world, 0);
+        system->update(&world, 0);
+        system->update(&world, 0);
+        system->update(&world, 0);
+        system->update(&world, 0);
     }
     world.destroy_system(p);
     auto *pp = world.get_system<Printer>();
     ASSERT(pp == nullptr);
 }
 
+struct Position {
+    float x, y;
+};
+
+struct Health {
+    int hp;
+};
+
+static std::vector<Entity> sorted_entities(World &world) {
+    auto entities = world.unsafe_view_all();
+    std::sort(entities.begin(), entities.end());
+    return entities;
+}
+
+// Checks that two worlds have the same entities and components.
+static void assert_same_world(World &a, World &b) {
+    auto entities = sorted_entities(a);
+    ASSERT_ALWAYS(entities == sorted_entities(b));
+    for (auto entity : entities) {
+        ASSERT_ALWAYS(a.has_component<Position>(entity)
+                      == b.has_component<Position>(entity));
+        if (a.has_component<Position>(entity)) {
+            const auto &pa = a.read<Position>(entity);
+            const auto &pb = b.read<Position>(entity);
+            ASSERT_ALWAYS(pa.x == pb.x && pa.y == pb.y);
+        }
+        ASSERT_ALWAYS(a.has_component<Health>(entity)
+                      == b.has_component<Health>(entity));
+        if (a.has_component<Health>(entity)) {
+            ASSERT_ALWAYS(a.read<Health>(entity).hp
+                          == b.read<Health>(entity).hp);
+        }
+    }
+    ASSERT_ALWAYS(a.view<Position>().size() == b.view<Position>().size());
+    ASSERT_ALWAYS(a.view<Health>().size() == b.view<Health>().size());
+}
+
+// Ends a frame the same way the main loop does.
+static void end_frame(World &world) {
+    world.collect_unused_entities();
+    world.commit_frame();
+}
+
+void run_clone_test() {
+    World world;
+    std::vector<Entity> entities;
+    for (int i = 0; i < 100; ++i) {
+        auto entity = world.make_entity();
+        world.pack(entity, Position{float(i), float(-i)});
+        world.pack(entity, Health{i});
+        entities.push_back(entity);
+    }
+
+    auto clone = world.clone();
+    assert_same_world(world, *clone);
+
+    // Pages are shared until one of the worlds writes to them
+    ASSERT_ALWAYS(&world.read<Position>(entities[0])
+                  == &clone->read<Position>(entities[0]));
+
+    clone->unpack<Position>(entities[0]).x = 1000.0f;
+    clone->remove_component<Health>(entities[1]);
+    clone->destroy_entity(entities[2]);
+    clone->pack(clone->make_entity(), Position{-1.0f, -1.0f});
+
+    ASSERT_ALWAYS(&world.read<Position>(entities[0])
+                  != &clone->read<Position>(entities[0]));
+    ASSERT_ALWAYS(world.read<Position>(entities[0]).x == 0.0f);
+    ASSERT_ALWAYS(world.has_component<Health>(entities[1]));
+    ASSERT_ALWAYS(world.read<Health>(entities[2]).hp == 2);
+    ASSERT_ALWAYS(world.view<Position>().size() == 100);
+    ASSERT_ALWAYS(clone->read<Position>(entities[0]).x == 1000.0f);
+
+    // Writing to the original does not change the clone either
+    world.unpack<Health>(entities[3]).hp = -1;
+    ASSERT_ALWAYS(clone->read<Health>(entities[3]).hp == 3);
+
+    // Restoring shares the clone's pages again
+    world.restore(*clone);
+    assert_same_world(world, *clone);
+}
+
+void run_rewind_test() {
+    World world;
+    world.start_recording(8);
+
+    std::vector<Entity> entities;
+    for (int i = 0; i < 10; ++i) {
+        auto entity = world.make_entity();
+        world.pack(entity, Position{float(i), 0.0f});
+        if (i % 2 == 0) {
+            world.pack(entity, Health{100});
+        }
+        entities.push_back(entity);
+    }
+    end_frame(world);
+
+    SnapshotWriter saved;
+    world.save_snapshot(saved);
+
+    // Frame 1: modify and remove components
+    world.unpack<Position>(entities[0]).x = 50.0f;
+    world.unpack<Health>(entities[2]).hp = 10;
+    world.remove_component<Position>(entities[1]);
+    world.pack(entities[3], Health{1});
+    end_frame(world);
+
+    // Frame 2: create an entity with a timer, destroy another
+    auto created = world.make_entity();
+    world.pack(created, Position{-5.0f, -5.0f});
+    auto timer = world.after(1.0f, []() {}, created);
+    world.destroy_entity(entities[4]);
+    end_frame(world);
+
+    // Frame 3: ids destroyed in frame 2 may be reused
+    auto reused = world.make_entity();
+    world.pack(reused, Health{7});
+    world.unpack<Position>(entities[5]).y = 3.0f;
+    end_frame(world);
+
+    // Changes since the last commit are undone as well
+    world.unpack<Position>(entities[6]).x = 99.0f;
+    world.destroy_entity(entities[7]);
+
+    ASSERT_ALWAYS(world.recorded_frames() == 4);
+    ASSERT_ALWAYS(!world.rewind(5));
+    ASSERT_ALWAYS(world.rewind(3));
+    ASSERT_ALWAYS(world.recorded_frames() == 1);
+
+    World expected;
+    SnapshotReader reader(saved);
+    ASSERT_ALWAYS(expected.load_snapshot(reader));
+    assert_same_world(world, expected);
+
+    // Rewinding the creation of an entity cancels its timers
+    ASSERT_ALWAYS(!world.timers().active(timer));
+
+    // Frames recorded after a rewind can be rewound again
+    world.unpack<Position>(entities[8]).x = -8.0f;
+    end_frame(world);
+    ASSERT_ALWAYS(world.rewind(1));
+    assert_same_world(world, expected);
+}
+
+class SystemA : public System {};
+class SystemB : public System {};
+class SystemC : public System {};
+
+void run_system_order_test() {
+    World world;
+    // Constraints are checked before any of the systems exist
+    world.order_systems<SystemA, SystemB>();
+    world.order_systems<SystemB, SystemC>();
+    world.order_systems<SystemB, SystemA>();
+    world.order_systems<SystemC, SystemA>();
+    world.order_systems<SystemA, SystemA>();
+
+    auto *c = world.make_system<SystemC>();
+    auto *b = world.make_system<SystemB>();
+    auto *a = world.make_system<SystemA>();
+
+    const auto &systems = world.systems();
+    ASSERT_ALWAYS(systems.size() == 3);
+    ASSERT_ALWAYS(systems[0] == a && systems[1] == b && systems[2] == c);
+    ASSERT_ALWAYS(world.get_system<SystemB>() == b);
+    world.destroy_systems();
+}
+
 } // test
 } // two
@@ -22,8 +22,10 @@
 #include <functional>
 #include <vector>
 #include <algorithm>
-#include <unordered_map>
 #include <memory>
+#include <atomic>
+#include <cstring>
+#include <type_traits>
 
 #include "SDL.h"
 #include "entity.h"
@@ -104,107 +106,772 @@ struct Quit {};
 // Emitted when the aplication is low on memory.
 struct LowMemory {};
 
+class EventDispatcher;
+
+namespace internal {
+
+inline size_t next_event_type_index() {
+    static std::atomic<size_t> next{0};
+    return next++;
+}
+
+// Dense index of an event type, assigned the first time the type is used.
+// Event buses are stored by this index so finding one does not need a
+// hash lookup.
+template <typename T>
+size_t event_type_index() {
+    static const size_t index = next_event_type_index();
+    return index;
+}
+
+inline uint32_t next_handler_generation() {
+    static std::atomic<uint32_t> next{1};
+    uint32_t generation = next++;
+    if (generation == 0) {
+        // Zero marks a removed handler
+        generation = next++;
+    }
+    return generation;
+}
+
+// Calls either a member function on an object or a `std::function`.
+// Member functions are stored directly in the delegate so binding them
+// does not allocate.
+template <typename R, typename Arg>
+class Delegate {
+public:
+    Delegate() = default;
+    Delegate(const std::function<R(Arg)> &function) : function{function} {}
+
+    template <typename U, typename Method>
+    static Delegate member(Method method, U *object);
+
+    inline R operator()(Arg arg) const {
+        if (stub != nullptr) {
+            return stub(*this, arg);
+        }
+        return function(arg);
+    }
+
+private:
+    using Stub = R (*)(const Delegate &, Arg);
+
+    Stub stub = nullptr;
+    void *object = nullptr;
+
+    // Large enough for member function pointers of classes with multiple
+    // or virtual inheritance.
+    alignas(void *) unsigned char method[sizeof(void *) * 4] = {};
+    std::function<R(Arg)> function;
+
+    template <typename U, typename Method>
+    static R call_member(const Delegate &delegate, Arg arg);
+};
+
+template <typename R, typename Arg>
+template <typename U, typename Method>
+Delegate<R, Arg> Delegate<R, Arg>::member(Method method, U *object) {
+    static_assert(sizeof(Method) <= sizeof(Delegate::method),
+                  "Member function pointer is too large");
+    static_assert(std::is_member_function_pointer<Method>::value,
+                  "Method must be a member function");
+    Delegate delegate;
+    delegate.stub = &call_member<U, Method>;
+    delegate.object = (void *)object;
+    memcpy(delegate.method, &method, sizeof(Method));
+    return delegate;
+}
+
+template <typename R, typename Arg>
+template <typename U, typename Method>
+R Delegate<R, Arg>::call_member(const Delegate &delegate, Arg arg) {
+    Method method;
+    memcpy(&method, delegate.method, sizeof(Method));
+    return (static_cast<U *>(delegate.object)->*method)(arg);
+}
+
+// Handlers in the order they were added. Handlers are removed by id in
+// constant time and may be added or removed while the list is being
+// iterated with `each()`, removed handlers are compacted once the
+// outermost iteration ends.
+template <typename Handler>
+class HandlerList {
+public:
+    // Adds a handler, returning its id and generation. Handlers added
+    // while iterating are first called on the next iteration.
+    void add(const Handler &handler, uint32_t *id, uint32_t *generation);
+
+    // Removes a handler. Returns false if the handler was already removed.
+    bool remove(uint32_t id, uint32_t generation);
+
+    // Calls `f` with each handler until `f` returns true. Returns true if
+    // `f` returned true.
+    template <typename F>
+    bool each(F f);
+
+    inline bool empty() const { return entries.size() == removed; }
+
+private:
+    struct Entry {
+        Handler handler;
+        uint32_t id;
+        uint32_t generation;
+    };
+
+    struct Slot {
+        uint32_t position;
+        uint32_t generation;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<Entry> added;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    size_t removed = 0;
+    int iterating = 0;
+
+    // Appends handlers added while iterating and removes dead entries.
+    void flush();
+};
+
+template <typename Handler>
+void HandlerList<Handler>::add(const Handler &handler, uint32_t *id,
+                               uint32_t *generation) {
+    *generation = next_handler_generation();
+    if (free_slots.empty()) {
+        *id = uint32_t(slots.size());
+        slots.push_back(Slot{0, 0});
+    } else {
+        *id = free_slots.back();
+        free_slots.pop_back();
+    }
+    auto &slot = slots[*id];
+    slot.generation = *generation;
+    if (iterating > 0) {
+        // Appending to entries could move the handler being called
+        slot.position = uint32_t(entries.size() + added.size());
+        added.push_back(Entry{handler, *id, *generation});
+        return;
+    }
+    slot.position = uint32_t(entries.size());
+    entries.push_back(Entry{handler, *id, *generation});
+}
+
+template <typename Handler>
+bool HandlerList<Handler>::remove(uint32_t id, uint32_t generation) {
+    if (id >= slots.size() || generation == 0
+            || slots[id].generation != generation) {
+        return false;
+    }
+    auto &slot = slots[id];
+    if (slot.position < entries.size()) {
+        entries[slot.position].generation = 0;
+    } else {
+        added[slot.position - entries.size()].generation = 0;
+    }
+    ++removed;
+    slot.generation = 0;
+    free_slots.push_back(id);
+    if (iterating == 0) {
+        flush();
+    }
+    return true;
+}
+
+template <typename Handler>
+template <typename F>
+bool HandlerList<Handler>::each(F f) {
+    ++iterating;
+    bool stopped = false;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].generation != 0 && f(entries[i].handler)) {
+            stopped = true;
+            break;
+        }
+    }
+    if (--iterating == 0) {
+        flush();
+    }
+    return stopped;
+}
+
+template <typename Handler>
+void HandlerList<Handler>::flush() {
+    for (auto &entry : added) {
+        entries.push_back(std::move(entry));
+    }
+    added.clear();
+    if (removed == 0 || removed * 2 < entries.size()) {
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].generation == 0) {
+            continue;
+        }
+        if (n != i) {
+            entries[n] = std::move(entries[i]);
+        }
+        slots[entries[n].id].position = uint32_t(n);
+        ++n;
+    }
+    entries.resize(n);
+    removed = 0;
+}
+
+class IPostQueue {
+public:
+    virtual ~IPostQueue() = default;
+
+    // Moves posted events into the dispatcher's queue. Only called by the
+    // thread that owns the dispatcher.
+    virtual void drain(EventDispatcher &dispatcher) = 0;
+
+    // Deletes posted events without delivering them.
+    virtual void discard() = 0;
+
+    // Next queue in the list of queues with posted events
+    IPostQueue *next_posted = nullptr;
+
+    // True while the queue is in the list of queues with posted events
+    std::atomic<bool> listed{false};
+};
+
+// Lock-free queue of events posted from any thread for a single event
+// type. Events are pushed onto an intrusive stack and taken all at once
+// by the consumer, which reverses them into the order they were posted.
+template <typename T>
+class PostQueue : public IPostQueue {
+public:
+    ~PostQueue() override { discard(); }
+
+    void push(const T &event);
+
+    void drain(EventDispatcher &dispatcher) override;
+    void discard() override;
+
+private:
+    struct Node {
+        Node *next;
+        T event;
+    };
+
+    std::atomic<Node *> head{nullptr};
+
+    // Takes all posted events, oldest first.
+    Node *take();
+};
+
+// Events posted to a dispatcher from other threads. Queues are created
+// the first time an event type is posted and stay alive until the
+// dispatcher is destroyed, so producers never see a queue being freed.
+struct PostedEvents {
+    static constexpr size_t MaxEventTypes = 1024;
+
+    std::atomic<IPostQueue *> queues[MaxEventTypes];
+
+    // Queues that have events waiting to be drained.
+    std::atomic<IPostQueue *> posted{nullptr};
+
+    PostedEvents() {
+        for (auto &queue : queues) {
+            queue.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~PostedEvents() {
+        for (auto &queue : queues) {
+            delete queue.load(std::memory_order_relaxed);
+        }
+    }
+
+    template <typename T>
+    PostQueue<T> *queue();
+
+    // Adds a queue to the posted list if it is not already there.
+    void list(IPostQueue *queue);
+
+    // Takes the posted list.
+    IPostQueue *take();
+};
+
+} // internal
+
+// Identifies an event handler added with `bind()` or `bind_batch()`.
+// Pass it to `unbind()` to remove the handler. Removing a handler that
+// has already been removed does nothing.
+struct Subscription {
+    size_t type = 0;
+    uint32_t id = 0;
+    uint32_t generation = 0;
+    bool batch = false;
+};
+
 class IEventBus {
 public:
     virtual ~IEventBus() = default;
+
+    // Delivers events queued since the last dispatch.
+    virtual void dispatch() = 0;
+
+    // Clears events delivered by the last dispatch.
+    virtual void clear_batch() = 0;
+
+    // Removes a handler added to this bus.
+    virtual void unbind(const Subscription &subscription) = 0;
+
+    // Stops any emit in progress, used when the bus is removed while
+    // one of its handlers is running.
+    inline void retire() { retired = true; }
+
+protected:
+    bool retired = false;
 };
 
 // An EventBus handles events for a single event type.
 template <typename T>
 class EventBus : public IEventBus {
 public:
-    using EventHandler = std::function<bool(const T &)>;
+    using EventHandler = internal::Delegate<bool, const T &>;
+    using BatchHandler = internal::Delegate<void, const std::vector<T> &>;
 
     // Adds a function as an event handler
-    void bind(const EventHandler &callback);
+    Subscription bind(const EventHandler &callback);
+
+    // Adds a function that receives all queued events at once
+    Subscription bind_batch(const BatchHandler &callback);
+
+    // Removes an event handler
+    void unbind(const Subscription &subscription) override;
+
+    // Emits an event to all event handlers. Returns true if a handler
+    // handled the event.
+    bool emit(const T &event);
+
+    // Adds an event to be delivered on the next dispatch.
+    inline void queue(const T &event) { pending.push_back(event); }
 
-    // Removes event handler
-    void unbind(const EventHandler &callback);
+    inline bool has_queued() const { return !pending.empty(); }
 
-    // Emits an event to all event handlers
-    void emit(const T &event) const;
+    // Events delivered by the last dispatch.
+    inline const std::vector<T> &batch() const { return delivered; }
+
+    void dispatch() override;
+
+    inline void clear_batch() override { delivered.clear(); }
 
 private:
-    std::vector<EventHandler> handlers;
+    internal::HandlerList<EventHandler> handlers;
+    internal::HandlerList<BatchHandler> batch_handlers;
+
+    // Events are queued in one buffer while the other is being delivered,
+    // the buffers are swapped on dispatch so both keep their capacity.
+    std::vector<T> pending;
+    std::vector<T> delivered;
 };
 
 // The event manager handles many event types. You can bind event handlers
 // with `two::bind()` and emit events using `two::emit()` which will use the
 // default EventDispatcher. You may also create other EventDispatchers if you need
 // to.
+//
+// Events can also be queued with `queue()`, in which case they are stored
+// in a contiguous buffer for each event type and delivered together when
+// `dispatch()` is called. The engine dispatches each world's events once
+// per frame before the world is updated.
 class EventDispatcher {
 public:
-    // Adds a function to receive events of type T
+    EventDispatcher() : posted_events{new internal::PostedEvents} {}
+
+    // Adds a function to receive events of type T. The returned
+    // subscription can be passed to `unbind()` to remove the handler.
     template <typename T>
-    void bind(std::function<bool(const T &)> callback);
+    Subscription bind(std::function<bool(const T &)> callback);
 
     // Same as `bind(callback)` but allows a member function to be used
     // as an event handler.
     template <typename Event, typename T, class U>
-    void bind(T callback, U this_ptr);
+    Subscription bind(T callback, U *this_ptr);
+
+    // Adds a function that receives all queued events of type T in a
+    // single call during `dispatch()`.
+    template <typename T>
+    Subscription bind_batch(
+            std::function<void(const std::vector<T> &)> callback);
+
+    // Same as `bind_batch(callback)` but allows a member function to be
+    // used as a batch handler.
+    template <typename Event, typename T, class U>
+    Subscription bind_batch(T callback, U *this_ptr);
+
+    // Removes an event handler. Handlers can be removed while an event
+    // is being emitted, including the handler that is currently running.
+    void unbind(const Subscription &subscription);
 
     // Emit an event to all event handlers. If a handler funtion in the
     // chain returns true then the event is considered handled and will
-    // not propagate to other listeners.
+    // not propagate to other listeners. Returns true if the event was
+    // handled.
+    template <typename T>
+    bool emit(const T &event);
+
+    // Queues an event to be delivered on the next `dispatch()`.
+    template <typename T>
+    void queue(const T &event);
+
+    // Events of type T delivered by the last `dispatch()`. The batch is
+    // valid until the next dispatch.
+    template <typename T>
+    const std::vector<T> &batch();
+
+    // Delivers all queued events. Each event is emitted to the event
+    // handlers in the order it was queued, then batch handlers receive
+    // every event of their type. Events queued while dispatching are
+    // delivered on the next dispatch.
+    void dispatch();
+
+    // Posts an event from any thread. Posted events are moved into the
+    // queue by `drain_posted()` and delivered on the following dispatch.
+    // Posting does not take a lock.
     template <typename T>
-    void emit(const T &event);
+    void post(const T &event);
 
-    // Removes all event handlers
+    // Moves events posted from other threads into the queue. Must be
+    // called from the thread that owns the dispatcher.
+    void drain_posted();
+
+    // Removes all event handlers, queued and posted events
     void clear();
 
+    // Takes the event handlers and queued events of `other`, which is left
+    // empty. Unlike move assignment the posted events of this dispatcher
+    // are kept, so it is safe to call while other threads post to it.
+    // Must not be called while an event is being emitted.
+    void replace(EventDispatcher &other);
+
 private:
-    std::unordered_map<type_id_t, std::unique_ptr<IEventBus>> event_buses;
+    std::vector<std::unique_ptr<IEventBus>> event_buses;
+
+    // Event types with queued events, in the order they were first queued.
+    std::vector<size_t> queued_types;
+    std::vector<size_t> dispatching_types;
+
+    // Event types with a batch from the last dispatch.
+    std::vector<size_t> delivered_types;
+
+    // Buses removed by `clear()` while an event handler was running. They
+    // are destroyed once the outermost emit returns.
+    std::vector<std::unique_ptr<IEventBus>> retired_buses;
+    int emit_depth = 0;
+
+    // Kept behind a pointer so the dispatcher can still be moved.
+    std::unique_ptr<internal::PostedEvents> posted_events;
+
+    template <typename T>
+    EventBus<T> *find_bus();
+
+    template <typename T>
+    EventBus<T> &bus();
+
+    void end_emit();
 };
 
 template <typename T>
-void EventDispatcher::bind(std::function<bool (const T &)> callback) {
-    auto type = type_id<T>();
-    if (event_buses.find(type) == event_buses.end()) {
-        auto event_bus = std::unique_ptr<EventBus<T>>(new EventBus<T>);
-        event_bus->bind(callback);
-        event_buses.emplace(std::make_pair(type, std::move(event_bus)));
-        return;
+EventBus<T> *EventDispatcher::find_bus() {
+    auto index = internal::event_type_index<T>();
+    if (index >= event_buses.size()) {
+        return nullptr;
     }
-    static_cast<EventBus<T> *>(event_buses[type].get())->bind(callback);
+    return static_cast<EventBus<T> *>(event_buses[index].get());
+}
+
+template <typename T>
+EventBus<T> &EventDispatcher::bus() {
+    auto index = internal::event_type_index<T>();
+    if (index >= event_buses.size()) {
+        event_buses.resize(index + 1);
+    }
+    if (event_buses[index] == nullptr) {
+        event_buses[index] = std::unique_ptr<IEventBus>(new EventBus<T>);
+    }
+    return *static_cast<EventBus<T> *>(event_buses[index].get());
+}
+
+template <typename T>
+Subscription EventDispatcher::bind(std::function<bool (const T &)> callback) {
+    return bus<T>().bind(callback);
 }
 
 template <typename Event, typename T, class U>
-void EventDispatcher::bind(T callback, U this_ptr) {
-    bind<Event>(std::bind(callback, this_ptr, std::placeholders::_1));
+Subscription EventDispatcher::bind(T callback, U *this_ptr) {
+    using Handler = typename EventBus<Event>::EventHandler;
+    return bus<Event>().bind(Handler::member(callback, this_ptr));
+}
+
+template <typename T>
+Subscription EventDispatcher::bind_batch(
+        std::function<void(const std::vector<T> &)> callback) {
+    return bus<T>().bind_batch(callback);
+}
+
+template <typename Event, typename T, class U>
+Subscription EventDispatcher::bind_batch(T callback, U *this_ptr) {
+    using Handler = typename EventBus<Event>::BatchHandler;
+    return bus<Event>().bind_batch(Handler::member(callback, this_ptr));
+}
+
+inline void EventDispatcher::unbind(const Subscription &subscription) {
+    if (subscription.type < event_buses.size()
+            && event_buses[subscription.type] != nullptr) {
+        event_buses[subscription.type]->unbind(subscription);
+    }
+}
+
+template <typename T>
+bool EventDispatcher::emit(const T &event) {
+    auto *event_bus = find_bus<T>();
+    if (event_bus == nullptr) {
+        return false;
+    }
+    ++emit_depth;
+    bool handled = event_bus->emit(event);
+    end_emit();
+    return handled;
+}
+
+template <typename T>
+void EventDispatcher::queue(const T &event) {
+    auto &event_bus = bus<T>();
+    if (!event_bus.has_queued()) {
+        queued_types.push_back(internal::event_type_index<T>());
+    }
+    event_bus.queue(event);
+}
+
+template <typename T>
+const std::vector<T> &EventDispatcher::batch() {
+    return bus<T>().batch();
+}
+
+inline void EventDispatcher::dispatch() {
+    for (auto index : delivered_types) {
+        event_buses[index]->clear_batch();
+    }
+    delivered_types.clear();
+    std::swap(queued_types, dispatching_types);
+
+    ++emit_depth;
+    for (size_t i = 0; i < dispatching_types.size(); ++i) {
+        auto index = dispatching_types[i];
+        if (index >= event_buses.size() || event_buses[index] == nullptr) {
+            // Removed by a handler
+            continue;
+        }
+        delivered_types.push_back(index);
+        event_buses[index]->dispatch();
+    }
+    dispatching_types.clear();
+    end_emit();
 }
 
 template <typename T>
-void EventDispatcher::emit(const T &event) {
-    if (event_buses.find(type_id<T>()) == event_buses.end()) {
+void EventDispatcher::post(const T &event) {
+    ASSERT(posted_events != nullptr);
+    auto *queue = posted_events->queue<T>();
+    queue->push(event);
+    posted_events->list(queue);
+}
+
+inline void EventDispatcher::drain_posted() {
+    if (posted_events == nullptr) {
+        // Moved from
         return;
     }
-    static_cast<EventBus<T> *>(event_buses[type_id<T>()].get())->emit(event);
+    auto *queue = posted_events->take();
+    while (queue != nullptr) {
+        auto *next = queue->next_posted;
+        // Cleared before draining so a queue that is posted to while
+        // draining is listed again
+        queue->listed.store(false, std::memory_order_release);
+        queue->drain(*this);
+        queue = next;
+    }
 }
 
 inline void EventDispatcher::clear() {
+    if (posted_events != nullptr) {
+        for (auto &queue : posted_events->queues) {
+            auto *q = queue.load(std::memory_order_acquire);
+            if (q != nullptr) {
+                q->discard();
+            }
+        }
+    }
+    if (emit_depth > 0) {
+        for (auto &event_bus : event_buses) {
+            if (event_bus != nullptr) {
+                event_bus->retire();
+                retired_buses.push_back(std::move(event_bus));
+            }
+        }
+    }
     event_buses.clear();
+    queued_types.clear();
+    dispatching_types.clear();
+    delivered_types.clear();
+}
+
+inline void EventDispatcher::replace(EventDispatcher &other) {
+    ASSERT(emit_depth == 0 && other.emit_depth == 0);
+    // Events posted to `other` would otherwise be lost with it
+    other.drain_posted();
+    event_buses = std::move(other.event_buses);
+    queued_types = std::move(other.queued_types);
+    dispatching_types.clear();
+    delivered_types = std::move(other.delivered_types);
+    other.event_buses.clear();
+    other.queued_types.clear();
+    other.delivered_types.clear();
+}
+
+inline void EventDispatcher::end_emit() {
+    if (--emit_depth == 0) {
+        retired_buses.clear();
+    }
 }
 
 template <typename T>
-void EventBus<T>::bind(const EventHandler &callback) {
-    handlers.push_back(callback);
+Subscription EventBus<T>::bind(const EventHandler &callback) {
+    Subscription subscription;
+    subscription.type = internal::event_type_index<T>();
+    handlers.add(callback, &subscription.id, &subscription.generation);
+    return subscription;
 }
 
 template <typename T>
-void EventBus<T>::unbind(const EventHandler &callback) {
-    auto pos = std::find(handlers.begin(), handlers.end(), callback);
-    handlers.erase(pos);
+Subscription EventBus<T>::bind_batch(const BatchHandler &callback) {
+    Subscription subscription;
+    subscription.type = internal::event_type_index<T>();
+    subscription.batch = true;
+    batch_handlers.add(callback, &subscription.id, &subscription.generation);
+    return subscription;
 }
 
 template <typename T>
-void EventBus<T>::emit(const T &event) const {
-    for (auto &callback : handlers) {
-        if (callback(event)) {
-            break;
+void EventBus<T>::unbind(const Subscription &subscription) {
+    if (subscription.batch) {
+        batch_handlers.remove(subscription.id, subscription.generation);
+        return;
+    }
+    handlers.remove(subscription.id, subscription.generation);
+}
+
+template <typename T>
+bool EventBus<T>::emit(const T &event) {
+    return handlers.each([this, &event](const EventHandler &handler) {
+        return retired || handler(event);
+    });
+}
+
+template <typename T>
+void EventBus<T>::dispatch() {
+    std::swap(pending, delivered);
+    if (!handlers.empty()) {
+        for (size_t i = 0; i < delivered.size() && !retired; ++i) {
+            emit(delivered[i]);
         }
     }
+    batch_handlers.each([this](const BatchHandler &handler) {
+        if (retired) {
+            return true;
+        }
+        handler(delivered);
+        return false;
+    });
 }
 
+namespace internal {
+
+template <typename T>
+void PostQueue<T>::push(const T &event) {
+    auto *node = new Node{nullptr, event};
+    node->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(node->next, node,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_relaxed)) {}
+}
+
+template <typename T>
+typename PostQueue<T>::Node *PostQueue<T>::take() {
+    // Acquire-release so a producer pushing after this sees `listed`
+    // cleared by the consumer and lists the queue again
+    auto *node = head.exchange(nullptr, std::memory_order_acq_rel);
+    Node *reversed = nullptr;
+    while (node != nullptr) {
+        auto *next = node->next;
+        node->next = reversed;
+        reversed = node;
+        node = next;
+    }
+    return reversed;
+}
+
+template <typename T>
+void PostQueue<T>::drain(EventDispatcher &dispatcher) {
+    auto *node = take();
+    while (node != nullptr) {
+        auto *next = node->next;
+        dispatcher.queue(node->event);
+        delete node;
+        node = next;
+    }
+}
+
+template <typename T>
+void PostQueue<T>::discard() {
+    auto *node = take();
+    while (node != nullptr) {
+        auto *next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+template <typename T>
+PostQueue<T> *PostedEvents::queue() {
+    auto index = event_type_index<T>();
+    ASSERTS(index < MaxEventTypes, "Too many posted event types");
+    auto *queue = queues[index].load(std::memory_order_acquire);
+    if (queue != nullptr) {
+        return static_cast<PostQueue<T> *>(queue);
+    }
+    IPostQueue *expected = nullptr;
+    auto *created = new PostQueue<T>;
+    if (queues[index].compare_exchange_strong(expected, created,
+                                              std::memory_order_acq_rel)) {
+        return created;
+    }
+    // Another thread created the queue first
+    delete created;
+    return static_cast<PostQueue<T> *>(expected);
+}
+
+inline void PostedEvents::list(IPostQueue *queue) {
+    if (queue->listed.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+    queue->next_posted = posted.load(std::memory_order_relaxed);
+    while (!posted.compare_exchange_weak(queue->next_posted, queue,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {}
+}
+
+inline IPostQueue *PostedEvents::take() {
+    return posted.exchange(nullptr, std::memory_order_acquire);
+}
+
+} // internal
+
 } // two
 
 #endif // TWO_EVENT_H
@@ -0,0 +1,228 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "grid.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "debug.h"
+
+namespace two {
+
+SpatialGrid::SpatialGrid(float cell_size)
+    : cell_width{cell_size}, inv_cell_width{1.0f / cell_size} {
+    ASSERT(cell_size > 0.0f);
+}
+
+int32_t SpatialGrid::cell_coord(float v) const {
+    // Clamped so that positions far away do not overflow
+    constexpr float Limit = float(1 << 30);
+    return int32_t(std::floor(clamp(v * inv_cell_width, -Limit, Limit)));
+}
+
+void SpatialGrid::insert(Entity entity, const float2 &position,
+                         float extent) {
+    bool is_large = extent > cell_width;
+    auto x = cell_coord(position.x);
+    auto y = cell_coord(position.y);
+
+    if (entity >= locations.size()) {
+        locations.resize(entity + 1, Location{0, 0, 0, false, false});
+    }
+    auto &location = locations[entity];
+    if (location.used && location.large == is_large) {
+        if (is_large) {
+            auto &item = large[location.index];
+            item.min = position - float2{extent, extent};
+            item.max = position + float2{extent, extent};
+            return;
+        }
+        if (location.x == x && location.y == y) {
+            max_extent = std::max(max_extent, extent);
+            return;
+        }
+    }
+    if (location.used) {
+        remove(entity);
+    }
+
+    if (is_large) {
+        locations[entity] = Location{0, 0, uint32_t(large.size()), true, true};
+        large.push_back(LargeEntity{entity,
+                                    position - float2{extent, extent},
+                                    position + float2{extent, extent}});
+        ++count;
+        return;
+    }
+    max_extent = std::max(max_extent, extent);
+    auto &cell = cells[cell_key(x, y)];
+    locations[entity] = Location{x, y, uint32_t(cell.size()), true, false};
+    cell.push_back(entity);
+    ++count;
+}
+
+void SpatialGrid::remove(Entity entity) {
+    if (!contains(entity)) {
+        return;
+    }
+    auto &location = locations[entity];
+
+    // Move the last entity in the list into the empty slot
+    if (location.large) {
+        auto moved = large.back();
+        large[location.index] = moved;
+        locations[moved.entity].index = location.index;
+        large.pop_back();
+    } else {
+        auto &cell = cells[cell_key(location.x, location.y)];
+        auto moved = cell.back();
+        cell[location.index] = moved;
+        locations[moved].index = location.index;
+        cell.pop_back();
+    }
+
+    location.used = false;
+    --count;
+}
+
+void SpatialGrid::clear() {
+    cells.clear();
+    large.clear();
+    locations.clear();
+    max_extent = 0.0f;
+    count = 0;
+}
+
+void SpatialGrid::query(const float2 &min, const float2 &max,
+                        std::vector<Entity> &result) const {
+    for (auto &item : large) {
+        if (item.max.x >= min.x && item.min.x <= max.x
+            && item.max.y >= min.y && item.min.y <= max.y) {
+            result.push_back(item.entity);
+        }
+    }
+
+    auto x0 = cell_coord(min.x - max_extent);
+    auto y0 = cell_coord(min.y - max_extent);
+    auto x1 = cell_coord(max.x + max_extent);
+    auto y1 = cell_coord(max.y + max_extent);
+    if (x1 < x0 || y1 < y0) {
+        return;
+    }
+
+    auto area = uint64_t(int64_t(x1) - x0 + 1)
+                * uint64_t(int64_t(y1) - y0 + 1);
+    if (area > cells.size()) {
+        // Fewer cells in the grid than in the rectangle
+        for (auto &it : cells) {
+            auto x = int32_t(uint32_t(it.first >> 32));
+            auto y = int32_t(uint32_t(it.first));
+            if (x >= x0 && x <= x1 && y >= y0 && y <= y1) {
+                result.insert(result.end(), it.second.begin(),
+                              it.second.end());
+            }
+        }
+        return;
+    }
+    for (auto y = y0; y <= y1; ++y) {
+        for (auto x = x0; x <= x1; ++x) {
+            auto it = cells.find(cell_key(x, y));
+            if (it != cells.end()) {
+                result.insert(result.end(), it->second.begin(),
+                              it->second.end());
+            }
+        }
+    }
+}
+
+void TransformGrid::reset() {
+    grid.clear();
+    page_versions.clear();
+    page_entities.clear();
+}
+
+void TransformGrid::sync(World *world) {
+    TWO_PROFILE_FUNC();
+    synced = 0;
+    const auto *transforms = world->component_array<Transform>();
+    if (transforms == nullptr) {
+        reset();
+        array_id = 0;
+        return;
+    }
+    if (transforms->id() != array_id) {
+        // Different world or the world was restored
+        reset();
+        array_id = transforms->id();
+    }
+
+    ++sync_count;
+    if (seen.size() < TWO_ENTITY_MAX) {
+        seen.resize(TWO_ENTITY_MAX, 0);
+    }
+    moved.clear();
+
+    auto page_count = transforms->page_count();
+    auto last_count = page_versions.size();
+    page_versions.resize(std::max(page_count, last_count), 0);
+    page_entities.resize(page_versions.size());
+
+    for (size_t p = 0; p < page_versions.size(); ++p) {
+        bool exists = p < page_count;
+        if (exists && transforms->page_version(p) == page_versions[p]) {
+            continue;
+        }
+        ++synced;
+
+        // Entities that were in this page may have been removed or moved
+        // to another page
+        auto &entities = page_entities[p];
+        moved.insert(moved.end(), entities.begin(), entities.end());
+        entities.clear();
+        if (!exists) {
+            continue;
+        }
+
+        const auto *components = transforms->page_components(p);
+        const auto *owners = transforms->page_entities(p);
+        auto n = transforms->page_size(p);
+        for (size_t i = 0; i < n; ++i) {
+            auto &transform = components[i];
+            // Rotating around the position keeps every corner within
+            // the length of the diagonal, wherever the origin is.
+            grid.insert(owners[i], transform.position,
+                        transform.scale.length());
+            seen[owners[i]] = sync_count;
+            entities.push_back(owners[i]);
+        }
+        page_versions[p] = transforms->page_version(p);
+    }
+    page_versions.resize(page_count);
+    page_entities.resize(page_count);
+
+    // A component moved to another page changes both pages, so an entity
+    // that was not seen in any changed page no longer has a Transform
+    for (auto entity : moved) {
+        if (seen[entity] != sync_count) {
+            grid.remove(entity);
+        }
+    }
+}
+
+} // two
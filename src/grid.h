@@ -0,0 +1,163 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef TWO_GRID_H
+#define TWO_GRID_H
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+#include "entity.h"
+#include "mathf.h"
+
+namespace two {
+
+// A uniform grid of entities indexed by position. Each entity is stored in
+// the one cell that contains its position. Queries are expanded by the
+// largest extent of any entity in a cell, so entities that overlap cells
+// other than their own are still found. Entities with an extent larger
+// than the cell size are kept in a separate list that every query checks
+// directly, so a few large entities do not widen queries for the rest.
+// Cells are only created for positions that are used, so the grid has no
+// bounds.
+class SpatialGrid {
+public:
+    explicit SpatialGrid(float cell_size);
+
+    // Adds an entity or moves it to the cell that contains `position`.
+    // `extent` is the largest distance from `position` to any part of
+    // the entity.
+    void insert(Entity entity, const float2 &position, float extent);
+
+    // Does nothing if the entity is not in the grid.
+    void remove(Entity entity);
+
+    inline bool contains(Entity entity) const {
+        return entity < locations.size() && locations[entity].used;
+    }
+
+    // Removes all entities.
+    void clear();
+
+    // Appends entities that may overlap the rectangle from `min` to `max`.
+    // Entities that are in the result may still be outside the rectangle,
+    // the order of the result is unspecified.
+    void query(const float2 &min, const float2 &max,
+               std::vector<Entity> &result) const;
+
+    inline size_t size() const { return count; }
+
+    inline float cell_size() const { return cell_width; }
+
+private:
+    struct Location {
+        int32_t x;
+        int32_t y;
+        // Index in the cell's entity list, or in `large` if the entity
+        // is larger than a cell
+        uint32_t index;
+        bool used;
+        bool large;
+    };
+
+    struct LargeEntity {
+        Entity entity;
+        float2 min;
+        float2 max;
+    };
+
+    float cell_width;
+    float inv_cell_width;
+
+    // Largest extent of an entity stored in a cell. Only grows until the
+    // grid is cleared, but never past the cell size.
+    float max_extent = 0.0f;
+
+    size_t count = 0;
+
+    std::unordered_map<uint64_t, std::vector<Entity>> cells;
+
+    // Entities with an extent larger than the cell size.
+    std::vector<LargeEntity> large;
+
+    // Indexed by entity id.
+    std::vector<Location> locations;
+
+    static inline uint64_t cell_key(int32_t x, int32_t y) {
+        return (uint64_t(uint32_t(x)) << 32) | uint32_t(y);
+    }
+
+    int32_t cell_coord(float v) const;
+};
+
+// A `SpatialGrid` of the entities with a Transform component in a world.
+// `sync` only looks at the pages of Transform components that changed
+// since the last call (see `ComponentArray::page_version`), so keeping the
+// grid up to date costs nothing when transforms are not modified.
+// `World::unpack` counts as a modification even if the component is only
+// read, so systems that do not write to a Transform should use
+// `World::read` or the pages they touch are synced every frame.
+//
+//     grid.sync(world);
+//     grid.query(camera_min, camera_max, entities);
+//
+class TransformGrid {
+public:
+    explicit TransformGrid(float cell_size) : grid{cell_size} {}
+
+    // Updates the grid with the Transform components that were added,
+    // removed or modified since the last sync.
+    void sync(World *world);
+
+    // See `SpatialGrid::query`.
+    inline void query(const float2 &min, const float2 &max,
+                      std::vector<Entity> &result) const {
+        grid.query(min, max, result);
+    }
+
+    inline const SpatialGrid &spatial_grid() const { return grid; }
+
+    // Number of Transform pages looked at in the last sync.
+    inline size_t pages_synced() const { return synced; }
+
+private:
+    SpatialGrid grid;
+
+    // Id of the Transform array the grid was built from.
+    uint64_t array_id = 0;
+
+    // Version and entities of each page the last time it was synced.
+    std::vector<uint64_t> page_versions;
+    std::vector<std::vector<Entity>> page_entities;
+
+    // Sync in which each entity was last seen, indexed by entity id.
+    std::vector<uint32_t> seen;
+    uint32_t sync_count = 0;
+
+    // Entities that were in a page that changed.
+    std::vector<Entity> moved;
+
+    size_t synced = 0;
+
+    void reset();
+};
+
+} // two
+
+#endif // TWO_GRID_H
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <vector>
+
+#include "grid.h"
+#include "entity.h"
+#include "debug.h"
+
+namespace two {
+namespace test {
+
+static bool found(const std::vector<Entity> &result, Entity entity) {
+    return std::find(result.begin(), result.end(), entity) != result.end();
+}
+
+void run_spatial_grid_test() {
+    SpatialGrid grid(4.0f);
+    std::vector<Entity> result;
+
+    grid.insert(1, float2{1.0f, 1.0f}, 0.5f);
+    grid.insert(2, float2{-10.0f, 20.0f}, 0.5f);
+    // Overlaps cells other than its own
+    grid.insert(3, float2{7.9f, 0.0f}, 1.0f);
+    // Larger than a cell
+    grid.insert(4, float2{100.0f, 100.0f}, 60.0f);
+    ASSERT_ALWAYS(grid.size() == 4);
+
+    grid.query(float2{0.0f, 0.0f}, float2{2.0f, 2.0f}, result);
+    ASSERT_ALWAYS(found(result, 1) && !found(result, 2));
+
+    result.clear();
+    grid.query(float2{8.5f, -1.0f}, float2{9.0f, 1.0f}, result);
+    ASSERT_ALWAYS(found(result, 3));
+
+    result.clear();
+    grid.query(float2{45.0f, 45.0f}, float2{46.0f, 46.0f}, result);
+    ASSERT_ALWAYS(found(result, 4) && !found(result, 1));
+
+    // Moving an entity takes it out of its old cell
+    grid.insert(1, float2{-10.0f, 21.0f}, 0.5f);
+    ASSERT_ALWAYS(grid.size() == 4);
+    result.clear();
+    grid.query(float2{0.0f, 0.0f}, float2{2.0f, 2.0f}, result);
+    ASSERT_ALWAYS(!found(result, 1));
+    result.clear();
+    grid.query(float2{-11.0f, 19.0f}, float2{-9.0f, 22.0f}, result);
+    ASSERT_ALWAYS(found(result, 1) && found(result, 2));
+
+    // A large entity that shrinks is moved into a cell
+    grid.insert(4, float2{100.0f, 100.0f}, 1.0f);
+    result.clear();
+    grid.query(float2{45.0f, 45.0f}, float2{46.0f, 46.0f}, result);
+    ASSERT_ALWAYS(!found(result, 4));
+
+    grid.remove(2);
+    grid.remove(2);
+    ASSERT_ALWAYS(!grid.contains(2) && grid.size() == 3);
+    result.clear();
+    grid.query(float2{-11.0f, 19.0f}, float2{-9.0f, 22.0f}, result);
+    ASSERT_ALWAYS(!found(result, 2));
+}
+
+void run_transform_grid_test() {
+    World world;
+    std::vector<Entity> entities;
+    for (int i = 0; i < 1000; ++i) {
+        auto entity = world.make_entity();
+        world.pack(entity, Transform{float2{float(i * 10), 0.0f}});
+        entities.push_back(entity);
+    }
+
+    TransformGrid grid(8.0f);
+    std::vector<Entity> result;
+    grid.sync(&world);
+    ASSERT_ALWAYS(grid.spatial_grid().size() == 1000);
+    auto pages = grid.pages_synced();
+    ASSERT_ALWAYS(pages > 1);
+
+    // Nothing changed, no pages are looked at
+    grid.sync(&world);
+    ASSERT_ALWAYS(grid.pages_synced() == 0);
+
+    // Reading does not count as a change
+    ASSERT_ALWAYS(world.read<Transform>(entities[500]).position.x == 5000.0f);
+    grid.sync(&world);
+    ASSERT_ALWAYS(grid.pages_synced() == 0);
+
+    world.unpack<Transform>(entities[500]).position = float2{-500.0f, 0.0f};
+    grid.sync(&world);
+    ASSERT_ALWAYS(grid.pages_synced() == 1);
+    grid.query(float2{4999.0f, -1.0f}, float2{5001.0f, 1.0f}, result);
+    ASSERT_ALWAYS(!found(result, entities[500]));
+    result.clear();
+    grid.query(float2{-501.0f, -1.0f}, float2{-499.0f, 1.0f}, result);
+    ASSERT_ALWAYS(found(result, entities[500]));
+
+    // Removed components and destroyed entities leave the grid
+    world.remove_component<Transform>(entities[10]);
+    world.destroy_entity(entities[20]);
+    grid.sync(&world);
+    ASSERT_ALWAYS(grid.spatial_grid().size() == 998);
+    ASSERT_ALWAYS(!grid.spatial_grid().contains(entities[10]));
+    ASSERT_ALWAYS(!grid.spatial_grid().contains(entities[20]));
+    ASSERT_ALWAYS(grid.spatial_grid().contains(entities[999]));
+
+    // A restored world replaces the whole grid
+    World other;
+    auto entity = other.make_entity();
+    other.pack(entity, Transform{float2{3.0f, 3.0f}});
+    world.restore(other);
+    grid.sync(&world);
+    ASSERT_ALWAYS(grid.spatial_grid().size() == 1);
+    ASSERT_ALWAYS(grid.spatial_grid().contains(entity));
+}
+
+} // test
+} // two
@@ -19,6 +19,8 @@
 #include "image.h"
 
 #include <cstdlib>
+#include <cstring>
+#include <algorithm>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
@@ -221,21 +223,26 @@ Image *Image::convert(PixelFormat pixelformat) const {
     return dst;
 }
 
-void Image::paste(Image *im, const int2 &xy) {
+void Image::paste(const Image *im, const int2 &xy) {
     if (im->pixelformat != pixelformat) {
         // We could convert here but that would allocate memory every time
         // which we may not want to do.
         PANIC("Cannot paste image with different formats, use Image::convert");
         return;
     }
-    int dst_w = clampi(xy.x + im->w, 0, w);
-    int dst_h = clampi(xy.y + im->h, 0, h);
+    int x0 = std::max(xy.x, 0);
+    int y0 = std::max(xy.y, 0);
+    int x1 = std::min(xy.x + im->w, w);
+    int y1 = std::min(xy.y + im->h, h);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
 
-    for (int v = xy.x; v < dst_w; ++v) {
-        for (int u = xy.y; u < dst_h; ++u) {
-            auto color = im->read(int2{u - xy.x, v - xy.y});
-            write(int2{u, v}, color);
-        }
+    int bpp = bytes_per_pixel(pixelformat);
+    for (int y = y0; y < y1; ++y) {
+        memcpy(data + y * pitch() + x0 * bpp,
+               im->data + (y - xy.y) * im->pitch() + (x0 - xy.x) * bpp,
+               size_t((x1 - x0) * bpp));
     }
 }
 
@@ -114,7 +114,7 @@ public:
     // image is smaller to source image will be clamped.
     //
     // > Note: for better performance use a target Texture with SDL_RenderCopy.
-    void paste(Image *im, const int2 &xy);
+    void paste(const Image *im, const int2 &xy);
 
     // Convert image to a new image with the desired format.
     Image *convert(PixelFormat pixelformat) const;
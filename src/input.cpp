@@ -0,0 +1,348 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#include "input.h"
+
+#include "debug.h"
+#include "two.h"
+
+namespace two {
+
+constexpr int InputState::MaxMouseButtons;
+
+static InputState current_input;
+
+const InputState &input() {
+    return current_input;
+}
+
+InputState &internal::input_state() {
+    return current_input;
+}
+
+int internal::mouse_button_index(int sdl_button) {
+    // We use button 2 for the secondary click, but SDL uses button 3.
+    switch (sdl_button) {
+    case SDL_BUTTON_RIGHT:
+        return 2;
+    case SDL_BUTTON_MIDDLE:
+        return 3;
+    default:
+        return sdl_button;
+    }
+}
+
+SDL_Event internal::mouse_focus_event() {
+    SDL_Event e;
+    SDL_zero(e);
+    e.type = SDL_WINDOWEVENT;
+    e.window.event = SDL_WINDOWEVENT_FOCUS_GAINED;
+    SDL_GetMouseState(&e.window.data1, &e.window.data2);
+
+    // Same conversion SDL applies to mouse events when the renderer has
+    // a logical size
+    if (gfx != nullptr) {
+        SDL_Rect viewport;
+        float scale_x, scale_y;
+        SDL_RenderGetViewport(gfx, &viewport);
+        SDL_RenderGetScale(gfx, &scale_x, &scale_y);
+        if (scale_x > 0.0f && scale_y > 0.0f) {
+            e.window.data1 -= int(float(viewport.x) * scale_x);
+            e.window.data2 -= int(float(viewport.y) * scale_y);
+            e.window.data1 = int(float(e.window.data1) / scale_x);
+            e.window.data2 = int(float(e.window.data2) / scale_y);
+        }
+    }
+    return e;
+}
+
+namespace {
+
+constexpr uint32_t InputLogMagic = 0x52495754; // "TWIR"
+constexpr uint32_t InputLogVersion = 1;
+
+enum class RecordedEvent : uint8_t {
+    KeyDown,
+    KeyUp,
+    MouseMotion,
+    MouseDown,
+    MouseUp,
+    MouseWheel,
+    FocusLost,
+    Quit,
+    FocusGained,
+};
+
+} // namespace
+
+bool InputRecorder::open() {
+    if (!file.open(FileMode::Write)) {
+        return false;
+    }
+    frame.clear();
+    frame.write(InputLogMagic);
+    frame.write(InputLogVersion);
+    bool ok = file.write((const char *)frame.data().data(), frame.size());
+    frame.clear();
+    return ok;
+}
+
+void InputRecorder::record(const SDL_Event &e) {
+    switch (e.type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        frame.write(e.type == SDL_KEYDOWN ? RecordedEvent::KeyDown
+                                          : RecordedEvent::KeyUp);
+        frame.write(int32_t(e.key.keysym.sym));
+        frame.write(uint16_t(e.key.keysym.scancode));
+        frame.write(uint8_t(e.key.repeat));
+        break;
+    case SDL_MOUSEMOTION:
+        frame.write(RecordedEvent::MouseMotion);
+        frame.write(int32_t(e.motion.x));
+        frame.write(int32_t(e.motion.y));
+        break;
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+        frame.write(e.type == SDL_MOUSEBUTTONDOWN ? RecordedEvent::MouseDown
+                                                  : RecordedEvent::MouseUp);
+        frame.write(uint8_t(e.button.button));
+        frame.write(int32_t(e.button.x));
+        frame.write(int32_t(e.button.y));
+        break;
+    case SDL_MOUSEWHEEL:
+        frame.write(RecordedEvent::MouseWheel);
+        frame.write(int32_t(e.wheel.x));
+        frame.write(int32_t(e.wheel.y));
+        frame.write(uint8_t(e.wheel.direction == SDL_MOUSEWHEEL_FLIPPED));
+        break;
+    case SDL_WINDOWEVENT:
+        if (e.window.event == SDL_WINDOWEVENT_FOCUS_LOST) {
+            frame.write(RecordedEvent::FocusLost);
+            break;
+        }
+        if (e.window.event != SDL_WINDOWEVENT_FOCUS_GAINED) {
+            return;
+        }
+        // Mouse position, see internal::mouse_focus_event
+        frame.write(RecordedEvent::FocusGained);
+        frame.write(int32_t(e.window.data1));
+        frame.write(int32_t(e.window.data2));
+        break;
+    case SDL_QUIT:
+        frame.write(RecordedEvent::Quit);
+        break;
+    default:
+        return;
+    }
+    ++event_count;
+}
+
+bool InputRecorder::end_frame(float dt) {
+    // Frame header followed by the events in the order they were polled
+    bool ok = file.write((const char *)&dt, sizeof(dt))
+              && file.write((const char *)&event_count, sizeof(event_count))
+              && file.write((const char *)frame.data().data(), frame.size());
+    frame.clear();
+    event_count = 0;
+    return ok;
+}
+
+bool InputRecorder::close() {
+    return file.close();
+}
+
+bool InputReplay::open() {
+    // Not a snapshot file, so there is no resource table to read
+    File file(filename);
+    if (!file.open(FileMode::Read)) {
+        return false;
+    }
+    std::vector<uint8_t> data(size_t(file.size()));
+    if (file.read((char *)data.data(), int64_t(data.size()))
+        != int64_t(data.size())) {
+        log_error("Could not read %s", filename.c_str());
+        return false;
+    }
+    reader = SnapshotReader(data.data(), data.size());
+    frames_read = 0;
+    if (reader.read<uint32_t>() != InputLogMagic) {
+        log_error("%s is not an input log", filename.c_str());
+        return false;
+    }
+    auto version = reader.read<uint32_t>();
+    if (version != InputLogVersion) {
+        log_error("%s: unsupported input log version %u",
+                  filename.c_str(), version);
+        return false;
+    }
+    return reader.ok();
+}
+
+bool InputReplay::next_frame(float *dt, std::vector<SDL_Event> *events) {
+    events->clear();
+    if (reader.tell() >= reader.size()) {
+        return false;
+    }
+    *dt = reader.read<float>();
+    auto count = reader.read<uint32_t>();
+
+    for (uint32_t i = 0; i < count && reader.ok(); ++i) {
+        SDL_Event e;
+        SDL_zero(e);
+        auto type = reader.read<RecordedEvent>();
+        switch (type) {
+        case RecordedEvent::KeyDown:
+        case RecordedEvent::KeyUp:
+            e.type = type == RecordedEvent::KeyDown ? SDL_KEYDOWN : SDL_KEYUP;
+            e.key.state = type == RecordedEvent::KeyDown ? SDL_PRESSED
+                                                         : SDL_RELEASED;
+            e.key.keysym.sym = SDL_Keycode(reader.read<int32_t>());
+            {
+                auto scancode = reader.read<uint16_t>();
+                if (scancode >= SDL_NUM_SCANCODES) {
+                    log_error("%s: invalid scancode %u in frame %llu",
+                              filename.c_str(), unsigned(scancode),
+                              (unsigned long long)frames_read);
+                    return false;
+                }
+                e.key.keysym.scancode = SDL_Scancode(scancode);
+            }
+            e.key.repeat = reader.read<uint8_t>();
+            break;
+        case RecordedEvent::MouseMotion:
+            e.type = SDL_MOUSEMOTION;
+            e.motion.x = reader.read<int32_t>();
+            e.motion.y = reader.read<int32_t>();
+            break;
+        case RecordedEvent::MouseDown:
+        case RecordedEvent::MouseUp:
+            e.type = type == RecordedEvent::MouseDown ? SDL_MOUSEBUTTONDOWN
+                                                      : SDL_MOUSEBUTTONUP;
+            e.button.state = type == RecordedEvent::MouseDown ? SDL_PRESSED
+                                                              : SDL_RELEASED;
+            e.button.button = reader.read<uint8_t>();
+            e.button.x = reader.read<int32_t>();
+            e.button.y = reader.read<int32_t>();
+            break;
+        case RecordedEvent::MouseWheel:
+            e.type = SDL_MOUSEWHEEL;
+            e.wheel.x = reader.read<int32_t>();
+            e.wheel.y = reader.read<int32_t>();
+            e.wheel.direction = reader.read<uint8_t>()
+                                ? SDL_MOUSEWHEEL_FLIPPED
+                                : SDL_MOUSEWHEEL_NORMAL;
+            break;
+        case RecordedEvent::FocusLost:
+            e.type = SDL_WINDOWEVENT;
+            e.window.event = SDL_WINDOWEVENT_FOCUS_LOST;
+            break;
+        case RecordedEvent::FocusGained:
+            e.type = SDL_WINDOWEVENT;
+            e.window.event = SDL_WINDOWEVENT_FOCUS_GAINED;
+            e.window.data1 = reader.read<int32_t>();
+            e.window.data2 = reader.read<int32_t>();
+            break;
+        case RecordedEvent::Quit:
+            e.type = SDL_QUIT;
+            break;
+        default:
+            log_error("%s: invalid event in frame %llu", filename.c_str(),
+                      (unsigned long long)frames_read);
+            return false;
+        }
+        events->push_back(e);
+    }
+    if (!reader.ok()) {
+        log_error("%s: input log is truncated", filename.c_str());
+    }
+    ++frames_read;
+    return reader.ok();
+}
+
+void InputState::begin_frame() {
+    keys_pressed.reset();
+    keys_released.reset();
+    buttons_pressed = 0;
+    buttons_released = 0;
+    last_mouse = mouse;
+    scroll_delta = float2{0.0f, 0.0f};
+}
+
+void InputState::process(const SDL_Event &e) {
+    switch (e.type) {
+    case SDL_KEYDOWN:
+        if (e.key.repeat == 0) {
+            keys_down.set(e.key.keysym.scancode);
+            keys_pressed.set(e.key.keysym.scancode);
+        }
+        break;
+    case SDL_KEYUP:
+        keys_down.reset(e.key.keysym.scancode);
+        keys_released.set(e.key.keysym.scancode);
+        break;
+    case SDL_MOUSEMOTION:
+        mouse = int2{e.motion.x, e.motion.y};
+        break;
+    case SDL_MOUSEBUTTONDOWN:
+        {
+            auto bit = button_bit(internal::mouse_button_index(e.button.button));
+            buttons_down |= bit;
+            buttons_pressed |= bit;
+            mouse = int2{e.button.x, e.button.y};
+        }
+        break;
+    case SDL_MOUSEBUTTONUP:
+        {
+            auto bit = button_bit(internal::mouse_button_index(e.button.button));
+            buttons_down &= ~bit;
+            buttons_released |= bit;
+            mouse = int2{e.button.x, e.button.y};
+        }
+        break;
+    case SDL_MOUSEWHEEL:
+        {
+            // Mouse scrolling is inverted
+            int dir = e.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1 : 1;
+            scroll_delta += float2{float(e.wheel.x * dir),
+                                   float(e.wheel.y * dir)};
+        }
+        break;
+    case SDL_WINDOWEVENT:
+        if (e.window.event == SDL_WINDOWEVENT_FOCUS_LOST) {
+            reset();
+        }
+        if (e.window.event == SDL_WINDOWEVENT_FOCUS_GAINED) {
+            mouse = int2{e.window.data1, e.window.data2};
+            last_mouse = mouse;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void InputState::reset() {
+    keys_released |= keys_down;
+    keys_down.reset();
+    buttons_released |= buttons_down;
+    buttons_down = 0;
+}
+
+} // two
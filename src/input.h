@@ -0,0 +1,188 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#ifndef TWO_INPUT_H
+#define TWO_INPUT_H
+
+#include <bitset>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SDL.h"
+#include "debug.h"
+#include "mathf.h"
+#include "filesystem.h"
+#include "snapshot.h"
+
+namespace two {
+
+// Keyboard and mouse state for the current frame. The state is built once
+// per frame from SDL events in `pump()`, so querying it does not call into
+// SDL and does not require binding event handlers.
+//
+//     auto &in = two::input();
+//     if (in.key_pressed(SDL_SCANCODE_SPACE)) jump();
+//
+// Mouse buttons use the same indices as `MouseDown`: 1 is the primary
+// button, 2 is the secondary and 3 is the middle mouse button.
+class InputState {
+public:
+    static constexpr int MaxMouseButtons = 8;
+
+    // True while the physical key is held down.
+    inline bool key(SDL_Scancode scancode) const {
+        ASSERT(scancode < SDL_NUM_SCANCODES);
+        return keys_down[scancode];
+    }
+
+    // True if the key was pressed this frame. Key repeats are ignored.
+    inline bool key_pressed(SDL_Scancode scancode) const {
+        ASSERT(scancode < SDL_NUM_SCANCODES);
+        return keys_pressed[scancode];
+    }
+
+    // True if the key was released this frame.
+    inline bool key_released(SDL_Scancode scancode) const {
+        ASSERT(scancode < SDL_NUM_SCANCODES);
+        return keys_released[scancode];
+    }
+
+    // True while the mouse button is held down.
+    inline bool mouse_button(int button) const {
+        return (buttons_down & button_bit(button)) != 0;
+    }
+
+    // True if the mouse button was pressed this frame.
+    inline bool mouse_pressed(int button) const {
+        return (buttons_pressed & button_bit(button)) != 0;
+    }
+
+    // True if the mouse button was released this frame.
+    inline bool mouse_released(int button) const {
+        return (buttons_released & button_bit(button)) != 0;
+    }
+
+    // Mouse position in pixels at the end of the last pump. SDL only sends
+    // the position when the mouse moves, so `pump()` also reads it when
+    // input starts and when the window gains focus.
+    inline int2 mouse_position() const { return mouse; }
+
+    // Distance the mouse moved this frame in pixels.
+    inline int2 mouse_delta() const { return mouse - last_mouse; }
+
+    // Amount the scroll wheel moved this frame.
+    inline float2 scroll() const { return scroll_delta; }
+
+    // Clears pressed and released keys and buttons. Called before the
+    // events of a new frame are processed.
+    void begin_frame();
+
+    // Updates the state from an SDL event.
+    void process(const SDL_Event &e);
+
+    // Releases every key and button, used when the window loses focus.
+    void reset();
+
+private:
+    std::bitset<SDL_NUM_SCANCODES> keys_down;
+    std::bitset<SDL_NUM_SCANCODES> keys_pressed;
+    std::bitset<SDL_NUM_SCANCODES> keys_released;
+
+    uint32_t buttons_down = 0;
+    uint32_t buttons_pressed = 0;
+    uint32_t buttons_released = 0;
+
+    int2 mouse{0, 0};
+    int2 last_mouse{0, 0};
+    float2 scroll_delta{0.0f, 0.0f};
+
+    static inline uint32_t button_bit(int button) {
+        return button > 0 && button <= MaxMouseButtons ? 1u << (button - 1)
+                                                       : 0;
+    }
+};
+
+// Records the SDL events of each frame and the frame time to a file so a
+// play session can be replayed with `InputReplay`. Only events used by the
+// engine are written, each in a compact binary form.
+class InputRecorder {
+public:
+    explicit InputRecorder(const std::string &filename) : file{filename} {}
+
+    // Opens the file in the write directory. Returns true if successful.
+    bool open();
+
+    // Adds an event to the current frame.
+    void record(const SDL_Event &e);
+
+    // Writes the current frame to the file.
+    bool end_frame(float dt);
+
+    // Closes the file, returns true if successful.
+    bool close();
+
+private:
+    File file;
+    SnapshotWriter frame;
+    uint32_t event_count = 0;
+};
+
+// Reads a log written by `InputRecorder` one frame at a time.
+class InputReplay {
+public:
+    explicit InputReplay(const std::string &filename) : filename{filename} {}
+
+    // Reads the whole log. Returns false if the file could not be read or
+    // is not an input log.
+    bool open();
+
+    // Reads the events and frame time of the next frame. Returns false
+    // once every frame has been read.
+    bool next_frame(float *dt, std::vector<SDL_Event> *events);
+
+    inline uint64_t frame() const { return frames_read; }
+
+private:
+    std::string filename;
+    SnapshotReader reader;
+    uint64_t frames_read = 0;
+};
+
+// Input state for the current frame.
+const InputState &input();
+
+namespace internal {
+
+// Input state updated by `pump()`.
+InputState &input_state();
+
+// Converts an SDL button index to the index used by mouse events.
+int mouse_button_index(int sdl_button);
+
+// Window focus gained event with the current mouse position in `data1`
+// and `data2`, in the same coordinates as mouse events. Processing it sets
+// the mouse position without counting as movement.
+SDL_Event mouse_focus_event();
+
+} // internal
+
+} // two
+
+#endif // TWO_INPUT_H
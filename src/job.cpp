@@ -0,0 +1,143 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#include "job.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "debug.h"
+
+namespace two {
+
+JobPool::JobPool(size_t threads) {
+    threads = std::max(threads, size_t(1));
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(&JobPool::worker_main, this);
+    }
+}
+
+JobPool::~JobPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_cv.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void JobPool::run(JobGroup &group, std::function<void()> job) {
+    group.pending.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(Job{std::move(job), &group});
+    }
+    job_cv.notify_one();
+}
+
+void JobPool::wait(JobGroup &group, const std::function<void()> &idle) {
+    TWO_PROFILE_FUNC();
+    while (!group.done()) {
+        if (run_one(group)) {
+            continue;
+        }
+        if (idle != nullptr) {
+            uint64_t seen;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                seen = wakeups;
+            }
+            idle();
+            std::unique_lock<std::mutex> lock(mutex);
+            // A wake after reading `seen` is not missed since it changes
+            // the count
+            done_cv.wait(lock, [this, &group, seen]() {
+                return group.done() || wakeups != seen;
+            });
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        // Jobs of the group may still be running on workers
+        done_cv.wait_for(lock, std::chrono::milliseconds(1),
+                         [&group]() { return group.done(); });
+    }
+}
+
+void JobPool::wake() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++wakeups;
+    }
+    done_cv.notify_all();
+}
+
+void JobPool::worker_main() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_cv.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job.function();
+        finish(job);
+    }
+}
+
+bool JobPool::run_one(JobGroup &group) {
+    Job job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::find_if(jobs.begin(), jobs.end(),
+                               [&group](const Job &queued) {
+                                   return queued.group == &group;
+                               });
+        if (it == jobs.end()) {
+            return false;
+        }
+        job = std::move(*it);
+        jobs.erase(it);
+    }
+    job.function();
+    finish(job);
+    return true;
+}
+
+void JobPool::finish(Job &job) {
+    // Decremented under the lock so a waiting thread can't miss the signal
+    std::lock_guard<std::mutex> lock(mutex);
+    if (job.group->pending.fetch_sub(1, std::memory_order_release) == 1) {
+        done_cv.notify_all();
+    }
+}
+
+JobPool &job_pool() {
+    static JobPool pool(std::thread::hardware_concurrency() > 1
+                        ? std::thread::hardware_concurrency() - 1 : 1);
+    return pool;
+}
+
+} // two
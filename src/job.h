@@ -0,0 +1,124 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#ifndef TWO_JOB_H
+#define TWO_JOB_H
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace two {
+
+// Tracks a set of jobs so that they can be waited on.
+class JobGroup {
+public:
+    JobGroup() = default;
+    JobGroup(const JobGroup &) = delete;
+    JobGroup &operator=(const JobGroup &) = delete;
+
+    // True once every job in the group has finished.
+    inline bool done() const {
+        return pending.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobPool;
+    std::atomic<int> pending{0};
+};
+
+// A fixed set of worker threads that run queued jobs.
+//
+//     JobGroup group;
+//     for (auto *chunk : chunks) {
+//         job_pool().run(group, [chunk]() { simulate(chunk); });
+//     }
+//     job_pool().wait(group);
+//
+class JobPool {
+public:
+    // Starts `threads` worker threads, at least one.
+    explicit JobPool(size_t threads);
+
+    // Waits for the jobs that are running and discards the rest.
+    ~JobPool();
+
+    JobPool(const JobPool &) = delete;
+    JobPool &operator=(const JobPool &) = delete;
+
+    // Queues a job. The group must be waited on before it is destroyed.
+    void run(JobGroup &group, std::function<void()> job);
+
+    // Waits for all jobs in a group to finish. The calling thread runs
+    // queued jobs of the group while it waits, never jobs of other groups,
+    // so waiting on a small group is not held up by long jobs queued by
+    // someone else. If there are none left `idle` is called, then the
+    // thread sleeps until the group is done or `wake` is called, and calls
+    // `idle` again.
+    void wait(JobGroup &group, const std::function<void()> &idle = nullptr);
+
+    // Wakes threads waiting with an idle callback so they call it again.
+    // Use after queuing work that the idle callback handles.
+    void wake();
+
+    inline size_t size() const { return workers.size(); }
+
+private:
+    struct Job {
+        std::function<void()> function;
+        JobGroup *group;
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    std::mutex mutex;
+
+    // Signaled when a job is queued.
+    std::condition_variable job_cv;
+
+    // Signaled when a group is done or `wake` is called.
+    std::condition_variable done_cv;
+
+    // Incremented by `wake` so a waiter can tell it was woken after it
+    // last called its idle callback.
+    uint64_t wakeups = 0;
+
+    bool stopping = false;
+
+    void worker_main();
+
+    // Runs a queued job of `group` on the calling thread. Returns false if
+    // there were none.
+    bool run_one(JobGroup &group);
+
+    void finish(Job &job);
+};
+
+// Shared pool with a worker for each core except the one running the main
+// thread. Created the first time it is used.
+JobPool &job_pool();
+
+} // two
+
+#endif // TWO_JOB_H
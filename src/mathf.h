@@ -176,8 +176,8 @@ struct Vector4_t {
         struct { T x, y, z, w; };
     };
 
-    Vector4_t<float>(__m128 m) : m128{m} {}
-    Vector4_t<int>(__m128i m) : m128i{m} {}
+    Vector4_t(__m128 m) : m128{m} {}
+    Vector4_t(__m128i m) : m128i{m} {}
 #else
     T x, y, z, w;
 #endif
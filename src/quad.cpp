@@ -0,0 +1,513 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "quad.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "SDL.h"
+#include "config.h"
+#include "debug.h"
+
+#ifdef TWO_SSE
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TWO_TARGET(isa_) __attribute__((target(isa_)))
+#else
+#define TWO_TARGET(isa_)
+#endif
+
+namespace two {
+
+void QuadBatch::push(const float2 &position, const float2 &scale,
+                     const float2 &origin, const float2 &size,
+                     float angle) {
+    x.push_back(position.x);
+    y.push_back(position.y);
+    scale_x.push_back(scale.x);
+    scale_y.push_back(scale.y);
+    origin_x.push_back(origin.x);
+    origin_y.push_back(origin.y);
+    width.push_back(size.x);
+    height.push_back(size.y);
+    rotation.push_back(angle);
+    rotated = rotated || angle != 0.0f;
+}
+
+void QuadBatch::clear() {
+    x.clear();
+    y.clear();
+    scale_x.clear();
+    scale_y.clear();
+    origin_x.clear();
+    origin_y.clear();
+    width.clear();
+    height.clear();
+    rotation.clear();
+    rotated = false;
+}
+
+// Transforms quads in [begin, end) one at a time.
+static void transform_quads_scalar(QuadBatch &b, const QuadProjection &p,
+                                   size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        float px = b.x[i];
+        float py = b.y[i];
+        float sx = b.scale_x[i];
+        float sy = b.scale_y[i];
+        float ox = b.origin_x[i];
+        float oy = b.origin_y[i];
+
+        // Corners relative to the origin
+        float wx = ox * sx + px;
+        float wy = oy * sy + py;
+        float x0 = px - wx;
+        float x1 = (px + sx) - wx;
+        float y0 = py - wy;
+        float y1 = (py + sy) - wy;
+
+        float st = 0.0f;
+        float ct = 1.0f;
+        if (b.rotated) {
+            float theta = b.rotation[i] * DegToRad;
+            st = sinf(theta);
+            ct = cosf(theta);
+        }
+
+        const float vx[4]{x0, x1, x1, x0};
+        const float vy[4]{y0, y0, y1, y1};
+        float min_x = INFINITY, min_y = INFINITY;
+        float max_x = -INFINITY, max_y = -INFINITY;
+        for (int c = 0; c < 4; ++c) {
+            float rx = (ct*vx[c] - st*vy[c] + px) * p.tilesize.x;
+            float ry = (st*vx[c] + ct*vy[c] + py) * p.tilesize.y;
+            min_x = std::min(min_x, rx);
+            min_y = std::min(min_y, ry);
+            max_x = std::max(max_x, rx);
+            max_y = std::max(max_y, ry);
+        }
+
+        // Truncating the bounds is the same as truncating each corner
+        int32_t box_min_x = int32_t(min_x) + p.offset.x;
+        int32_t box_min_y = int32_t(min_y) + p.offset.y;
+        int32_t box_max_x = int32_t(max_x) + p.offset.x;
+        int32_t box_max_y = int32_t(max_y) + p.offset.y;
+        b.visible[i] = !(box_min_x > p.screen.x || box_min_y > p.screen.y
+                         || box_max_x < 0 || box_max_y < 0);
+
+        float w = sx * b.width[i] * p.scale;
+        float h = sy * b.height[i] * p.scale;
+        float ws_x = float(int32_t(px * p.tilesize.x) + p.offset.x);
+        float ws_y = float(int32_t(py * p.tilesize.y) + p.offset.y);
+        b.dst_x[i] = int32_t(ws_x - ox * w);
+        b.dst_y[i] = int32_t(ws_y - oy * h);
+        b.dst_w[i] = int32_t(w);
+        b.dst_h[i] = int32_t(h);
+    }
+}
+
+#ifdef TWO_SSE
+
+// Cephes single precision sin and cos for |x| < 8192, used for culling
+// only so the last bit of precision does not matter.
+TWO_TARGET("sse2")
+static void sincos_sse2(__m128 x, __m128 *s, __m128 *c) {
+    const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+    auto sign_sin = _mm_and_ps(x, sign_mask);
+    x = _mm_andnot_ps(sign_mask, x);
+
+    // Octant of x, rounded up to an even number
+    auto j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+    j = _mm_and_si128(_mm_add_epi32(j, _mm_set1_epi32(1)),
+                      _mm_set1_epi32(~1));
+    auto y = _mm_cvtepi32_ps(j);
+
+    auto swap_sin = _mm_slli_epi32(_mm_and_si128(j, _mm_set1_epi32(4)), 29);
+    auto poly_mask = _mm_castsi128_ps(_mm_cmpeq_epi32(
+        _mm_and_si128(j, _mm_set1_epi32(2)), _mm_setzero_si128()));
+    auto sign_cos = _mm_slli_epi32(_mm_andnot_si128(
+        _mm_sub_epi32(j, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29);
+    sign_sin = _mm_xor_ps(sign_sin, _mm_castsi128_ps(swap_sin));
+
+    // Extended precision modular arithmetic
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+    x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+    auto z = _mm_mul_ps(x, x);
+
+    auto yc = _mm_set1_ps(2.443315711809948e-5f);
+    yc = _mm_add_ps(_mm_mul_ps(yc, z), _mm_set1_ps(-1.388731625493765e-3f));
+    yc = _mm_add_ps(_mm_mul_ps(yc, z), _mm_set1_ps(4.166664568298827e-2f));
+    yc = _mm_mul_ps(_mm_mul_ps(yc, z), z);
+    yc = _mm_sub_ps(yc, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+    yc = _mm_add_ps(yc, _mm_set1_ps(1.0f));
+
+    auto ys = _mm_set1_ps(-1.9515295891e-4f);
+    ys = _mm_add_ps(_mm_mul_ps(ys, z), _mm_set1_ps(8.3321608736e-3f));
+    ys = _mm_add_ps(_mm_mul_ps(ys, z), _mm_set1_ps(-1.6666654611e-1f));
+    ys = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ys, z), x), x);
+
+    auto sine = _mm_or_ps(_mm_and_ps(poly_mask, ys),
+                          _mm_andnot_ps(poly_mask, yc));
+    auto cosine = _mm_or_ps(_mm_and_ps(poly_mask, yc),
+                            _mm_andnot_ps(poly_mask, ys));
+    *s = _mm_xor_ps(sine, sign_sin);
+    *c = _mm_xor_ps(cosine, _mm_castsi128_ps(sign_cos));
+}
+
+// Transforms quads 4 at a time. Returns the number of quads transformed.
+TWO_TARGET("sse2")
+static size_t transform_quads_sse2(QuadBatch &b, const QuadProjection &p) {
+    const size_t n = b.size() & ~size_t(3);
+    const auto tile_w = _mm_set1_ps(p.tilesize.x);
+    const auto tile_h = _mm_set1_ps(p.tilesize.y);
+    const auto cam_scale = _mm_set1_ps(p.scale);
+    const auto offset_x = _mm_set1_epi32(p.offset.x);
+    const auto offset_y = _mm_set1_epi32(p.offset.y);
+    const auto screen_x = _mm_set1_epi32(p.screen.x);
+    const auto screen_y = _mm_set1_epi32(p.screen.y);
+    const auto zero = _mm_setzero_si128();
+
+    for (size_t i = 0; i < n; i += 4) {
+        auto px = _mm_loadu_ps(&b.x[i]);
+        auto py = _mm_loadu_ps(&b.y[i]);
+        auto sx = _mm_loadu_ps(&b.scale_x[i]);
+        auto sy = _mm_loadu_ps(&b.scale_y[i]);
+        auto ox = _mm_loadu_ps(&b.origin_x[i]);
+        auto oy = _mm_loadu_ps(&b.origin_y[i]);
+
+        auto wx = _mm_add_ps(_mm_mul_ps(ox, sx), px);
+        auto wy = _mm_add_ps(_mm_mul_ps(oy, sy), py);
+        auto x0 = _mm_sub_ps(px, wx);
+        auto x1 = _mm_sub_ps(_mm_add_ps(px, sx), wx);
+        auto y0 = _mm_sub_ps(py, wy);
+        auto y1 = _mm_sub_ps(_mm_add_ps(py, sy), wy);
+
+        __m128 min_x, min_y, max_x, max_y;
+        if (b.rotated) {
+            // Wrap to [-180, 180] degrees before converting to radians
+            auto deg = _mm_loadu_ps(&b.rotation[i]);
+            auto turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(
+                _mm_mul_ps(deg, _mm_set1_ps(1.0f / 360.0f))));
+            deg = _mm_sub_ps(deg, _mm_mul_ps(turns, _mm_set1_ps(360.0f)));
+            __m128 st, ct;
+            sincos_sse2(_mm_mul_ps(deg, _mm_set1_ps(DegToRad)), &st, &ct);
+
+            auto ct_x0 = _mm_mul_ps(ct, x0);
+            auto ct_x1 = _mm_mul_ps(ct, x1);
+            auto ct_y0 = _mm_mul_ps(ct, y0);
+            auto ct_y1 = _mm_mul_ps(ct, y1);
+            auto st_x0 = _mm_mul_ps(st, x0);
+            auto st_x1 = _mm_mul_ps(st, x1);
+            auto st_y0 = _mm_mul_ps(st, y0);
+            auto st_y1 = _mm_mul_ps(st, y1);
+
+            auto rx0 = _mm_mul_ps(_mm_add_ps(
+                _mm_sub_ps(ct_x0, st_y0), px), tile_w);
+            auto rx1 = _mm_mul_ps(_mm_add_ps(
+                _mm_sub_ps(ct_x1, st_y0), px), tile_w);
+            auto rx2 = _mm_mul_ps(_mm_add_ps(
+                _mm_sub_ps(ct_x1, st_y1), px), tile_w);
+            auto rx3 = _mm_mul_ps(_mm_add_ps(
+                _mm_sub_ps(ct_x0, st_y1), px), tile_w);
+            auto ry0 = _mm_mul_ps(_mm_add_ps(
+                _mm_add_ps(st_x0, ct_y0), py), tile_h);
+            auto ry1 = _mm_mul_ps(_mm_add_ps(
+                _mm_add_ps(st_x1, ct_y0), py), tile_h);
+            auto ry2 = _mm_mul_ps(_mm_add_ps(
+                _mm_add_ps(st_x1, ct_y1), py), tile_h);
+            auto ry3 = _mm_mul_ps(_mm_add_ps(
+                _mm_add_ps(st_x0, ct_y1), py), tile_h);
+
+            min_x = _mm_min_ps(_mm_min_ps(rx0, rx1), _mm_min_ps(rx2, rx3));
+            max_x = _mm_max_ps(_mm_max_ps(rx0, rx1), _mm_max_ps(rx2, rx3));
+            min_y = _mm_min_ps(_mm_min_ps(ry0, ry1), _mm_min_ps(ry2, ry3));
+            max_y = _mm_max_ps(_mm_max_ps(ry0, ry1), _mm_max_ps(ry2, ry3));
+        } else {
+            // Without rotation the box is the quad itself
+            auto rx0 = _mm_mul_ps(_mm_add_ps(x0, px), tile_w);
+            auto rx1 = _mm_mul_ps(_mm_add_ps(x1, px), tile_w);
+            auto ry0 = _mm_mul_ps(_mm_add_ps(y0, py), tile_h);
+            auto ry1 = _mm_mul_ps(_mm_add_ps(y1, py), tile_h);
+            min_x = _mm_min_ps(rx0, rx1);
+            max_x = _mm_max_ps(rx0, rx1);
+            min_y = _mm_min_ps(ry0, ry1);
+            max_y = _mm_max_ps(ry0, ry1);
+        }
+
+        auto box_min_x = _mm_add_epi32(_mm_cvttps_epi32(min_x), offset_x);
+        auto box_min_y = _mm_add_epi32(_mm_cvttps_epi32(min_y), offset_y);
+        auto box_max_x = _mm_add_epi32(_mm_cvttps_epi32(max_x), offset_x);
+        auto box_max_y = _mm_add_epi32(_mm_cvttps_epi32(max_y), offset_y);
+        auto culled = _mm_or_si128(
+            _mm_or_si128(_mm_cmpgt_epi32(box_min_x, screen_x),
+                         _mm_cmpgt_epi32(box_min_y, screen_y)),
+            _mm_or_si128(_mm_cmpgt_epi32(zero, box_max_x),
+                         _mm_cmpgt_epi32(zero, box_max_y)));
+        int culled_bits = _mm_movemask_ps(_mm_castsi128_ps(culled));
+        for (int k = 0; k < 4; ++k) {
+            b.visible[i + k] = ((culled_bits >> k) & 1) == 0;
+        }
+
+        auto w = _mm_mul_ps(_mm_mul_ps(sx, _mm_loadu_ps(&b.width[i])),
+                            cam_scale);
+        auto h = _mm_mul_ps(_mm_mul_ps(sy, _mm_loadu_ps(&b.height[i])),
+                            cam_scale);
+        auto ws_x = _mm_cvtepi32_ps(_mm_add_epi32(
+            _mm_cvttps_epi32(_mm_mul_ps(px, tile_w)), offset_x));
+        auto ws_y = _mm_cvtepi32_ps(_mm_add_epi32(
+            _mm_cvttps_epi32(_mm_mul_ps(py, tile_h)), offset_y));
+
+        _mm_storeu_si128((__m128i *)&b.dst_x[i], _mm_cvttps_epi32(
+            _mm_sub_ps(ws_x, _mm_mul_ps(ox, w))));
+        _mm_storeu_si128((__m128i *)&b.dst_y[i], _mm_cvttps_epi32(
+            _mm_sub_ps(ws_y, _mm_mul_ps(oy, h))));
+        _mm_storeu_si128((__m128i *)&b.dst_w[i], _mm_cvttps_epi32(w));
+        _mm_storeu_si128((__m128i *)&b.dst_h[i], _mm_cvttps_epi32(h));
+    }
+    return n;
+}
+
+// Same as sincos_sse2 with 8 lanes.
+TWO_TARGET("avx2")
+static void sincos_avx2(__m256 x, __m256 *s, __m256 *c) {
+    const __m256 sign_mask = _mm256_castsi256_ps(
+        _mm256_set1_epi32(0x80000000));
+    auto sign_sin = _mm256_and_ps(x, sign_mask);
+    x = _mm256_andnot_ps(sign_mask, x);
+
+    auto j = _mm256_cvttps_epi32(
+        _mm256_mul_ps(x, _mm256_set1_ps(1.27323954473516f)));
+    j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)),
+                         _mm256_set1_epi32(~1));
+    auto y = _mm256_cvtepi32_ps(j);
+
+    auto swap_sin = _mm256_slli_epi32(
+        _mm256_and_si256(j, _mm256_set1_epi32(4)), 29);
+    auto poly_mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+        _mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_setzero_si256()));
+    auto sign_cos = _mm256_slli_epi32(_mm256_andnot_si256(
+        _mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29);
+    sign_sin = _mm256_xor_ps(sign_sin, _mm256_castsi256_ps(swap_sin));
+
+    x = _mm256_sub_ps(x, _mm256_mul_ps(y, _mm256_set1_ps(0.78515625f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(
+        y, _mm256_set1_ps(2.4187564849853515625e-4f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(
+        y, _mm256_set1_ps(3.77489497744594108e-8f)));
+    auto z = _mm256_mul_ps(x, x);
+
+    auto yc = _mm256_set1_ps(2.443315711809948e-5f);
+    yc = _mm256_add_ps(_mm256_mul_ps(yc, z),
+                       _mm256_set1_ps(-1.388731625493765e-3f));
+    yc = _mm256_add_ps(_mm256_mul_ps(yc, z),
+                       _mm256_set1_ps(4.166664568298827e-2f));
+    yc = _mm256_mul_ps(_mm256_mul_ps(yc, z), z);
+    yc = _mm256_sub_ps(yc, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+    yc = _mm256_add_ps(yc, _mm256_set1_ps(1.0f));
+
+    auto ys = _mm256_set1_ps(-1.9515295891e-4f);
+    ys = _mm256_add_ps(_mm256_mul_ps(ys, z),
+                       _mm256_set1_ps(8.3321608736e-3f));
+    ys = _mm256_add_ps(_mm256_mul_ps(ys, z),
+                       _mm256_set1_ps(-1.6666654611e-1f));
+    ys = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(ys, z), x), x);
+
+    auto sine = _mm256_blendv_ps(yc, ys, poly_mask);
+    auto cosine = _mm256_blendv_ps(ys, yc, poly_mask);
+    *s = _mm256_xor_ps(sine, sign_sin);
+    *c = _mm256_xor_ps(cosine, _mm256_castsi256_ps(sign_cos));
+}
+
+// Transforms quads 8 at a time. Returns the number of quads transformed.
+TWO_TARGET("avx2")
+static size_t transform_quads_avx2(QuadBatch &b, const QuadProjection &p) {
+    const size_t n = b.size() & ~size_t(7);
+    const auto tile_w = _mm256_set1_ps(p.tilesize.x);
+    const auto tile_h = _mm256_set1_ps(p.tilesize.y);
+    const auto cam_scale = _mm256_set1_ps(p.scale);
+    const auto offset_x = _mm256_set1_epi32(p.offset.x);
+    const auto offset_y = _mm256_set1_epi32(p.offset.y);
+    const auto screen_x = _mm256_set1_epi32(p.screen.x);
+    const auto screen_y = _mm256_set1_epi32(p.screen.y);
+    const auto zero = _mm256_setzero_si256();
+
+    for (size_t i = 0; i < n; i += 8) {
+        auto px = _mm256_loadu_ps(&b.x[i]);
+        auto py = _mm256_loadu_ps(&b.y[i]);
+        auto sx = _mm256_loadu_ps(&b.scale_x[i]);
+        auto sy = _mm256_loadu_ps(&b.scale_y[i]);
+        auto ox = _mm256_loadu_ps(&b.origin_x[i]);
+        auto oy = _mm256_loadu_ps(&b.origin_y[i]);
+
+        auto wx = _mm256_add_ps(_mm256_mul_ps(ox, sx), px);
+        auto wy = _mm256_add_ps(_mm256_mul_ps(oy, sy), py);
+        auto x0 = _mm256_sub_ps(px, wx);
+        auto x1 = _mm256_sub_ps(_mm256_add_ps(px, sx), wx);
+        auto y0 = _mm256_sub_ps(py, wy);
+        auto y1 = _mm256_sub_ps(_mm256_add_ps(py, sy), wy);
+
+        __m256 min_x, min_y, max_x, max_y;
+        if (b.rotated) {
+            auto deg = _mm256_loadu_ps(&b.rotation[i]);
+            auto turns = _mm256_round_ps(
+                _mm256_mul_ps(deg, _mm256_set1_ps(1.0f / 360.0f)),
+                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+            deg = _mm256_sub_ps(deg,
+                                _mm256_mul_ps(turns, _mm256_set1_ps(360.0f)));
+            __m256 st, ct;
+            sincos_avx2(_mm256_mul_ps(deg, _mm256_set1_ps(DegToRad)),
+                        &st, &ct);
+
+            auto ct_x0 = _mm256_mul_ps(ct, x0);
+            auto ct_x1 = _mm256_mul_ps(ct, x1);
+            auto ct_y0 = _mm256_mul_ps(ct, y0);
+            auto ct_y1 = _mm256_mul_ps(ct, y1);
+            auto st_x0 = _mm256_mul_ps(st, x0);
+            auto st_x1 = _mm256_mul_ps(st, x1);
+            auto st_y0 = _mm256_mul_ps(st, y0);
+            auto st_y1 = _mm256_mul_ps(st, y1);
+
+            auto rx0 = _mm256_mul_ps(_mm256_add_ps(
+                _mm256_sub_ps(ct_x0, st_y0), px), tile_w);
+            auto rx1 = _mm256_mul_ps(_mm256_add_ps(
+                _mm256_sub_ps(ct_x1, st_y0), px), tile_w);
+            auto rx2 = _mm256_mul_ps(_mm256_add_ps(
+                _mm256_sub_ps(ct_x1, st_y1), px), tile_w);
+            auto rx3 = _mm256_mul_ps(_mm256_add_ps(
+                _mm256_sub_ps(ct_x0, st_y1), px), tile_w);
+            auto ry0 = _mm256_mul_ps(_mm256_add_ps(
+                _mm256_add_ps(st_x0, ct_y0), py), tile_h);
+            auto ry1 = _mm256_mul_ps(_mm256_add_ps(
+                _mm256_add_ps(st_x1, ct_y0), py), tile_h);
+            auto ry2 = _mm256_mul_ps(_mm256_add_ps(
+                _mm256_add_ps(st_x1, ct_y1), py), tile_h);
+            auto ry3 = _mm256_mul_ps(_mm256_add_ps(
+                _mm256_add_ps(st_x0, ct_y1), py), tile_h);
+
+            min_x = _mm256_min_ps(_mm256_min_ps(rx0, rx1),
+                                  _mm256_min_ps(rx2, rx3));
+            max_x = _mm256_max_ps(_mm256_max_ps(rx0, rx1),
+                                  _mm256_max_ps(rx2, rx3));
+            min_y = _mm256_min_ps(_mm256_min_ps(ry0, ry1),
+                                  _mm256_min_ps(ry2, ry3));
+            max_y = _mm256_max_ps(_mm256_max_ps(ry0, ry1),
+                                  _mm256_max_ps(ry2, ry3));
+        } else {
+            auto rx0 = _mm256_mul_ps(_mm256_add_ps(x0, px), tile_w);
+            auto rx1 = _mm256_mul_ps(_mm256_add_ps(x1, px), tile_w);
+            auto ry0 = _mm256_mul_ps(_mm256_add_ps(y0, py), tile_h);
+            auto ry1 = _mm256_mul_ps(_mm256_add_ps(y1, py), tile_h);
+            min_x = _mm256_min_ps(rx0, rx1);
+            max_x = _mm256_max_ps(rx0, rx1);
+            min_y = _mm256_min_ps(ry0, ry1);
+            max_y = _mm256_max_ps(ry0, ry1);
+        }
+
+        auto box_min_x = _mm256_add_epi32(_mm256_cvttps_epi32(min_x),
+                                          offset_x);
+        auto box_min_y = _mm256_add_epi32(_mm256_cvttps_epi32(min_y),
+                                          offset_y);
+        auto box_max_x = _mm256_add_epi32(_mm256_cvttps_epi32(max_x),
+                                          offset_x);
+        auto box_max_y = _mm256_add_epi32(_mm256_cvttps_epi32(max_y),
+                                          offset_y);
+        auto culled = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpgt_epi32(box_min_x, screen_x),
+                            _mm256_cmpgt_epi32(box_min_y, screen_y)),
+            _mm256_or_si256(_mm256_cmpgt_epi32(zero, box_max_x),
+                            _mm256_cmpgt_epi32(zero, box_max_y)));
+        int culled_bits = _mm256_movemask_ps(_mm256_castsi256_ps(culled));
+        for (int k = 0; k < 8; ++k) {
+            b.visible[i + k] = ((culled_bits >> k) & 1) == 0;
+        }
+
+        auto w = _mm256_mul_ps(
+            _mm256_mul_ps(sx, _mm256_loadu_ps(&b.width[i])), cam_scale);
+        auto h = _mm256_mul_ps(
+            _mm256_mul_ps(sy, _mm256_loadu_ps(&b.height[i])), cam_scale);
+        auto ws_x = _mm256_cvtepi32_ps(_mm256_add_epi32(
+            _mm256_cvttps_epi32(_mm256_mul_ps(px, tile_w)), offset_x));
+        auto ws_y = _mm256_cvtepi32_ps(_mm256_add_epi32(
+            _mm256_cvttps_epi32(_mm256_mul_ps(py, tile_h)), offset_y));
+
+        _mm256_storeu_si256((__m256i *)&b.dst_x[i], _mm256_cvttps_epi32(
+            _mm256_sub_ps(ws_x, _mm256_mul_ps(ox, w))));
+        _mm256_storeu_si256((__m256i *)&b.dst_y[i], _mm256_cvttps_epi32(
+            _mm256_sub_ps(ws_y, _mm256_mul_ps(oy, h))));
+        _mm256_storeu_si256((__m256i *)&b.dst_w[i], _mm256_cvttps_epi32(w));
+        _mm256_storeu_si256((__m256i *)&b.dst_h[i], _mm256_cvttps_epi32(h));
+    }
+    return n;
+}
+
+#endif // TWO_SSE
+
+static SimdLevel detect_simd_level() {
+#ifdef TWO_SSE
+    if (SDL_HasAVX2()) {
+        return SimdLevel::AVX2;
+    }
+    if (SDL_HasSSE2()) {
+        return SimdLevel::SSE2;
+    }
+#endif
+    return SimdLevel::Scalar;
+}
+
+SimdLevel simd_level() {
+    static const SimdLevel level = detect_simd_level();
+    return level;
+}
+
+void transform_quads(QuadBatch &batch, const QuadProjection &projection) {
+    transform_quads(batch, projection, simd_level());
+}
+
+void transform_quads(QuadBatch &batch, const QuadProjection &projection,
+                     SimdLevel level) {
+    TWO_PROFILE_FUNC();
+    ASSERTS(int(level) <= int(simd_level()), "Unsupported instruction set");
+    auto n = batch.size();
+    batch.dst_x.resize(n);
+    batch.dst_y.resize(n);
+    batch.dst_w.resize(n);
+    batch.dst_h.resize(n);
+    batch.visible.resize(n);
+
+    // The SIMD versions leave the last few quads to the scalar version
+    size_t done = 0;
+    switch (level) {
+#ifdef TWO_SSE
+    case SimdLevel::AVX2:
+        done = transform_quads_avx2(batch, projection);
+        break;
+    case SimdLevel::SSE2:
+        done = transform_quads_sse2(batch, projection);
+        break;
+#endif
+    default:
+        break;
+    }
+    transform_quads_scalar(batch, projection, done, n);
+}
+
+} // two
@@ -0,0 +1,113 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef TWO_QUAD_H
+#define TWO_QUAD_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "mathf.h"
+
+namespace two {
+
+enum class SimdLevel { Scalar, SSE2, AVX2 };
+
+// Sprite quads in structure of arrays layout. Inputs are added with
+// `push`, `transform_quads` fills in the outputs for the whole batch.
+//
+//     batch.clear();
+//     for (auto entity : entities) {
+//         batch.push(position, scale, origin, size, angle);
+//     }
+//     transform_quads(batch, projection);
+//
+struct QuadBatch {
+    // Transform position and scale in world units.
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> scale_x;
+    std::vector<float> scale_y;
+
+    // Origin of the quad from (0, 0) to (1, 1).
+    std::vector<float> origin_x;
+    std::vector<float> origin_y;
+
+    // Size of the sprite in pixels.
+    std::vector<float> width;
+    std::vector<float> height;
+
+    // Rotation in degrees.
+    std::vector<float> rotation;
+
+    // False if every quad has a rotation of 0, in which case the rotation
+    // step is skipped.
+    bool rotated = false;
+
+    // Destination rects in screen space, set by `transform_quads`.
+    std::vector<int32_t> dst_x;
+    std::vector<int32_t> dst_y;
+    std::vector<int32_t> dst_w;
+    std::vector<int32_t> dst_h;
+
+    // 0 if the rotated quad is outside the screen, set by
+    // `transform_quads`.
+    std::vector<uint8_t> visible;
+
+    void push(const float2 &position, const float2 &scale,
+              const float2 &origin, const float2 &size, float angle);
+
+    void clear();
+
+    inline size_t size() const { return x.size(); }
+};
+
+// Camera values used to project quads, see `SpriteRenderer`.
+struct QuadProjection {
+    // Camera tile size in pixels multiplied by the camera scale.
+    float2 tilesize;
+    float scale;
+
+    // Added to every projected position, usually half of the screen
+    // size minus the camera position in pixels.
+    int2 offset;
+
+    // Size of the screen in pixels. Quads that do not overlap the
+    // screen are not visible.
+    int2 screen;
+};
+
+// Computes the screen space bounding box of every quad to cull quads
+// outside of the screen, and the destination rect of the quad. Results
+// are the same as transforming each quad separately, except that
+// rotated quads near the edge of the screen may be culled slightly
+// differently by the SIMD versions.
+void transform_quads(QuadBatch &batch, const QuadProjection &projection);
+
+// Same as above with a specific instruction set, which must be supported
+// by the CPU. Meant for tests and benchmarks.
+void transform_quads(QuadBatch &batch, const QuadProjection &projection,
+                     SimdLevel level);
+
+// The best instruction set supported by the CPU, checked once.
+SimdLevel simd_level();
+
+} // two
+
+#endif // TWO_QUAD_H
@@ -0,0 +1,196 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#include "render.h"
+
+#include "debug.h"
+
+namespace two {
+
+// Key layout from most to least significant bits:
+// pass:8 | layer:8 | texture:14 | flip:2 | color:32
+//
+// Alpha is part of the color so sprites that only differ in alpha are
+// grouped too. Texture indices past 14 bits wrap, which only makes
+// grouping less effective since each command keeps its own texture.
+static constexpr int PassShift = 56;
+static constexpr int LayerShift = 48;
+static constexpr int TextureShift = 34;
+static constexpr int FlipShift = 32;
+static constexpr uint64_t MaxPass = (uint64_t(1) << 8) - 1;
+static constexpr uint64_t TextureMask = (uint64_t(1) << 14) - 1;
+
+RenderCommand RenderCommand::copy(SDL_Texture *texture, const SDL_Rect &src,
+                                  const SDL_Rect &dst, const Color &color) {
+    return copy_ex(texture, src, dst, color, 0.0f, SDL_Point{0, 0},
+                   SDL_FLIP_NONE);
+}
+
+RenderCommand RenderCommand::copy_ex(SDL_Texture *texture,
+                                     const SDL_Rect &src, const SDL_Rect &dst,
+                                     const Color &color, float angle,
+                                     const SDL_Point &center, uint8_t flip) {
+    RenderCommand command;
+    command.key = 0;
+    command.texture = texture;
+    command.src = src;
+    command.dst = dst;
+    command.center = center;
+    command.angle = angle;
+    command.color = color;
+    command.flip = flip;
+    command.op = Copy;
+    command.texture_index = 0;
+    return command;
+}
+
+RenderCommand RenderCommand::fill(const SDL_Rect &dst, const Color &color) {
+    auto command = copy(nullptr, SDL_Rect{0, 0, 0, 0}, dst, color);
+    command.op = Fill;
+    return command;
+}
+
+RenderCommand RenderCommand::clear(const Color &color) {
+    auto command = fill(SDL_Rect{0, 0, 0, 0}, color);
+    command.op = Clear;
+    return command;
+}
+
+void RenderList::begin_pass() {
+    if (pass < MaxPass) {
+        ++pass;
+    } else {
+        log_warn("Too many render passes in a frame, passes will be merged");
+    }
+}
+
+uint32_t RenderList::texture_index(SDL_Texture *texture) {
+    if (texture == last_texture && !texture_states.empty()) {
+        return last_texture_index;
+    }
+    auto it = texture_ids.find(texture);
+    if (it == texture_ids.end()) {
+        auto index = uint32_t(texture_states.size());
+        texture_states.push_back(TextureState{texture, Color{}, false, false});
+        it = texture_ids.emplace(std::make_pair(texture, index)).first;
+    }
+    last_texture = texture;
+    last_texture_index = it->second;
+    return it->second;
+}
+
+void RenderList::add(RenderCommand command, uint64_t key) {
+    command.texture_index = texture_index(command.texture);
+    command.key = (pass << PassShift) | key;
+    command_list.push_back(command);
+}
+
+void RenderList::draw(const RenderCommand &command, uint8_t layer) {
+    // Texture indices start at 1 so grouped commands are drawn after
+    // ordered commands of the same layer
+    auto index = uint64_t(texture_index(command.texture)) + 1;
+    uint64_t key = uint64_t(layer) << LayerShift;
+    key |= (index & TextureMask) << TextureShift;
+    key |= uint64_t(command.flip & 3) << FlipShift;
+    key |= command.color.to_uint32();
+    add(command, key);
+}
+
+void RenderList::draw_ordered(const RenderCommand &command, uint8_t layer) {
+    add(command, uint64_t(layer) << LayerShift);
+}
+
+void RenderList::sort() {
+    TWO_PROFILE_FUNC();
+    internal::radix_sort(command_list, sort_temp);
+}
+
+void RenderList::submit(SDL_Renderer *renderer) {
+    TWO_PROFILE_FUNC();
+    render_stats = RenderStats{};
+    render_stats.commands = uint32_t(command_list.size());
+    SDL_Texture *bound = nullptr;
+
+    // Modulation may have been set outside of this list since the last
+    // submit, such as by a static layer or tilemap chunk being baked.
+    for (auto &state : texture_states) {
+        state.color_set = false;
+        state.alpha_set = false;
+    }
+
+    for (auto &command : command_list) {
+        auto &color = command.color;
+        switch (command.op) {
+        case RenderCommand::Clear:
+            SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b,
+                                   color.a);
+            SDL_RenderClear(renderer);
+            continue;
+        case RenderCommand::Fill:
+            SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b,
+                                   color.a);
+            SDL_RenderFillRect(renderer, &command.dst);
+            ++render_stats.draw_calls;
+            continue;
+        case RenderCommand::Copy:
+            break;
+        }
+
+        // Modulation is texture state, only set it when it changes
+        auto &state = texture_states[command.texture_index];
+        auto *texture = state.texture;
+        if (!state.color_set || state.color.r != color.r
+                || state.color.g != color.g || state.color.b != color.b) {
+            SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
+            state.color_set = true;
+            ++render_stats.state_changes;
+        }
+        if (!state.alpha_set || state.color.a != color.a) {
+            SDL_SetTextureAlphaMod(texture, color.a);
+            state.alpha_set = true;
+            ++render_stats.state_changes;
+        }
+        state.color = color;
+
+        if (texture != bound) {
+            ++render_stats.texture_changes;
+            bound = texture;
+        }
+        ++render_stats.draw_calls;
+
+        if (command.angle == 0.0f && command.flip == SDL_FLIP_NONE) {
+            SDL_RenderCopy(renderer, texture, &command.src, &command.dst);
+            continue;
+        }
+        SDL_RenderCopyEx(renderer, texture, &command.src, &command.dst,
+                         command.angle, &command.center,
+                         (SDL_RendererFlip)command.flip);
+    }
+}
+
+void RenderList::reset() {
+    command_list.clear();
+    texture_states.clear();
+    texture_ids.clear();
+    last_texture = nullptr;
+    last_texture_index = 0;
+    pass = 0;
+}
+
+} // two
@@ -0,0 +1,201 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#ifndef TWO_RENDER_H
+#define TWO_RENDER_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <unordered_map>
+
+#include "SDL.h"
+#include "image.h"
+
+namespace two {
+
+// A single draw operation recorded in a `RenderList`. Commands are plain
+// data so a list can be built away from the thread that submits it.
+struct RenderCommand {
+    enum Op : uint8_t {
+        // Copies `src` from `texture` to `dst`
+        Copy,
+        // Fills `dst` with `color`
+        Fill,
+        // Clears the whole target with `color`
+        Clear
+    };
+
+    // Set by `RenderList`, commands are drawn in key order.
+    uint64_t key;
+
+    // Textures must stay alive until the list is submitted. Textures
+    // released by `make_texture` are only destroyed on the main thread
+    // after the frame has been presented.
+    SDL_Texture *texture;
+
+    SDL_Rect src;
+    SDL_Rect dst;
+    SDL_Point center;
+    float angle;
+    Color color;
+    uint8_t flip;
+    Op op;
+
+    // Index of the texture in the list it was added to.
+    uint32_t texture_index;
+
+    static RenderCommand copy(SDL_Texture *texture, const SDL_Rect &src,
+                              const SDL_Rect &dst, const Color &color);
+
+    static RenderCommand copy_ex(SDL_Texture *texture, const SDL_Rect &src,
+                                 const SDL_Rect &dst, const Color &color,
+                                 float angle, const SDL_Point &center,
+                                 uint8_t flip);
+
+    static RenderCommand fill(const SDL_Rect &dst, const Color &color);
+
+    static RenderCommand clear(const Color &color);
+};
+
+// Counters from the last list submitted.
+struct RenderStats {
+    uint32_t commands;
+
+    // Number of copy and fill calls made to SDL.
+    uint32_t draw_calls;
+
+    // Copies that used a different texture than the previous copy. Each
+    // of these breaks a render batch.
+    uint32_t texture_changes;
+
+    // Number of color and alpha modulation calls.
+    uint32_t state_changes;
+};
+
+// Commands for a whole frame. Draw systems add commands, the list is
+// sorted once and then submitted to the renderer in a single pass, which
+// keeps SDL calls on the main thread and lets consecutive commands share
+// textures and modulation state.
+//
+//     auto &list = two::render_list();
+//     list.begin_pass();
+//     list.draw(RenderCommand::copy(tex, src, dst, Color::White), layer);
+//
+// Commands are ordered by pass, then by layer. Within a layer commands
+// added with `draw` are grouped by texture, flip and color while commands
+// added with `draw_ordered` keep the order they were added in.
+class RenderList {
+public:
+    // Starts a new pass. Every command of a pass is drawn after the
+    // commands of earlier passes. Each draw system should begin a pass.
+    void begin_pass();
+
+    // Adds a command that can be reordered within its layer.
+    void draw(const RenderCommand &command, uint8_t layer = 0);
+
+    // Adds a command that is drawn in the order it was added, before the
+    // commands added with `draw` in the same layer.
+    void draw_ordered(const RenderCommand &command, uint8_t layer = 0);
+
+    // Sorts commands by their key. The sort is stable.
+    void sort();
+
+    // Submits sorted commands to the renderer. Must be called on the main
+    // thread.
+    void submit(SDL_Renderer *renderer);
+
+    // Removes all commands.
+    void reset();
+
+    inline const std::vector<RenderCommand> &commands() const {
+        return command_list;
+    }
+
+    inline const RenderStats &stats() const { return render_stats; }
+
+private:
+    // Modulation last set on a texture while submitting. Only trusted
+    // during a single submit, other code sets modulation directly.
+    struct TextureState {
+        SDL_Texture *texture;
+        Color color;
+        bool color_set;
+        bool alpha_set;
+    };
+
+    std::vector<RenderCommand> command_list;
+    std::vector<RenderCommand> sort_temp;
+    std::vector<TextureState> texture_states;
+    std::unordered_map<SDL_Texture *, uint32_t> texture_ids;
+    SDL_Texture *last_texture = nullptr;
+    uint32_t last_texture_index = 0;
+    uint64_t pass = 0;
+    RenderStats render_stats{};
+
+    uint32_t texture_index(SDL_Texture *texture);
+    void add(RenderCommand command, uint64_t key);
+};
+
+namespace internal {
+
+// Stable LSD radix sort over the 8 bit digits of `item.key`. Digits that
+// are the same for every key are skipped.
+template <typename T>
+void radix_sort(std::vector<T> &items, std::vector<T> &temp) {
+    constexpr int Passes = 8;
+    size_t counts[Passes][256];
+    memset(counts, 0, sizeof(counts));
+    for (auto &item : items) {
+        for (int p = 0; p < Passes; ++p) {
+            ++counts[p][(item.key >> (p * 8)) & 0xff];
+        }
+    }
+
+    temp.resize(items.size());
+    auto *src = &items;
+    auto *dst = &temp;
+
+    for (int p = 0; p < Passes && !items.empty(); ++p) {
+        auto shift = p * 8;
+        auto *count = counts[p];
+        if (count[(items[0].key >> shift) & 0xff] == items.size()) {
+            continue;
+        }
+        size_t offset = 0;
+        for (int d = 0; d < 256; ++d) {
+            auto n = count[d];
+            count[d] = offset;
+            offset += n;
+        }
+        for (auto &item : *src) {
+            (*dst)[count[(item.key >> shift) & 0xff]++] = item;
+        }
+        std::swap(src, dst);
+    }
+    if (src != &items) {
+        items.swap(temp);
+    }
+}
+
+} // internal
+
+} // two
+
+#endif // TWO_RENDER_H
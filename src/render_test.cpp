@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "render.h"
+#include "debug.h"
+
+namespace two {
+namespace test {
+
+struct Keyed {
+    uint64_t key;
+    uint32_t index;
+};
+
+static void assert_sorted(std::vector<Keyed> items) {
+    auto expected = items;
+    std::stable_sort(expected.begin(), expected.end(),
+                     [](const Keyed &a, const Keyed &b) {
+                         return a.key < b.key;
+                     });
+    std::vector<Keyed> temp;
+    internal::radix_sort(items, temp);
+    ASSERT_ALWAYS(items.size() == expected.size());
+    for (size_t i = 0; i < items.size(); ++i) {
+        ASSERT_ALWAYS(items[i].key == expected[i].key);
+        // Stable, items with the same key keep their order
+        ASSERT_ALWAYS(items[i].index == expected[i].index);
+    }
+}
+
+void run_radix_sort_test() {
+    uint64_t seed = 12345;
+    auto next = [&seed]() {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        return seed;
+    };
+
+    std::vector<Keyed> items;
+    assert_sorted(items);
+
+    // Full width keys
+    for (uint32_t i = 0; i < 1000; ++i) {
+        items.push_back(Keyed{next(), i});
+    }
+    assert_sorted(items);
+
+    // Few distinct keys in the middle bytes, so most digits are skipped
+    // and many keys are equal
+    items.clear();
+    for (uint32_t i = 0; i < 1000; ++i) {
+        items.push_back(Keyed{((next() >> 60) << 24) | 0xff, i});
+    }
+    assert_sorted(items);
+
+    // Every key the same
+    items.assign(100, Keyed{7, 0});
+    for (uint32_t i = 0; i < items.size(); ++i) {
+        items[i].index = i;
+    }
+    assert_sorted(items);
+}
+
+void run_render_list_test() {
+    // The software renderer does not need a window
+    auto *surface = SDL_CreateRGBSurfaceWithFormat(0, 4, 4, 32,
+                                                   SDL_PIXELFORMAT_RGBA8888);
+    ASSERT_ALWAYS(surface != nullptr);
+    auto *renderer = SDL_CreateSoftwareRenderer(surface);
+    ASSERT_ALWAYS(renderer != nullptr);
+    auto *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                                      SDL_TEXTUREACCESS_STATIC, 1, 1);
+    ASSERT_ALWAYS(texture != nullptr);
+
+    RenderList list;
+    SDL_Rect rect{0, 0, 1, 1};
+    Color red{255, 0, 0, 128};
+    list.draw(RenderCommand::copy(texture, rect, rect, red));
+    list.draw(RenderCommand::copy(texture, rect, rect, red));
+    list.sort();
+    list.submit(renderer);
+    ASSERT_ALWAYS(list.stats().state_changes == 2);
+
+    // Modulation set outside of the list is not mistaken for the color
+    // the list last set
+    SDL_SetTextureColorMod(texture, 0, 255, 0);
+    SDL_SetTextureAlphaMod(texture, 255);
+    list.submit(renderer);
+    uint8_t r, g, b, a;
+    SDL_GetTextureColorMod(texture, &r, &g, &b);
+    SDL_GetTextureAlphaMod(texture, &a);
+    ASSERT_ALWAYS(r == 255 && g == 0 && b == 0 && a == 128);
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(surface);
+}
+
+} // test
+} // two
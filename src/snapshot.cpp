@@ -0,0 +1,202 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#include "snapshot.h"
+
+#include <cstring>
+
+#include "filesystem.h"
+#include "debug.h"
+
+namespace two {
+
+namespace internal {
+
+uint32_t hash_string(const char *s) {
+    uint32_t hash = 2166136261u;
+    for (; *s != '\0'; ++s) {
+        hash ^= uint8_t(*s);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+} // internal
+
+constexpr uint32_t SnapshotWriter::NullResource;
+
+void SnapshotWriter::write(const void *data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    auto offset = buffer.size();
+    buffer.resize(offset + size);
+    memcpy(buffer.data() + offset, data, size);
+}
+
+void SnapshotWriter::write_string(const std::string &s) {
+    write(uint32_t(s.size()));
+    write(s.data(), s.size());
+}
+
+uint32_t SnapshotWriter::add_typed_resource(
+        const std::shared_ptr<void> &resource, uint32_t type,
+        const std::string &key) {
+    ASSERT(resource != nullptr);
+    auto it = resource_lookup.find(resource.get());
+    if (it != resource_lookup.end()) {
+        ASSERT(resource_type_table[it->second] == type);
+        if (resource_keys[it->second].empty()) {
+            resource_keys[it->second] = key;
+        }
+        return it->second;
+    }
+    auto index = uint32_t(resource_table.size());
+    resource_table.push_back(resource);
+    resource_type_table.push_back(type);
+    resource_keys.push_back(key);
+    resource_lookup.emplace(std::make_pair(resource.get(), index));
+    return index;
+}
+
+void SnapshotWriter::reset() {
+    buffer.clear();
+    resource_table.clear();
+    resource_type_table.clear();
+    resource_keys.clear();
+    resource_lookup.clear();
+}
+
+bool SnapshotWriter::save(const std::string &filename) const {
+    TWO_PROFILE_FUNC();
+    File file(filename);
+    if (!file.open(FileMode::Write)) {
+        return false;
+    }
+    // Resources are listed by key so they can be loaded again by a
+    // different run, an empty key must be added by the reader.
+    SnapshotWriter header;
+    header.write(uint32_t(resource_keys.size()));
+    for (size_t i = 0; i < resource_keys.size(); ++i) {
+        header.write(resource_type_table[i]);
+        header.write_string(resource_keys[i]);
+    }
+    bool ok = file.write((const char *)header.buffer.data(),
+                         header.buffer.size());
+    ok = ok && file.write((const char *)buffer.data(), buffer.size());
+    return file.close() && ok;
+}
+
+SnapshotReader::SnapshotReader(const uint8_t *data, size_t size)
+    : buffer(data, data + size) {}
+
+SnapshotReader::SnapshotReader(const SnapshotWriter &writer)
+    : view(writer.data().data()), view_size(writer.size()) {
+    const auto &resources = writer.resources();
+    for (size_t i = 0; i < resources.size(); ++i) {
+        add_resource(resources[i], writer.resource_types()[i]);
+    }
+}
+
+bool SnapshotReader::open(const std::string &filename) {
+    TWO_PROFILE_FUNC();
+    File file(filename);
+    if (!file.open(FileMode::Read)) {
+        return false;
+    }
+    view = nullptr;
+    buffer.resize(file.size());
+    pos = 0;
+    failed = file.read((char *)buffer.data(), buffer.size())
+             != int64_t(buffer.size());
+
+    resource_table.clear();
+    resources_added = 0;
+    auto count = read<uint32_t>();
+    for (uint32_t i = 0; i < count && !failed; ++i) {
+        auto type = read<uint32_t>();
+        resource_table.push_back(Resource{nullptr, type, read_string(),
+                                          false});
+    }
+    if (failed) {
+        log_error("Snapshot: could not read %s", filename.c_str());
+        return false;
+    }
+    // Offsets in the snapshot are relative to the data after the header
+    buffer.erase(buffer.begin(), buffer.begin() + pos);
+    pos = 0;
+    return true;
+}
+
+void SnapshotReader::add_resource(const std::shared_ptr<void> &resource,
+                                  uint32_t type) {
+    if (resources_added < resource_table.size()) {
+        auto &entry = resource_table[resources_added++];
+        if (entry.type != type) {
+            log_warn("Snapshot: resource %u has a different type",
+                     unsigned(resources_added - 1));
+            return;
+        }
+        entry.resource = resource;
+        return;
+    }
+    resource_table.push_back(Resource{resource, type, std::string{}, false});
+    ++resources_added;
+}
+
+bool SnapshotReader::read(void *dst, size_t size) {
+    if (failed || size > this->size() - pos) {
+        failed = true;
+        memset(dst, 0, size);
+        return false;
+    }
+    memcpy(dst, bytes() + pos, size);
+    pos += size;
+    return true;
+}
+
+std::string SnapshotReader::read_string() {
+    auto size = read<uint32_t>();
+    if (failed || size > this->size() - pos) {
+        failed = true;
+        return std::string{};
+    }
+    std::string s((const char *)bytes() + pos, size);
+    pos += size;
+    return s;
+}
+
+bool SnapshotReader::skip(size_t size) {
+    if (failed || size > this->size() - pos) {
+        failed = true;
+        return false;
+    }
+    pos += size;
+    return true;
+}
+
+bool SnapshotReader::seek(size_t offset) {
+    if (failed || offset > size()) {
+        failed = true;
+        return false;
+    }
+    pos = offset;
+    return true;
+}
+
+} // two
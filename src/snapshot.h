@@ -0,0 +1,355 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+#ifndef TWO_SNAPSHOT_H
+#define TWO_SNAPSHOT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <type_traits>
+
+#include "debug.h"
+
+namespace two {
+
+namespace internal {
+
+// 32 bit FNV-1a hash.
+uint32_t hash_string(const char *s);
+
+} // internal
+
+// Tag saved with each resource in a snapshot so that a resource is never
+// read back as a different type. The tag is generated from a signature
+// made by the compiler, like `type_name()`, so it does not change between
+// builds.
+template <typename T>
+uint32_t resource_type() {
+    static const uint32_t type = internal::hash_string(TWO_PRETTY_FUNCTION);
+    return type;
+}
+
+// Writes binary snapshot data to a memory buffer. The buffer is written
+// to a file in a single call with `save()`, after the keys of the
+// resources it refers to.
+//
+//     SnapshotWriter writer;
+//     world->save_snapshot(writer);
+//     writer.save("quicksave.dat");
+//
+class SnapshotWriter {
+public:
+    // Appends raw bytes to the buffer.
+    void write(const void *data, size_t size);
+
+    // Appends a single value. T must be trivially copyable.
+    template <typename T>
+    void write(const T &value);
+
+    void write_string(const std::string &s);
+
+    // Overwrites a value that has already been written. Useful for sizes
+    // that are only known after writing a block.
+    template <typename T>
+    void write_at(size_t offset, const T &value);
+
+    // Shared resources such as textures and fonts cannot be written to a
+    // snapshot. Instead they are written as an index into a resource table.
+    // Resources with a `key` (the asset key they are cached with) are
+    // loaded again by key when the file is opened. Other resources must
+    // be added in a known order before saving so the same table can be
+    // rebuilt with `SnapshotReader::add_resource` when loading. The
+    // resource is saved with its type, see `resource_type()`.
+    template <typename T>
+    uint32_t add_resource(const std::shared_ptr<T> &resource,
+                          const std::string &key = std::string{});
+
+    // Writes the index of a resource, adding it to the resource table if
+    // it is not already there. A null resource is written as `NullResource`.
+    template <typename T>
+    void write_resource(const std::shared_ptr<T> &resource);
+
+    // Same as `write_resource(resource)` but the resource is saved with
+    // the key returned by `key_of(resource)`, such as the key it has in a
+    // `ResourceCache`. `key_of` is only called the first time a resource
+    // is written.
+    template <typename T, typename KeyOf>
+    void write_resource(const std::shared_ptr<T> &resource, KeyOf key_of);
+
+    // Writes the resource keys and the buffer to a file in the write
+    // directory. Returns true if successful.
+    bool save(const std::string &filename) const;
+
+    // Clears written data, the resource table is kept.
+    inline void clear() { buffer.clear(); }
+
+    // Clears written data and the resource table.
+    void reset();
+
+    // Discards everything written after `size` bytes.
+    inline void truncate(size_t size) {
+        ASSERT(size <= buffer.size());
+        buffer.resize(size);
+    }
+
+    inline const std::vector<uint8_t> &data() const { return buffer; }
+    inline size_t size() const { return buffer.size(); }
+
+    // Resources in the order they were added.
+    inline const std::vector<std::shared_ptr<void>> &resources() const {
+        return resource_table;
+    }
+
+    // Type of each resource in `resources()`.
+    inline const std::vector<uint32_t> &resource_types() const {
+        return resource_type_table;
+    }
+
+    static constexpr uint32_t NullResource = 0xffffffff;
+
+private:
+    std::vector<uint8_t> buffer;
+    std::vector<std::shared_ptr<void>> resource_table;
+    std::vector<uint32_t> resource_type_table;
+    std::vector<std::string> resource_keys;
+    std::unordered_map<const void *, uint32_t> resource_lookup;
+
+    uint32_t add_typed_resource(const std::shared_ptr<void> &resource,
+                                uint32_t type, const std::string &key);
+};
+
+// Reads binary snapshot data written by a `SnapshotWriter`.
+class SnapshotReader {
+public:
+    SnapshotReader() = default;
+    SnapshotReader(const uint8_t *data, size_t size);
+
+    // Reads the data in `writer` in place instead of copying it, and adds
+    // its resource table. The writer must not change while it is read.
+    explicit SnapshotReader(const SnapshotWriter &writer);
+
+    // Reads an entire snapshot file written by `SnapshotWriter::save`.
+    // The resource table is replaced by the resource keys in the file.
+    // Returns true if successful.
+    bool open(const std::string &filename);
+
+    // Copies raw bytes from the buffer. Returns false and marks the reader
+    // as failed if there is not enough data left.
+    bool read(void *dst, size_t size);
+
+    // Reads a single value. T must be trivially copyable.
+    template <typename T>
+    T read();
+
+    std::string read_string();
+
+    // Skips a number of bytes without reading them.
+    bool skip(size_t size);
+
+    // Moves to an absolute position in the buffer.
+    bool seek(size_t offset);
+
+    // Adds a resource to the resource table, see
+    // `SnapshotWriter::add_resource`. After `open` this sets the resources
+    // read from the file in order instead, so resources without a key can
+    // still be provided. A resource that does not have the type saved in
+    // the file is not set.
+    template <typename T>
+    void add_resource(const std::shared_ptr<T> &resource);
+
+    // Same as `add_resource(resource)` with the type given explicitly, for
+    // resources from `SnapshotWriter::resources()`.
+    void add_resource(const std::shared_ptr<void> &resource, uint32_t type);
+
+    // Reads a resource index and returns the resource it refers to.
+    // Returns null if the index is not in the resource table or the
+    // resource is not a T.
+    template <typename T>
+    std::shared_ptr<T> read_resource();
+
+    // Same as `read_resource()` but a resource that was saved with a key
+    // and has not been added is loaded with `load(key)`, which returns a
+    // `std::shared_ptr<T>`. Each key is only loaded once per reader.
+    template <typename T, typename Load>
+    std::shared_ptr<T> read_resource(Load load);
+
+    // False if a read has failed.
+    inline bool ok() const { return !failed; }
+
+    inline size_t tell() const { return pos; }
+    inline size_t size() const {
+        return view != nullptr ? view_size : buffer.size();
+    }
+
+    // Bytes left to read. Use to bound counts read from the buffer
+    // before allocating for them.
+    inline size_t remaining() const { return size() - pos; }
+
+private:
+    struct Resource {
+        std::shared_ptr<void> resource;
+        // See `resource_type()`
+        uint32_t type;
+        std::string key;
+        // True once the key has been given to a loader
+        bool loaded;
+    };
+
+    std::vector<uint8_t> buffer;
+    // Data read in place, used instead of `buffer` if not null
+    const uint8_t *view = nullptr;
+    size_t view_size = 0;
+    std::vector<Resource> resource_table;
+    // Number of resources set with `add_resource`
+    size_t resources_added = 0;
+    size_t pos = 0;
+    bool failed = false;
+
+    inline const uint8_t *bytes() const {
+        return view != nullptr ? view : buffer.data();
+    }
+};
+
+// Controls how a component type is written to a snapshot. By default
+// trivially copyable components are enabled and copied in a single block,
+// other components are skipped unless this template is specialized.
+//
+//     template <>
+//     struct Serializer<Inventory> {
+//         static constexpr bool enabled = true;
+//         static void save(SnapshotWriter &w, const Inventory *items,
+//                          size_t count);
+//         static void load(SnapshotReader &r, Inventory *items,
+//                          size_t count);
+//     };
+//
+// Components are stored in contiguous pages, `save` and `load` are called
+// once per page with all components in that page.
+template <typename T>
+struct Serializer {
+    static constexpr bool enabled = std::is_trivially_copyable<T>::value
+                                    && std::is_default_constructible<T>::value;
+
+    static void save(SnapshotWriter &writer, const T *items, size_t count) {
+        writer.write((const void *)items, sizeof(T) * count);
+    }
+
+    static void load(SnapshotReader &reader, T *items, size_t count) {
+        reader.read((void *)items, sizeof(T) * count);
+    }
+};
+
+template <typename T>
+constexpr bool Serializer<T>::enabled;
+
+template <typename T>
+void SnapshotWriter::write(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T must be trivially copyable");
+    write((const void *)&value, sizeof(T));
+}
+
+template <typename T>
+void SnapshotWriter::write_at(size_t offset, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T must be trivially copyable");
+    ASSERT(offset + sizeof(T) <= buffer.size());
+    memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+uint32_t SnapshotWriter::add_resource(const std::shared_ptr<T> &resource,
+                                      const std::string &key) {
+    return add_typed_resource(resource, resource_type<T>(), key);
+}
+
+template <typename T>
+void SnapshotWriter::write_resource(const std::shared_ptr<T> &resource) {
+    if (resource == nullptr) {
+        write(NullResource);
+        return;
+    }
+    write(add_resource(resource));
+}
+
+template <typename T, typename KeyOf>
+void SnapshotWriter::write_resource(const std::shared_ptr<T> &resource,
+                                    KeyOf key_of) {
+    if (resource == nullptr) {
+        write(NullResource);
+        return;
+    }
+    auto it = resource_lookup.find(resource.get());
+    if (it != resource_lookup.end()) {
+        write(it->second);
+        return;
+    }
+    write(add_resource(resource, key_of(resource)));
+}
+
+template <typename T>
+void SnapshotReader::add_resource(const std::shared_ptr<T> &resource) {
+    add_resource(resource, resource_type<T>());
+}
+
+template <typename T>
+T SnapshotReader::read() {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "T must be trivially copyable");
+    T value{};
+    read((void *)&value, sizeof(T));
+    return value;
+}
+
+template <typename T>
+std::shared_ptr<T> SnapshotReader::read_resource() {
+    auto index = read<uint32_t>();
+    if (index >= resource_table.size()
+        || resource_table[index].type != resource_type<T>()) {
+        return nullptr;
+    }
+    return std::static_pointer_cast<T>(resource_table[index].resource);
+}
+
+template <typename T, typename Load>
+std::shared_ptr<T> SnapshotReader::read_resource(Load load) {
+    auto index = read<uint32_t>();
+    if (index >= resource_table.size()
+        || resource_table[index].type != resource_type<T>()) {
+        return nullptr;
+    }
+    auto &entry = resource_table[index];
+    if (entry.resource == nullptr && !entry.loaded && !entry.key.empty()) {
+        entry.loaded = true;
+        entry.resource = std::shared_ptr<T>(load(entry.key));
+        if (entry.resource == nullptr) {
+            log_warn("Snapshot: could not load resource '%s'",
+                     entry.key.c_str());
+        }
+    }
+    return std::static_pointer_cast<T>(entry.resource);
+}
+
+} // two
+
+#endif // TWO_SNAPSHOT_H
@@ -0,0 +1,145 @@
+#include <memory>
+#include <vector>
+
+#include "entity.h"
+#include "snapshot.h"
+#include "debug.h"
+
+namespace two {
+namespace test {
+
+struct Velocity {
+    float x, y;
+};
+
+struct Inventory {
+    std::vector<int> slots;
+};
+
+struct Font {};
+
+} // test
+
+template <>
+struct Serializer<test::Inventory> {
+    static constexpr bool enabled = true;
+
+    static void save(SnapshotWriter &writer, const test::Inventory *items,
+                     size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            const auto &slots = items[i].slots;
+            writer.write(uint32_t(slots.size()));
+            writer.write(slots.data(), sizeof(int) * slots.size());
+        }
+    }
+
+    static void load(SnapshotReader &reader, test::Inventory *items,
+                     size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            auto size = reader.read<uint32_t>();
+            if (size > reader.remaining() / sizeof(int)) {
+                return;
+            }
+            items[i].slots.resize(size);
+            reader.read(items[i].slots.data(), sizeof(int) * size);
+        }
+    }
+};
+
+namespace test {
+
+void run_snapshot_test() {
+    World world;
+    std::vector<Entity> entities;
+    for (int i = 0; i < 300; ++i) {
+        auto entity = world.make_entity();
+        world.pack(entity, Velocity{float(i), 1.0f});
+        if (i % 3 == 0) {
+            world.pack(entity, Inventory{std::vector<int>(i % 7, i)});
+        }
+        entities.push_back(entity);
+    }
+    world.destroy_entity(entities[10]);
+    world.collect_unused_entities();
+
+    SnapshotWriter writer;
+    world.save_snapshot(writer);
+
+    World loaded;
+    SnapshotReader reader(writer);
+    ASSERT_ALWAYS(loaded.load_snapshot(reader));
+    ASSERT_ALWAYS(loaded.view<Velocity>().size() == 299);
+    ASSERT_ALWAYS(!loaded.has_component<Velocity>(entities[10]));
+    for (int i = 0; i < 300; ++i) {
+        if (i == 10) {
+            continue;
+        }
+        auto entity = entities[i];
+        ASSERT_ALWAYS(loaded.unpack<Velocity>(entity).x == float(i));
+        ASSERT_ALWAYS(loaded.has_component<Inventory>(entity)
+                      == (i % 3 == 0));
+        if (i % 3 == 0) {
+            const auto &slots = loaded.unpack<Inventory>(entity).slots;
+            ASSERT_ALWAYS(slots == std::vector<int>(i % 7, i));
+        }
+    }
+    // The destroyed id is reused in the loaded world as well
+    ASSERT_ALWAYS(loaded.make_entity() == world.make_entity());
+
+    // A truncated snapshot is rejected and leaves the world empty
+    SnapshotReader truncated(writer.data().data(), writer.size() / 2);
+    ASSERT_ALWAYS(!loaded.load_snapshot(truncated));
+    ASSERT_ALWAYS(loaded.view<Velocity>().empty());
+
+    // Ids out of range or that do not add up to the alive count are
+    // rejected as well
+    const size_t ids_offset = 4 * sizeof(uint32_t);
+    SnapshotWriter corrupted;
+    world.save_snapshot(corrupted);
+    corrupted.write_at(ids_offset + sizeof(Entity), Entity(TWO_ENTITY_MAX));
+    SnapshotReader out_of_range(corrupted);
+    ASSERT_ALWAYS(!loaded.load_snapshot(out_of_range));
+    ASSERT_ALWAYS(loaded.view<Velocity>().empty());
+
+    corrupted.write_at(ids_offset + sizeof(Entity), entities[0]);
+    corrupted.write_at(ids_offset + 2 * sizeof(Entity), entities[0]);
+    SnapshotReader duplicate(corrupted);
+    ASSERT_ALWAYS(!loaded.load_snapshot(duplicate));
+    ASSERT_ALWAYS(loaded.view<Velocity>().empty());
+
+    SnapshotWriter miscounted;
+    world.save_snapshot(miscounted);
+    miscounted.write_at(2 * sizeof(uint32_t), uint32_t(TWO_ENTITY_MAX));
+    SnapshotReader alive_count(miscounted);
+    ASSERT_ALWAYS(!loaded.load_snapshot(alive_count));
+}
+
+void run_snapshot_resource_test() {
+    auto texture = std::make_shared<int>(42);
+    auto font = std::make_shared<Font>();
+
+    SnapshotWriter writer;
+    writer.write_resource(texture);
+    writer.write_resource(font);
+    writer.write_resource(texture);
+    writer.write_resource(std::shared_ptr<Font>(nullptr));
+    ASSERT_ALWAYS(writer.resources().size() == 2);
+
+    SnapshotReader reader(writer);
+    ASSERT_ALWAYS(reader.read_resource<int>() == texture);
+    ASSERT_ALWAYS(reader.read_resource<Font>() == font);
+    // Indices that refer to a resource of another type are not cast
+    ASSERT_ALWAYS(reader.read_resource<Font>() == nullptr);
+    ASSERT_ALWAYS(reader.read_resource<Font>() == nullptr);
+    ASSERT_ALWAYS(reader.ok());
+
+    // Resources added by hand must match the types that were saved
+    SnapshotReader rebuilt(writer.data().data(), writer.size());
+    rebuilt.add_resource(std::make_shared<Font>());
+    rebuilt.add_resource(font);
+    ASSERT_ALWAYS(rebuilt.read_resource<int>() == nullptr);
+    ASSERT_ALWAYS(rebuilt.read_resource<Font>() == font);
+}
+
+} // test
+} // two
@@ -21,16 +21,66 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <sstream>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
 
 #include "SDL_render.h"
 #include "mathf.h"
 #include "debug.h"
 #include "image.h"
+#include "filesystem.h"
+#include "job.h"
 #include "two.h"
 
 namespace two {
 
+constexpr bool Serializer<Sprite>::enabled;
+constexpr size_t Serializer<Sprite>::size;
+
+void Serializer<Sprite>::save(SnapshotWriter &writer,
+                              const Sprite *items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const auto &sprite = items[i];
+        writer.write_resource(sprite.texture, [](const Texture &texture) {
+            return texture_cache().key_of(texture);
+        });
+        writer.write(sprite.rect);
+        writer.write(sprite.origin);
+        writer.write(int32_t(sprite.flip));
+        writer.write(sprite.color);
+        writer.write(sprite.layer);
+    }
+}
+
+void Serializer<Sprite>::load(SnapshotReader &reader,
+                              Sprite *items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        auto &sprite = items[i];
+        sprite.texture = reader.read_resource<SDL_Texture>(load_texture);
+        sprite.rect = reader.read<Rect>();
+        sprite.origin = reader.read<float2>();
+        sprite.flip = Sprite::Flip(reader.read<int32_t>());
+        sprite.color = reader.read<Color>();
+        sprite.layer = reader.read<SpriteLayer>();
+    }
+}
+
+namespace internal {
+static Texture stage_texture(const Image *im);
+} // internal
+
 Texture make_texture(const Image *im, const Rect &rect) {
+    bool whole = rect.x == 0 && rect.y == 0 && rect.w == im->width()
+                 && rect.h == im->height();
+    if (whole && internal::is_async_load_thread()) {
+        // Uploaded within the frame budget, see upload_textures
+        return internal::stage_texture(im);
+    }
     const auto *src = im;
 
     if (im->get_pixelformat() != Image::RGBA32) {
@@ -38,14 +88,18 @@ Texture make_texture(const Image *im, const Rect &rect) {
         src = im->convert(Image::RGBA32);
     }
 
-    auto *tex = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA8888,
-                                  SDL_TEXTUREACCESS_TARGET,
-                                  im->width(), im->height());
-    ASSERT(tex != nullptr);
+    SDL_Texture *tex = nullptr;
+    // Worlds loaded with load_world_async create textures on a worker
+    run_on_main_thread([&]() {
+        tex = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA8888,
+                                SDL_TEXTUREACCESS_TARGET,
+                                im->width(), im->height());
+        ASSERT(tex != nullptr);
 
-    SDL_Rect q{int(rect.x), int(rect.y), int(rect.w), int(rect.h)};
-    SDL_UpdateTexture(tex, &q, (const void *)src->pixels(), src->pitch());
-    SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+        SDL_Rect q{int(rect.x), int(rect.y), int(rect.w), int(rect.h)};
+        SDL_UpdateTexture(tex, &q, (const void *)src->pixels(), src->pitch());
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    });
 
     if (im->get_pixelformat() != Image::RGBA32) {
         delete src;
@@ -60,17 +114,376 @@ Texture make_texture(const Image *im) {
 
 void update_texture(const Texture &tex, const Image *im) {
     ASSERT(im->get_pixelformat() == Image::RGBA32);
-    SDL_UpdateTexture(tex.get(), nullptr, (const void *)im->pixels(), im->pitch());
+    run_on_main_thread([&]() {
+        SDL_UpdateTexture(tex.get(), nullptr,
+                          (const void *)im->pixels(), im->pitch());
+    });
+}
+
+ResourceCache<SDL_Texture> &texture_cache() {
+    static ResourceCache<SDL_Texture> cache;
+    return cache;
+}
+
+Texture load_texture(const std::string &image_asset) {
+    return texture_cache().get(image_asset, [&]() -> Texture {
+        auto *im = load_image(image_asset);
+        if (im == nullptr) {
+            return nullptr;
+        }
+        auto texture = make_texture(im);
+        delete im;
+        return texture;
+    });
 }
 
 Optional<Sprite> load_sprite(const std::string &image_asset) {
-    auto *im = load_image(image_asset);
-    if (im == nullptr) {
+    auto texture = load_texture(image_asset);
+    if (texture == nullptr) {
         return {};
     }
-    auto sprite = make_sprite(im);
-    delete im;
-    return sprite;
+    int w, h;
+    SDL_QueryTexture(texture.get(), nullptr, nullptr, &w, &h);
+    return Sprite{texture, Rect{0.0f, 0.0f, float(w), float(h)}};
+}
+
+namespace internal {
+
+// Requests from load_texture_async between decoding and upload.
+struct TextureUploads {
+    std::mutex mutex;
+    std::deque<std::weak_ptr<TextureRequest>> queue;
+    JobGroup decoding;
+    // Requests that are not done yet by asset, so requesting an asset
+    // that is already loading shares the request.
+    std::unordered_map<std::string, std::weak_ptr<TextureRequest>> loading;
+    // Textures created by make_texture while a world loads, uploaded
+    // before any requests.
+    struct Staged {
+        Texture texture;
+        std::unique_ptr<Image> image;
+        int rows_uploaded;
+    };
+    std::deque<Staged> staged;
+    std::atomic<uint32_t> decoding_count{0};
+    std::atomic<int64_t> budget{4 * 1024 * 1024};
+    std::atomic<uint64_t> last_frame_bytes{0};
+
+    TextureUploads() {
+        // Create the pool first so it is destroyed after this
+        job_pool();
+    }
+
+    ~TextureUploads() { job_pool().wait(decoding); }
+
+    // Returns the request already loading `image_asset`, a request that
+    // is done if the texture is cached, or queues the image to be decoded.
+    std::shared_ptr<TextureRequest> start(const std::string &image_asset);
+
+    void decode(const std::weak_ptr<TextureRequest> &weak);
+
+    // Marks a request as done or failed. Must hold `mutex`.
+    void finish_locked(TextureRequest *request, TextureRequest::State state);
+
+    // Uploads rows of a request, at most `budget` bytes unless it is 0.
+    // Returns the number of bytes uploaded, or -1 if the texture could
+    // not be created.
+    int64_t upload(TextureRequest *request, int64_t budget);
+
+    // Uploads staged textures in order. Returns false if the budget ran
+    // out before all of them were uploaded.
+    bool upload_staged(int64_t budget, uint64_t &total);
+
+    // Uploads queued requests in order until the frame budget is used.
+    void upload_frame();
+};
+
+static TextureUploads &texture_uploads() {
+    static TextureUploads uploads;
+    return uploads;
+}
+
+std::shared_ptr<TextureRequest> TextureUploads::start(
+        const std::string &image_asset) {
+    // Held while checking the cache too, a request that finishes is added
+    // to the cache before it is removed from `loading`.
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = loading.find(image_asset);
+    if (it != loading.end()) {
+        auto pending = it->second.lock();
+        if (pending != nullptr) {
+            return pending;
+        }
+    }
+
+    auto request = std::make_shared<TextureRequest>();
+    request->image_asset = image_asset;
+
+    auto cached = texture_cache().find(image_asset);
+    if (cached != nullptr) {
+        int w, h;
+        SDL_QueryTexture(cached.get(), nullptr, nullptr, &w, &h);
+        request->image_size = int2{w, h};
+        request->loaded_texture = cached;
+        request->current_state.store(TextureRequest::Done,
+                                     std::memory_order_release);
+        return request;
+    }
+
+    loading[image_asset] = request;
+    std::weak_ptr<TextureRequest> weak = request;
+    ++decoding_count;
+    job_pool().run(decoding, [this, weak]() {
+        decode(weak);
+        --decoding_count;
+    });
+    return request;
+}
+
+void TextureUploads::finish_locked(TextureRequest *request,
+                                   TextureRequest::State state) {
+    auto it = loading.find(request->image_asset);
+    if (it != loading.end() && it->second.lock().get() == request) {
+        loading.erase(it);
+    }
+    request->current_state.store(state, std::memory_order_release);
+}
+
+void TextureUploads::decode(const std::weak_ptr<TextureRequest> &weak) {
+    auto request = weak.lock();
+    if (request == nullptr) {
+        return;
+    }
+    auto *im = load_image(request->image_asset);
+    if (im != nullptr && im->get_pixelformat() != Image::RGBA32) {
+        auto *rgba32 = im->convert(Image::RGBA32);
+        delete im;
+        im = rgba32;
+    }
+    if (im == nullptr) {
+        log_error("Could not load texture %s", request->image_asset.c_str());
+        std::lock_guard<std::mutex> lock(mutex);
+        finish_locked(request.get(), TextureRequest::Failed);
+        return;
+    }
+    request->image.reset(im);
+    request->image_size = int2{im->width(), im->height()};
+    std::lock_guard<std::mutex> lock(mutex);
+    request->current_state.store(TextureRequest::Uploading,
+                                 std::memory_order_release);
+    queue.push_back(request);
+}
+
+// Copies rows of `im` to `texture` starting at `rows_uploaded`, at most
+// `budget` bytes but at least one row. Copies all rows if `budget` is 0.
+// Returns the number of bytes copied.
+static int64_t upload_rows(SDL_Texture *texture, const Image *im,
+                           int &rows_uploaded, int64_t budget) {
+    int remaining = im->height() - rows_uploaded;
+    int rows = remaining;
+    if (budget > 0) {
+        rows = int(std::min(int64_t(remaining),
+                            std::max(budget / im->pitch(), int64_t(1))));
+    }
+    if (rows > 0) {
+        SDL_Rect dst{0, rows_uploaded, im->width(), rows};
+        const auto *src = (const unsigned char *)im->pixels()
+                          + int64_t(rows_uploaded) * im->pitch();
+        SDL_UpdateTexture(texture, &dst, (const void *)src, im->pitch());
+        rows_uploaded += rows;
+    }
+    return int64_t(rows) * im->pitch();
+}
+
+static Texture stage_texture(const Image *im) {
+    auto &uploads = texture_uploads();
+    TextureUploads::Staged upload;
+    upload.image.reset(im->convert(Image::RGBA32));
+    upload.rows_uploaded = 0;
+
+    SDL_Texture *tex = nullptr;
+    // Only creating the texture waits for the main thread
+    run_on_main_thread([&]() {
+        // Same format and access as make_texture
+        tex = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA8888,
+                                SDL_TEXTUREACCESS_TARGET,
+                                im->width(), im->height());
+        ASSERT(tex != nullptr);
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    });
+    upload.texture = make_texture(tex);
+    auto texture = upload.texture;
+
+    std::lock_guard<std::mutex> lock(uploads.mutex);
+    uploads.staged.push_back(std::move(upload));
+    return texture;
+}
+
+size_t staged_texture_uploads() {
+    auto &uploads = texture_uploads();
+    std::lock_guard<std::mutex> lock(uploads.mutex);
+    return uploads.staged.size();
+}
+
+bool TextureUploads::upload_staged(int64_t budget, uint64_t &total) {
+    for (;;) {
+        Staged upload;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (staged.empty()) {
+                return true;
+            }
+            int64_t remaining = budget - int64_t(total);
+            if (budget > 0 && total > 0
+                    && remaining < staged.front().image->pitch()) {
+                return false;
+            }
+            upload = std::move(staged.front());
+            staged.pop_front();
+        }
+        if (upload.texture.use_count() == 1) {
+            // Dropped by the world that was loading
+            continue;
+        }
+        total += uint64_t(upload_rows(
+            upload.texture.get(), upload.image.get(), upload.rows_uploaded,
+            budget > 0 ? budget - int64_t(total) : 0));
+        if (upload.rows_uploaded < upload.image->height()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            staged.push_front(std::move(upload));
+        }
+    }
+}
+
+int64_t TextureUploads::upload(TextureRequest *request, int64_t budget) {
+    const auto *im = request->image.get();
+    if (request->uploading == nullptr) {
+        // Same format and access as make_texture
+        request->uploading = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA8888,
+                                               SDL_TEXTUREACCESS_TARGET,
+                                               im->width(), im->height());
+        if (request->uploading == nullptr) {
+            log_error("Could not create texture %s: %s",
+                      request->image_asset.c_str(), SDL_GetError());
+            return -1;
+        }
+        SDL_SetTextureBlendMode(request->uploading, SDL_BLENDMODE_BLEND);
+        // Owned by the request from here on so it is released if the
+        // request is dropped before it is done.
+        request->loaded_texture = make_texture(request->uploading);
+    }
+    return upload_rows(request->uploading, im, request->rows_uploaded,
+                       budget);
+}
+
+void TextureUploads::upload_frame() {
+    TWO_PROFILE_FUNC();
+    int64_t budget = this->budget.load(std::memory_order_relaxed);
+    uint64_t total = 0;
+    if (!upload_staged(budget, total)) {
+        last_frame_bytes.store(total, std::memory_order_relaxed);
+        return;
+    }
+    for (;;) {
+        std::shared_ptr<TextureRequest> request;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (queue.empty()) {
+                break;
+            }
+            request = queue.front().lock();
+            if (request == nullptr) {
+                // Nothing is waiting for this texture anymore
+                queue.pop_front();
+                continue;
+            }
+        }
+        int64_t remaining = budget - int64_t(total);
+        if (budget > 0 && total > 0
+                && remaining < request->image->pitch()) {
+            // Not even one more row fits in this frame
+            break;
+        }
+        auto bytes = upload(request.get(), budget > 0 ? remaining : 0);
+        if (bytes < 0) {
+            request->image.reset();
+            std::lock_guard<std::mutex> lock(mutex);
+            finish_locked(request.get(), TextureRequest::Failed);
+            queue.pop_front();
+            continue;
+        }
+        total += uint64_t(bytes);
+
+        if (request->rows_uploaded < request->image_size.y) {
+            continue;
+        }
+        request->image.reset();
+        request->uploading = nullptr;
+        request->loaded_texture = texture_cache().insert(
+            request->image_asset, request->loaded_texture);
+        std::lock_guard<std::mutex> lock(mutex);
+        finish_locked(request.get(), TextureRequest::Done);
+        queue.pop_front();
+    }
+    last_frame_bytes.store(total, std::memory_order_relaxed);
+}
+
+void upload_textures() {
+    if (gfx != nullptr) {
+        texture_uploads().upload_frame();
+    }
+}
+
+} // internal
+
+std::shared_ptr<TextureRequest> load_texture_async(
+        const std::string &image_asset) {
+    return internal::texture_uploads().start(image_asset);
+}
+
+void set_texture_upload_budget(int64_t bytes_per_frame) {
+    ASSERT(bytes_per_frame >= 0);
+    internal::texture_uploads().budget.store(bytes_per_frame,
+                                             std::memory_order_relaxed);
+}
+
+TextureUploadStats texture_upload_stats() {
+    auto &uploads = internal::texture_uploads();
+    TextureUploadStats stats;
+    stats.decoding = uploads.decoding_count.load();
+    stats.bytes = uploads.last_frame_bytes.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(uploads.mutex);
+    stats.queued = uint32_t(uploads.queue.size());
+    return stats;
+}
+
+void TextureStreamer::update(World *world, float) {
+    TWO_PROFILE_FUNC();
+    finished.clear();
+    for (auto entity : world->view<Sprite, PendingTexture>()) {
+        const auto &pending = world->unpack<PendingTexture>(entity);
+        if (pending.request == nullptr) {
+            finished.push_back(entity);
+            continue;
+        }
+        auto state = pending.request->state();
+        if (state == TextureRequest::Done) {
+            auto &sprite = world->unpack<Sprite>(entity);
+            sprite.texture = pending.request->texture();
+            sprite.rect = pending.rect;
+            if (sprite.rect.w == 0 || sprite.rect.h == 0) {
+                auto size = pending.request->size();
+                sprite.rect = Rect{0.0f, 0.0f, float(size.x), float(size.y)};
+            }
+            finished.push_back(entity);
+        } else if (state == TextureRequest::Failed) {
+            finished.push_back(entity);
+        }
+    }
+    // Removing components while iterating would change the view
+    for (auto entity : finished) {
+        world->remove_component<PendingTexture>(entity);
+    }
 }
 
 Sprite make_sprite(const Image *im) {
@@ -83,17 +496,23 @@ Sprite make_sprite(const Image *im, const Rect &rect) {
     return Sprite{make_texture(im, rect), rect};
 }
 
-Sprite blank_sprite(const Color &color) {
-    static Texture blank = nullptr;
-    if (UNLIKELY(blank == nullptr)) {
+static Texture make_blank_texture() {
+    SDL_Texture *tex = nullptr;
+    run_on_main_thread([&tex]() {
         unsigned char pixels[]{255, 255, 255, 255};
-        auto *tex = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA8888,
-                                      SDL_TEXTUREACCESS_STATIC, 1, 1);
+        tex = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA8888,
+                                SDL_TEXTUREACCESS_STATIC, 1, 1);
 
-        SDL_UpdateTexture(tex, nullptr, (const void *)&pixels, sizeof(pixels));
+        SDL_UpdateTexture(tex, nullptr, (const void *)&pixels,
+                          sizeof(pixels));
         SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
-        blank = make_texture(tex);
-    }
+    });
+    return make_texture(tex);
+}
+
+Sprite blank_sprite(const Color &color) {
+    // Initialized once even if called from several loading threads
+    static const Texture blank = make_blank_texture();
     auto sprite = Sprite{blank, Rect{0, 0, 1, 1}};
     sprite.color = color;
     return sprite;
@@ -118,32 +537,81 @@ std::vector<Sprite> load_atlas(const Image *im,
     return sprites;
 }
 
-void SpriteRenderer::sort_sprites(World *world,
-                                  const std::vector<Entity> &entities,
-                                  std::vector<Entity> &sorted) {
+Optional<std::vector<Sprite>> load_atlas(const Image *im,
+                                         const std::vector<Rect> &rects) {
+    for (const auto &rect : rects) {
+        if (rect.x < 0 || rect.y < 0 || rect.w < 0 || rect.h < 0
+                || rect.x + rect.w > im->width()
+                || rect.y + rect.h > im->height()) {
+            log_error("Atlas rect (%g, %g, %g, %g) is outside of the image "
+                      "(%dx%d)", rect.x, rect.y, rect.w, rect.h,
+                      im->width(), im->height());
+            return {};
+        }
+    }
+    auto tex = make_texture(im);
+    std::vector<Sprite> sprites;
+    sprites.reserve(rects.size());
+    for (const auto &rect : rects) {
+        sprites.push_back(Sprite{tex, rect});
+    }
+    return sprites;
+}
+
+Optional<std::vector<Sprite>> load_atlas(const std::string &atlas_asset) {
     TWO_PROFILE_FUNC();
-    sorted.clear();
-    sorted.resize(entities.size());
-    sort_counts.fill(0);
+    File file(atlas_asset);
+    if (!file.open(FileMode::Read)) {
+        return {};
+    }
+    std::string data(size_t(file.size()), '\0');
+    if (file.read(&data[0], data.size()) != int64_t(data.size())) {
+        log_error("Could not read atlas %s", atlas_asset.c_str());
+        return {};
+    }
 
-    for (auto entity : entities) {
-        ASSERT(world->has_component<Sprite>(entity));
-        auto &sprite = world->unpack<Sprite>(entity);
+    std::stringstream lines(data);
+    std::string line;
+    std::string image_asset;
+    std::vector<Rect> rects;
+    int line_pos = 0;
 
-        ASSERT(sprite.layer < sort_counts.size());
-        ++sort_counts[sprite.layer];
-    }
+    while (std::getline(lines, line)) {
+        ++line_pos;
+        auto start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+        auto end = line.find_last_not_of(" \t\r");
+        line = line.substr(start, end - start + 1);
 
-    for (size_t i = 1; i < sort_counts.size(); ++i) {
-        sort_counts[i] += sort_counts[i - 1];
+        // The first line is the image, every line after it is a sprite
+        if (image_asset.empty()) {
+            image_asset = line;
+            continue;
+        }
+        Rect rect;
+        std::stringstream fields(line);
+        if (!(fields >> rect.x >> rect.y >> rect.w >> rect.h)) {
+            log_error("%s:%d: Expected 'x y w h'", atlas_asset.c_str(),
+                      line_pos);
+            return {};
+        }
+        rects.push_back(rect);
+    }
+    if (image_asset.empty()) {
+        log_error("%s: Missing atlas image", atlas_asset.c_str());
+        return {};
     }
 
-    for (int i = entities.size() - 1; i >= 0; --i) {
-        auto entity = entities[i];
-        auto &sprite = world->unpack<Sprite>(entity);
-        sorted[--sort_counts[sprite.layer]] = entity;
+    auto *im = load_image(image_asset);
+    if (im == nullptr) {
+        return {};
     }
-};
+    auto sprites = load_atlas(im, rects);
+    delete im;
+    return sprites;
+}
 
 void SpriteRenderer::draw(World *world) {
     TWO_PROFILE_FUNC();
@@ -153,102 +621,381 @@ void SpriteRenderer::draw(World *world) {
     auto tilesizef = float2(camera.tilesize) * cam_scale;
     auto cam_offset = int2(camera.position * tilesizef);
 
-    int screen_w, screen_h;
-    SDL_RenderGetLogicalSize(gfx, &screen_w, &screen_h);
+    int screen_w = render_info().screen_size.x;
+    int screen_h = render_info().screen_size.y;
     int2 screen_wh_2{screen_w / 2, screen_h / 2};
 
-    const auto &entities = world->view<Transform, Sprite>();
-    sort_sprites(world, entities, sprite_buffer);
-    float2 v[4];
-
-    for (auto entity : sprite_buffer) {
-        auto &transform = world->unpack<Transform>(entity);
-        auto &sprite = world->unpack<Sprite>(entity);
-
-        v[0] = transform.position;
-        v[1] = {v[0].x + transform.scale.x, v[0].y};
-        v[2] = {v[0].x + transform.scale.x, v[0].y + transform.scale.y};
-        v[3] = {v[0].x, v[0].y + transform.scale.y};
-
-        auto origin = clamp01(sprite.origin);
-        auto woffset = (origin * transform.scale) + transform.position;
-        v[0] -= woffset;
-        v[1] -= woffset;
-        v[2] -= woffset;
-        v[3] -= woffset;
-
-        float theta = transform.rotation * DegToRad;
-        float st = sinf(theta);
-        float ct = cosf(theta);
-
-        float2 r;
-        r.x = ct*v[0].x - st*v[0].y + transform.position.x;
-        r.y = st*v[0].x + ct*v[0].y + transform.position.y;
-        v[0] = r;
-
-        r.x = ct*v[1].x - st*v[1].y + transform.position.x;
-        r.y = st*v[1].x + ct*v[1].y + transform.position.y;
-        v[1] = r;
-
-        r.x = ct*v[2].x - st*v[2].y + transform.position.x;
-        r.y = st*v[2].x + ct*v[2].y + transform.position.y;
-        v[2] = r;
-
-        r.x = ct*v[3].x - st*v[3].y + transform.position.x;
-        r.y = st*v[3].x + ct*v[3].y + transform.position.y;
-        v[3] = r;
-
-        // World to screen projection
-        v[0] = float2((int2(v[0] * tilesizef) + screen_wh_2) - cam_offset);
-        v[1] = float2((int2(v[1] * tilesizef) + screen_wh_2) - cam_offset);
-        v[2] = float2((int2(v[2] * tilesizef) + screen_wh_2) - cam_offset);
-        v[3] = float2((int2(v[3] * tilesizef) + screen_wh_2) - cam_offset);
-
-        // Culling
-        auto box_min = vmin(v[0], v[1]);
-        box_min = vmin(box_min, v[2]);
-        box_min = vmin(box_min, v[3]);
-
-        auto box_max = vmax(v[0], v[1]);
-        box_max = vmax(box_max, v[2]);
-        box_max = vmax(box_max, v[3]);
-
-        if (box_min.x > screen_w || box_min.y > screen_h
-            || box_max.x < 0.0f || box_max.y < 0.0f) {
+    QuadProjection projection;
+    projection.tilesize = tilesizef;
+    projection.scale = cam_scale;
+    projection.offset = screen_wh_2 - cam_offset;
+    projection.screen = int2{screen_w, screen_h};
+
+    // Static layers need every sprite that may be in their texture, which
+    // reaches up to two margins outside the screen
+    bool has_static = !static_layer_ids.empty()
+                      && render_info().render_targets;
+    int margin = has_static ? 2 * std::max(static_margin, 0) : 0;
+
+    // Screen in world units, with a pixel of margin for rounding
+    float2 screen_min{float(-1 - margin - projection.offset.x) / tilesizef.x,
+                      float(-1 - margin - projection.offset.y) / tilesizef.y};
+    float2 screen_max{
+        float(screen_w + 1 + margin - projection.offset.x) / tilesizef.x,
+        float(screen_h + 1 + margin - projection.offset.y) / tilesizef.y};
+
+    grid.sync(world);
+    nearby.clear();
+    grid.query(vmin(screen_min, screen_max), vmax(screen_min, screen_max),
+               nearby);
+
+    // The grid has every entity with a Transform, only keep the ones that
+    // would be in the view
+    EntityMask mask;
+    mask.set(world->find_or_register_component<Transform>());
+    mask.set(world->find_or_register_component<Sprite>());
+    mask.set(world->find_or_register_component<Active>());
+    nearby.erase(std::remove_if(nearby.begin(), nearby.end(),
+        [world, &mask](Entity entity) {
+            return (world->get_mask(entity) & mask) != mask;
+        }), nearby.end());
+    std::sort(nearby.begin(), nearby.end());
+
+    static_nearby.clear();
+    if (has_static) {
+        split_static_sprites(world);
+    }
+
+    quads.clear();
+    for (auto entity : nearby) {
+        auto &transform = world->read<Transform>(entity);
+        auto &sprite = world->read<Sprite>(entity);
+        float2 size{float(int(sprite.rect.w)), float(int(sprite.rect.h))};
+        quads.push(transform.position, transform.scale,
+                   clamp01(sprite.origin), size, transform.rotation);
+    }
+    transform_quads(quads, projection);
+
+    render_stats = SpriteRenderStats{};
+    render_stats.sprites = uint32_t(world->view<Transform, Sprite>().size());
+    render_stats.queried = uint32_t(nearby.size() + static_nearby.size());
+    render_stats.culled = render_stats.sprites - render_stats.queried;
+    auto &list = render_list();
+    list.begin_pass();
+
+    for (size_t i = 0; i < nearby.size(); ++i) {
+        if (!quads.visible[i]) {
+            ++render_stats.culled;
             continue;
         }
-
-        // Offset in pixels
-        float2 ws = float2((int2(transform.position * tilesizef)
-                  + screen_wh_2) - cam_offset);
+        auto &transform = world->read<Transform>(nearby[i]);
+        auto &sprite = world->read<Sprite>(nearby[i]);
 
         SDL_Rect src{int(sprite.rect.x), int(sprite.rect.y),
                      int(sprite.rect.w), int(sprite.rect.h)};
 
-        auto scale = transform.scale * float2(src.w, src.h) * cam_scale;
-        auto offset = float2(ws) - origin * scale;
+        SDL_Rect dst{quads.dst_x[i], quads.dst_y[i],
+                     quads.dst_w[i], quads.dst_h[i]};
+
+        SDL_Point center{int(quads.origin_x[i] * dst.w),
+                         int(quads.origin_y[i] * dst.h)};
+
+        // Sorted by layer, texture and state when the list is submitted
+        list.draw(RenderCommand::copy_ex(sprite.texture.get(), src, dst,
+                                         sprite.color, transform.rotation,
+                                         center, uint8_t(sprite.flip)),
+                  sprite.layer);
+    }
+
+    if (has_static) {
+        draw_static_layers(world, projection);
+    }
+}
+
+void SpriteRenderer::set_static_layer(SpriteLayer layer, bool is_static) {
+    auto &cache = static_layers[layer];
+    if (is_static == (cache != nullptr)) {
+        return;
+    }
+    if (is_static) {
+        cache.reset(new StaticLayer{});
+        cache->dirty = true;
+        static_layer_ids.push_back(layer);
+        return;
+    }
+    for (auto entity : cache->entities) {
+        auto &record = static_sprites[entity];
+        if (record.layer == layer) {
+            record.texture = nullptr;
+            record.used = false;
+        }
+    }
+    cache = nullptr;
+    static_layer_ids.erase(std::find(static_layer_ids.begin(),
+                                     static_layer_ids.end(), layer));
+}
+
+// Same bounds the TransformGrid uses, so every sprite that overlaps an
+// area is found by a grid query of that area.
+static bool overlaps(const Transform &transform,
+                     const float2 &min, const float2 &max) {
+    float extent = transform.scale.length();
+    return transform.position.x + extent >= min.x
+           && transform.position.y + extent >= min.y
+           && transform.position.x - extent <= max.x
+           && transform.position.y - extent <= max.y;
+}
 
-        SDL_Rect dst{int(offset.x), int(offset.y),
-                     int(scale.x), int(scale.y)};
+void SpriteRenderer::split_static_sprites(World *world) {
+    TWO_PROFILE_FUNC();
+    if (static_sprites.size() < TWO_ENTITY_MAX) {
+        static_sprites.resize(TWO_ENTITY_MAX);
+    }
+    for (auto layer : static_layer_ids) {
+        static_layers[layer]->found = 0;
+    }
 
-        SDL_Point center{int(origin.x * dst.w),
-                         int(origin.y * dst.h)};
+    size_t count = 0;
+    for (auto entity : nearby) {
+        auto &sprite = world->read<Sprite>(entity);
+        auto &record = static_sprites[entity];
+        if (is_static_layer(sprite.layer)) {
+            static_nearby.push_back(entity);
+            continue;
+        }
+        // Moved out of a static layer
+        if (record.used) {
+            static_layers[record.layer]->dirty = true;
+        }
+        nearby[count++] = entity;
+    }
+    nearby.resize(count);
+
+    for (auto entity : static_nearby) {
+        auto &transform = world->read<Transform>(entity);
+        auto &sprite = world->read<Sprite>(entity);
+        auto &record = static_sprites[entity];
+        auto &cache = *static_layers[sprite.layer];
+
+        if (record.used && record.layer == sprite.layer
+                && record.transform.position == transform.position
+                && record.transform.scale == transform.scale
+                && record.transform.rotation == transform.rotation
+                && record.texture == sprite.texture
+                && record.rect == sprite.rect
+                && record.origin == sprite.origin
+                && record.flip == sprite.flip
+                && record.color == sprite.color) {
+            ++cache.found;
+            continue;
+        }
+        if (record.used) {
+            static_layers[record.layer]->dirty = true;
+        }
+        if (overlaps(transform, cache.area_min, cache.area_max)) {
+            cache.dirty = true;
+        }
+    }
+}
 
-        SDL_SetTextureColorMod(sprite.texture.get(),
-                               sprite.color.r, sprite.color.g, sprite.color.b);
+void SpriteRenderer::draw_static_layers(World *world,
+                                        const QuadProjection &projection) {
+    TWO_PROFILE_FUNC();
+    auto &list = render_list();
+    int margin = std::max(static_margin, 0);
+
+    for (auto layer : static_layer_ids) {
+        auto &cache = *static_layers[layer];
+        auto &drawn = cache.projection;
+        int2 moved = projection.offset - drawn.offset;
+        if (cache.texture == nullptr
+                || cache.found != cache.entities.size()
+                || cache.margin != margin
+                || drawn.tilesize != projection.tilesize
+                || drawn.scale != projection.scale
+                || drawn.screen != projection.screen
+                || std::abs(moved.x) > margin || std::abs(moved.y) > margin) {
+            cache.dirty = true;
+        }
+        if (cache.dirty) {
+            redraw_static_layer(world, layer, cache, projection);
+            moved = int2{0, 0};
+            ++render_stats.layers_redrawn;
+        }
+        if (cache.texture == nullptr) {
+            continue;
+        }
 
-        SDL_SetTextureAlphaMod(sprite.texture.get(), sprite.color.a);
+        // The screen is somewhere in the middle of the texture
+        SDL_Rect src{margin - moved.x, margin - moved.y,
+                     projection.screen.x, projection.screen.y};
+        SDL_Rect dst{0, 0, projection.screen.x, projection.screen.y};
+        list.draw(RenderCommand::copy(cache.texture.get(), src, dst,
+                                      Color{255, 255, 255, 255}),
+                  layer);
+        render_stats.cached += uint32_t(cache.entities.size());
+    }
+}
 
-        SDL_RenderCopyEx(gfx, sprite.texture.get(), &src, &dst,
-                         transform.rotation, &center,
-                         (SDL_RendererFlip)sprite.flip);
+void SpriteRenderer::redraw_static_layer(World *world, SpriteLayer layer,
+                                         StaticLayer &cache,
+                                         const QuadProjection &projection) {
+    TWO_PROFILE_FUNC();
+    int margin = std::max(static_margin, 0);
+    int2 size{projection.screen.x + 2 * margin,
+              projection.screen.y + 2 * margin};
+
+    // Sprites are drawn as if the screen was the size of the texture
+    QuadProjection layer_projection = projection;
+    layer_projection.offset = projection.offset + int2{margin, margin};
+    layer_projection.screen = size;
+
+    auto &tilesize = projection.tilesize;
+    cache.area_min = float2{float(-1 - layer_projection.offset.x) / tilesize.x,
+                            float(-1 - layer_projection.offset.y) / tilesize.y};
+    cache.area_max = float2{
+        float(size.x + 1 - layer_projection.offset.x) / tilesize.x,
+        float(size.y + 1 - layer_projection.offset.y) / tilesize.y};
+
+    for (auto entity : cache.entities) {
+        auto &record = static_sprites[entity];
+        if (record.layer == layer) {
+            record.texture = nullptr;
+            record.used = false;
+        }
+    }
+    cache.entities.clear();
+
+    static_quads.clear();
+    for (auto entity : static_nearby) {
+        auto &transform = world->read<Transform>(entity);
+        auto &sprite = world->read<Sprite>(entity);
+        if (sprite.layer != layer
+                || !overlaps(transform, cache.area_min, cache.area_max)) {
+            continue;
+        }
+        auto &record = static_sprites[entity];
+        record.transform = transform;
+        record.texture = sprite.texture;
+        record.rect = sprite.rect;
+        record.origin = sprite.origin;
+        record.flip = sprite.flip;
+        record.color = sprite.color;
+        record.layer = layer;
+        record.used = true;
+        cache.entities.push_back(entity);
+
+        float2 sprite_size{float(int(sprite.rect.w)),
+                           float(int(sprite.rect.h))};
+        static_quads.push(transform.position, transform.scale,
+                          clamp01(sprite.origin), sprite_size,
+                          transform.rotation);
+    }
+    transform_quads(static_quads, layer_projection);
+
+    static_list.reset();
+    static_list.begin_pass();
+    for (size_t i = 0; i < cache.entities.size(); ++i) {
+        if (!static_quads.visible[i]) {
+            continue;
+        }
+        auto &transform = world->read<Transform>(cache.entities[i]);
+        auto &sprite = world->read<Sprite>(cache.entities[i]);
+        SDL_Rect src{int(sprite.rect.x), int(sprite.rect.y),
+                     int(sprite.rect.w), int(sprite.rect.h)};
+        SDL_Rect dst{static_quads.dst_x[i], static_quads.dst_y[i],
+                     static_quads.dst_w[i], static_quads.dst_h[i]};
+        SDL_Point center{int(static_quads.origin_x[i] * dst.w),
+                         int(static_quads.origin_y[i] * dst.h)};
+        static_list.draw(RenderCommand::copy_ex(sprite.texture.get(), src,
+                                                dst, sprite.color,
+                                                transform.rotation, center,
+                                                uint8_t(sprite.flip)),
+                         layer);
+    }
+    static_list.sort();
+
+    cache.projection = projection;
+    cache.margin = margin;
+    cache.found = cache.entities.size();
+    cache.dirty = false;
+    run_on_main_thread([this, &cache, &size]() {
+        bake_static_layer(cache, size);
+    });
+}
+
+// Drawing with normal blending into a transparent texture leaves colors
+// multiplied by alpha, so the texture is drawn with premultiplied alpha.
+static SDL_BlendMode premultiplied_blend() {
+    return SDL_ComposeCustomBlendMode(
+        SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        SDL_BLENDOPERATION_ADD, SDL_BLENDFACTOR_ONE,
+        SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+}
+
+void SpriteRenderer::bake_static_layer(StaticLayer &cache, const int2 &size) {
+    TWO_PROFILE_FUNC();
+    auto *target = cache.texture.get();
+    int target_w = 0, target_h = 0;
+    if (target != nullptr) {
+        SDL_QueryTexture(target, nullptr, nullptr, &target_w, &target_h);
+    }
+    if (target_w != size.x || target_h != size.y) {
+        target = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA8888,
+                                   SDL_TEXTUREACCESS_TARGET, size.x, size.y);
+        if (target == nullptr) {
+            log_error("Could not create static layer texture: %s",
+                      SDL_GetError());
+            cache.texture = nullptr;
+            return;
+        }
+        // The software renderer does not support custom blend modes
+        cache.premultiplied =
+            SDL_SetTextureBlendMode(target, premultiplied_blend()) == 0;
+        if (!cache.premultiplied) {
+            SDL_SetTextureBlendMode(target, SDL_BLENDMODE_BLEND);
+        }
+        cache.texture = make_texture(target);
+    }
+
+    auto *previous_target = SDL_GetRenderTarget(gfx);
+    SDL_SetRenderTarget(gfx, target);
+    SDL_SetRenderDrawColor(gfx, 0, 0, 0, 0);
+    SDL_RenderClear(gfx);
+    static_list.submit(gfx);
+
+    if (!cache.premultiplied) {
+        static_pixels.resize(size_t(size.x) * size_t(size.y));
+        SDL_RenderReadPixels(gfx, nullptr, SDL_PIXELFORMAT_RGBA8888,
+                             static_pixels.data(), size.x * 4);
+        for (auto &pixel : static_pixels) {
+            uint32_t a = pixel & 0xff;
+            if (a == 0 || a == 255) {
+                continue;
+            }
+            uint32_t r = std::min((((pixel >> 24) & 0xff) * 255 + a / 2) / a,
+                                  255u);
+            uint32_t g = std::min((((pixel >> 16) & 0xff) * 255 + a / 2) / a,
+                                  255u);
+            uint32_t b = std::min((((pixel >> 8) & 0xff) * 255 + a / 2) / a,
+                                  255u);
+            pixel = (r << 24) | (g << 16) | (b << 8) | a;
+        }
+    }
+    SDL_SetRenderTarget(gfx, previous_target);
+
+    if (!cache.premultiplied) {
+        SDL_UpdateTexture(target, nullptr, static_pixels.data(), size.x * 4);
     }
 }
 
 void OverlayRenderer::draw(World *world) {
+    auto &list = render_list();
+    list.begin_pass();
+
     for (auto entity : world->view<PixelTransform, Sprite>()) {
-        auto &transform = world->unpack<PixelTransform>(entity);
-        auto &sprite = world->unpack<Sprite>(entity);
+        auto &transform = world->read<PixelTransform>(entity);
+        auto &sprite = world->read<Sprite>(entity);
 
         SDL_Rect src{int(sprite.rect.x), int(sprite.rect.y),
                      int(sprite.rect.w), int(sprite.rect.h)};
@@ -259,22 +1006,16 @@ void OverlayRenderer::draw(World *world) {
                      int(sprite.rect.h * transform.scale.y)};
 
         if (world->has_component<ShadowEffect>(entity)) {
-            auto &shadow = world->unpack<ShadowEffect>(entity);
-            SDL_SetTextureColorMod(sprite.texture.get(), shadow.color.r,
-                                   shadow.color.g, shadow.color.b);
-
-            SDL_SetTextureAlphaMod(sprite.texture.get(), shadow.color.a);
+            auto &shadow = world->read<ShadowEffect>(entity);
             SDL_Rect shadow_dst{int(dst.x + shadow.offset.x),
                                 int(dst.y + shadow.offset.y),
                                 dst.w, dst.h};
-            SDL_RenderCopy(gfx, sprite.texture.get(), &src, &shadow_dst);
+            list.draw_ordered(RenderCommand::copy(sprite.texture.get(), src,
+                                                  shadow_dst, shadow.color));
         }
 
-        SDL_SetTextureColorMod(sprite.texture.get(), sprite.color.r,
-                               sprite.color.g, sprite.color.b);
-
-        SDL_SetTextureAlphaMod(sprite.texture.get(), sprite.color.a);
-        SDL_RenderCopy(gfx, sprite.texture.get(), &src, &dst);
+        list.draw_ordered(RenderCommand::copy(sprite.texture.get(), src, dst,
+                                              sprite.color));
     }
 }
 
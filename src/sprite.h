@@ -22,13 +22,18 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <atomic>
 #include <cstdint>
+#include <unordered_map>
 
 #include "SDL.h"
 #include "mathf.h"
 #include "entity.h"
 #include "image.h"
 #include "optional.h"
+#include "cache.h"
+#include "quad.h"
+#include "grid.h"
 #include "two.h"
 
 namespace two {
@@ -83,6 +88,20 @@ struct Sprite {
         , layer{0} {}
 };
 
+// Sprites are written to a snapshot with the texture stored as a resource
+// index, see `SnapshotWriter::add_resource`. Textures from `texture_cache()`
+// are loaded again with `load_texture` when the snapshot is read.
+template <>
+struct Serializer<Sprite> {
+    static constexpr bool enabled = true;
+    // Bytes written for each sprite.
+    static constexpr size_t size = sizeof(uint32_t) + sizeof(Rect)
+                                   + sizeof(float2) + sizeof(int32_t)
+                                   + sizeof(Color) + sizeof(SpriteLayer);
+    static void save(SnapshotWriter &writer, const Sprite *items, size_t count);
+    static void load(SnapshotReader &reader, Sprite *items, size_t count);
+};
+
 inline Texture make_texture(SDL_Texture *texture) {
     return std::shared_ptr<SDL_Texture>(texture, [](SDL_Texture *tex) {
         // Make sure we still have a graphics device. This is likely to
@@ -90,7 +109,7 @@ inline Texture make_texture(SDL_Texture *texture) {
         // shared pointers go out of scope after the graphics device is
         // released. Freeing the graphics device will free all textures.
         if (gfx != nullptr) {
-            SDL_DestroyTexture(tex);
+            internal::release_texture(tex);
         }
     });
 }
@@ -101,7 +120,17 @@ Texture make_texture(const Image *im);
 
 void update_texture(const Texture &tex, const Image *im);
 
-// Load a sprite asset from from an asset file.
+// Textures loaded from image assets, shared by asset path.
+ResourceCache<SDL_Texture> &texture_cache();
+
+// Loads a texture from an image asset, or returns the texture already
+// loaded for `image_asset` if it is still referenced. Returns null if the
+// image could not be loaded. Cached textures are shared, use
+// `make_texture` for a texture that is safe to modify.
+Texture load_texture(const std::string &image_asset);
+
+// Load a sprite asset from from an asset file. The texture is shared with
+// other sprites loaded from the same asset, see `load_texture`.
 Optional<Sprite> load_sprite(const std::string &image_asset);
 
 // Creates a sprite from an image. A new texture will be allocated
@@ -119,7 +148,15 @@ Sprite make_sprite(const Image *im, const Rect &rect);
 Sprite blank_sprite(const Color &color);
 
 // Load an atlas from a asset file. The asset file must exist in an archive
-// added with `filesystem.h mount()`.
+// added with `filesystem.h mount()`. The first line of the file is the
+// image asset, each following line is the rect of one sprite in pixels.
+// Blank lines and lines starting with `#` are ignored.
+//
+//     # Sprites are returned in this order
+//     sprites/characters.png
+//     0 0 16 16
+//     16 0 16 24
+//
 Optional<std::vector<Sprite>> load_atlas(const std::string &atlas_asset);
 
 // Creates multiples sprites from the same texture. The position and
@@ -142,19 +179,239 @@ std::vector<Sprite> load_atlas(const Image *im,
                                float tile_x, float tile_y,
                                float pad_x = 0, float pad_y = 0);
 
-// Requires a Transform component and a Sprite component
+namespace internal {
+struct TextureUploads;
+} // internal
+
+// A texture loaded in the background with `load_texture_async`.
+class TextureRequest {
+public:
+    enum State {
+        // The image is being read and decoded on the job pool.
+        Decoding,
+        // Waiting for or in the middle of uploads on the main thread.
+        Uploading,
+        Done,
+        // The image could not be loaded or the texture created.
+        Failed,
+    };
+
+    inline State state() const {
+        return State(current_state.load(std::memory_order_acquire));
+    }
+
+    inline bool done() const { return state() == Done; }
+
+    // The loaded texture, null until the request is done.
+    inline Texture texture() const {
+        return done() ? loaded_texture : nullptr;
+    }
+
+    // Size of the image in pixels, zero until the image is decoded.
+    inline int2 size() const {
+        return state() == Decoding ? int2{0, 0} : image_size;
+    }
+
+    inline const std::string &asset() const { return image_asset; }
+
+private:
+    friend struct internal::TextureUploads;
+
+    std::string image_asset;
+    std::atomic<int> current_state{Decoding};
+    std::unique_ptr<Image> image;
+    int2 image_size{0, 0};
+    Texture loaded_texture;
+    SDL_Texture *uploading = nullptr;
+    // Rows of the image already copied to `uploading`.
+    int rows_uploaded = 0;
+};
+
+// Loads a texture from an image asset without blocking the calling thread.
+// The image is read and decoded on the job pool (see `job.h`), then copied
+// to a texture by the main loop a few rows at a time, so that no more than
+// `set_texture_upload_budget` bytes are uploaded each frame. Large images
+// are spread over several frames instead of stalling one.
+//
+//     auto request = load_texture_async("sprites/world.png");
+//     pack(entity, loading_sprite);
+//     pack(entity, PendingTexture{request});
+//
+// If the texture is already in `texture_cache()` the request is done
+// immediately, finished textures are added to the cache. A request that is
+// no longer referenced by anything is dropped before it is uploaded.
+std::shared_ptr<TextureRequest> load_texture_async(
+    const std::string &image_asset);
+
+// Largest number of bytes uploaded by `load_texture_async` requests each
+// frame, 0 for no limit. At least one row is uploaded per frame while there
+// are requests waiting. Defaults to 4 MB.
+void set_texture_upload_budget(int64_t bytes_per_frame);
+
+struct TextureUploadStats {
+    // Requests still being decoded.
+    uint32_t decoding;
+    // Requests waiting to be uploaded.
+    uint32_t queued;
+    // Bytes uploaded in the last frame.
+    uint64_t bytes;
+};
+
+TextureUploadStats texture_upload_stats();
+
+namespace internal {
+
+// Uploads decoded images within the frame budget. Called by the main loop
+// after the frame is presented.
+void upload_textures();
+
+// Number of textures created by `make_texture` on the thread running
+// `load_world_async` that are not uploaded yet. The world is swapped in
+// once this is 0.
+size_t staged_texture_uploads();
+
+} // internal
+
+// Gives the entity's Sprite the texture of `request` once it is done.
+// Until then the sprite keeps its current texture, such as a small preview
+// or a `blank_sprite`. Only the texture and rect are replaced, the color
+// and other fields of the sprite are kept. Requires a `TextureStreamer`.
+struct PendingTexture {
+    std::shared_ptr<TextureRequest> request;
+    // Section of the texture used by the sprite. An empty rect uses the
+    // whole texture.
+    Rect rect;
+
+    PendingTexture() = default;
+    PendingTexture(const std::shared_ptr<TextureRequest> &request)
+        : request{request}, rect{0, 0, 0, 0} {}
+
+    PendingTexture(const std::shared_ptr<TextureRequest> &request,
+                   const Rect &rect)
+        : request{request}, rect{rect} {}
+};
+
+// Swaps in the textures of `PendingTexture` components when their requests
+// are done and removes the component. Failed requests keep the
+// placeholder.
+class TextureStreamer : public System {
+public:
+    void update(World *world, float dt) override;
+
+private:
+    std::vector<Entity> finished;
+};
+
+// Counters from the last frame drawn by a `SpriteRenderer`. Draw calls
+// and state changes are counted when the frame's `RenderList` is
+// submitted, see `RenderList::stats()`.
+struct SpriteRenderStats {
+    // Sprites with a Transform and a Sprite component.
+    uint32_t sprites;
+
+    // Sprites skipped because they were outside the screen.
+    uint32_t culled;
+
+    // Sprites found in the grid cells around the camera. Only these are
+    // projected and tested against the screen.
+    uint32_t queried;
+
+    // Sprites in static layers that were drawn from the layer's texture.
+    uint32_t cached;
+
+    // Static layers that were drawn into their texture this frame.
+    uint32_t layers_redrawn;
+};
+
+// Requires a Transform component and a Sprite component. Sprites are added
+// to the frame's `RenderList` where they are sorted by layer and grouped
+// by texture, flip and color. Sprites near the camera are found with a
+// `TransformGrid`, so sprites far outside the screen cost nothing, then
+// projected and culled in batches with `transform_quads`. Sprites that
+// share a layer, texture and state are drawn in entity order.
+//
+// Layers that rarely change, such as backgrounds and scenery, can be made
+// static with `set_static_layer`.
 class SpriteRenderer : public System {
 public:
+    // How many pixels the camera can move before a static layer is redrawn.
+    // Static layer textures are larger than the screen by this much on
+    // each side.
+    int static_margin = 64;
+
     void draw(World *world) override;
 
-    // Sorts entities with sprite components by the sprite sorting layer.
-    // This function assumes `entities` all have a sprite component.
-    void sort_sprites(World *world, const std::vector<Entity> &entities,
-                      std::vector<Entity> &sorted);
+    // Sprites in a static layer are drawn into a texture slightly larger
+    // than the screen, then each frame the layer is drawn with a single
+    // copy of that texture. The texture is only redrawn when a sprite in
+    // the layer changes its Transform or Sprite, a sprite is added to or
+    // removed from the layer, or the camera moves further than
+    // `static_margin` or changes its scale. Without render target support
+    // static layers are drawn like any other layer.
+    void set_static_layer(SpriteLayer layer, bool is_static);
+
+    inline bool is_static_layer(SpriteLayer layer) const {
+        return static_layers[layer] != nullptr;
+    }
+
+    inline const SpriteRenderStats &stats() const { return render_stats; }
 
 private:
-    std::vector<Entity> sprite_buffer;
-    std::array<TWO_ENTITY_INT_TYPE, SpriteLayerMax> sort_counts;
+    // State of a sprite when its static layer was last drawn.
+    struct StaticSprite {
+        Transform transform;
+        Texture texture;
+        Rect rect;
+        float2 origin;
+        Sprite::Flip flip;
+        Color color;
+        SpriteLayer layer;
+        bool used;
+    };
+
+    struct StaticLayer {
+        Texture texture;
+
+        // Camera and screen when the layer was drawn.
+        QuadProjection projection;
+        int margin;
+
+        // World area covered by the texture.
+        float2 area_min;
+        float2 area_max;
+
+        // Sprites drawn into the texture.
+        std::vector<Entity> entities;
+
+        // Sprites found unchanged this frame.
+        size_t found;
+
+        bool dirty;
+
+        // Whether the texture can be drawn with premultiplied alpha,
+        // otherwise colors are divided by alpha after the layer is drawn.
+        bool premultiplied;
+    };
+
+    TransformGrid grid{8.0f};
+    std::vector<Entity> nearby;
+    QuadBatch quads;
+    SpriteRenderStats render_stats{};
+
+    std::unique_ptr<StaticLayer> static_layers[SpriteLayerMax];
+    std::vector<SpriteLayer> static_layer_ids;
+    std::vector<StaticSprite> static_sprites;
+    std::vector<Entity> static_nearby;
+    std::vector<uint32_t> static_pixels;
+    QuadBatch static_quads;
+    RenderList static_list;
+
+    void split_static_sprites(World *world);
+    void draw_static_layers(World *world, const QuadProjection &projection);
+    void redraw_static_layer(World *world, SpriteLayer layer,
+                             StaticLayer &cache,
+                             const QuadProjection &projection);
+    void bake_static_layer(StaticLayer &cache, const int2 &size);
 };
 
 // Requires a PixelTransform component and a Sprite component
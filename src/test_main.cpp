@@ -0,0 +1,39 @@
+#include "debug.h"
+
+namespace two {
+namespace test {
+
+void run_entity_test();
+void run_clone_test();
+void run_rewind_test();
+void run_system_order_test();
+void run_snapshot_test();
+void run_snapshot_resource_test();
+void run_timer_test();
+void run_atlas_test();
+void run_spatial_grid_test();
+void run_transform_grid_test();
+void run_radix_sort_test();
+void run_render_list_test();
+
+} // test
+} // two
+
+// Runs every test, a failed test aborts with the assertion that failed.
+int main(int, char *[]) {
+    using namespace two::test;
+    run_entity_test();
+    run_clone_test();
+    run_rewind_test();
+    run_system_order_test();
+    run_snapshot_test();
+    run_snapshot_resource_test();
+    run_timer_test();
+    run_atlas_test();
+    run_spatial_grid_test();
+    run_transform_grid_test();
+    run_radix_sort_test();
+    run_render_list_test();
+    two::log("All tests passed");
+    return 0;
+}
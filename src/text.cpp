@@ -18,6 +18,7 @@
 
 #include "text.h"
 
+#include <cstdlib>
 #include <memory>
 #include <unordered_map>
 #include <string>
@@ -101,21 +102,73 @@ static SDL_Texture *load_font_texture(const std::string &image_asset) {
         delete im;
         im = rgba32;
     }
-    auto *tex = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA32,
-                                  SDL_TEXTUREACCESS_STATIC,
-                                  im->width(), im->height());
-    ASSERT(tex != nullptr);
-    SDL_UpdateTexture(tex, nullptr, (const void *)im->pixels(), im->pitch());
-    SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    SDL_Texture *tex = nullptr;
+    // Worlds loaded with load_world_async load fonts on a worker
+    run_on_main_thread([&]() {
+        tex = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA32,
+                                SDL_TEXTUREACCESS_STATIC,
+                                im->width(), im->height());
+        ASSERT(tex != nullptr);
+        SDL_UpdateTexture(tex, nullptr,
+                          (const void *)im->pixels(), im->pitch());
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    });
     delete im;
     return tex;
 }
 
+constexpr bool Serializer<Text>::enabled;
+
+// Loads a font from its key in `font_cache()`, see `load_font`.
+static std::shared_ptr<Font> load_font_key(const std::string &key) {
+    auto separator = key.rfind(':');
+    if (separator == std::string::npos) {
+        return nullptr;
+    }
+    auto page = std::atoi(key.c_str() + separator + 1);
+    return load_font(key.substr(0, separator), page);
+}
+
+void Serializer<Text>::save(SnapshotWriter &writer,
+                            const Text *items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const auto &text = items[i];
+        writer.write_resource(text.font,
+                              [](const std::shared_ptr<Font> &font) {
+                                  return font_cache().key_of(font);
+                              });
+        writer.write_string(text.text);
+        writer.write(text.color);
+        writer.write(text.line_spacing);
+        writer.write(text.width);
+        writer.write(int32_t(text.wrap));
+    }
+}
+
+void Serializer<Text>::load(SnapshotReader &reader,
+                            Text *items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        auto &text = items[i];
+        text.font = reader.read_resource<Font>(load_font_key);
+        text.text = reader.read_string();
+        text.color = reader.read<Color>();
+        text.line_spacing = reader.read<float>();
+        text.width = reader.read<float>();
+        text.wrap = Text::WrapMode(reader.read<int32_t>());
+    }
+}
+
 Font::~Font() {
-    SDL_DestroyTexture(texture);
+    internal::release_texture(texture);
 }
 
-std::shared_ptr<Font> load_font(const std::string &fnt_asset, int page) {
+ResourceCache<Font> &font_cache() {
+    static ResourceCache<Font> cache;
+    return cache;
+}
+
+static std::shared_ptr<Font> parse_font(const std::string &fnt_asset,
+                                        int page) {
     auto font = std::make_shared<Font>();
 
     File file(fnt_asset);
@@ -178,6 +231,13 @@ std::shared_ptr<Font> load_font(const std::string &fnt_asset, int page) {
     return font;
 }
 
+std::shared_ptr<Font> load_font(const std::string &fnt_asset, int page) {
+    auto key = fnt_asset + ':' + std::to_string(page);
+    return font_cache().get(key, [&]() {
+        return parse_font(fnt_asset, page);
+    });
+}
+
 static inline void missing_glyph(const std::shared_ptr<Font> &font,
                                  uint32_t codepoint) {
     log_warn("Font: '%s' missing character 0x%X",
@@ -266,19 +326,22 @@ void FontRenderer::draw(World *world) {
     TWO_PROFILE_FUNC();
     ShadowEffect shadow;
     auto &camera = world->unpack_one<Camera>();
+    auto &list = render_list();
+    list.begin_pass();
+
     for (auto entity : world->view<Text>()) {
-        auto &text = world->unpack<Text>(entity);
+        auto &text = world->read<Text>(entity);
 
         int2 offset;
         float2 scale;
         if (world->has_component<PixelTransform>(entity)) {
             // Use absolute screen position
-            auto &transform = world->unpack<PixelTransform>(entity);
+            auto &transform = world->read<PixelTransform>(entity);
             offset = int2(transform.position);
             scale = transform.scale;
         } else if (world->has_component<Transform>(entity)) {
             // Use relative world position
-            auto &transform = world->unpack<Transform>(entity);
+            auto &transform = world->read<Transform>(entity);
             offset = world_to_screen(transform.position, camera);
             scale = transform.scale * camera.scale;
         } else {
@@ -286,7 +349,7 @@ void FontRenderer::draw(World *world) {
         }
         bool has_shadow = world->has_component<ShadowEffect>(entity);
         if (has_shadow)
-            shadow = world->unpack<ShadowEffect>(entity);
+            shadow = world->read<ShadowEffect>(entity);
 
         wrap_text(text, scale, wrap_info_cache);
         int x = 0;
@@ -322,20 +385,13 @@ void FontRenderer::draw(World *world) {
                 SDL_Rect shadow_dst = dst;
                 shadow_dst.x += shadow.offset.x;
                 shadow_dst.y += shadow.offset.y;
-
-                SDL_SetTextureColorMod(text.font->texture, shadow.color.r,
-                                       shadow.color.g, shadow.color.b);
-
-                SDL_SetTextureAlphaMod(text.font->texture, shadow.color.a);
-                SDL_RenderCopy(gfx, text.font->texture, &src, &shadow_dst);
+                list.draw_ordered(RenderCommand::copy(
+                    text.font->texture, src, shadow_dst, shadow.color));
             }
 
-            SDL_SetTextureColorMod(text.font->texture, text.color.r,
-                                   text.color.g, text.color.b);
-
-            SDL_SetTextureAlphaMod(text.font->texture, text.color.a);
             // Copy glyph texture
-            SDL_RenderCopy(gfx, text.font->texture, &src, &dst);
+            list.draw_ordered(RenderCommand::copy(text.font->texture, src,
+                                                  dst, text.color));
             // Advance to next character
             x += glyph.advance;
         }
@@ -28,6 +28,7 @@
 #include "mathf.h"
 #include "image.h"
 #include "entity.h"
+#include "cache.h"
 
 namespace two {
 
@@ -108,6 +109,16 @@ struct Text {
         , wrap{Overflow} {}
 };
 
+// Text is written to a snapshot with the font stored as a resource index,
+// see `SnapshotWriter::add_resource`. Fonts from `font_cache()` are loaded
+// again with `load_font` when the snapshot is read.
+template <>
+struct Serializer<Text> {
+    static constexpr bool enabled = true;
+    static void save(SnapshotWriter &writer, const Text *items, size_t count);
+    static void load(SnapshotReader &reader, Text *items, size_t count);
+};
+
 // FPS Component, add this to an entity with a text component
 // and add a FrameTimer System.
 struct FpsDisplay {
@@ -127,9 +138,13 @@ struct FpsDisplay {
         , time{0.0f} {}
 };
 
+// Fonts loaded from font assets, shared by asset path and page.
+ResourceCache<Font> &font_cache();
+
 // Loads a font from a .fnt (AngelCode BMFont) binary file.
 // Page is which page to use in the font file since a .fnt file can contain
-// more than one font variants.
+// more than one font variants. Returns the font already loaded for the
+// same asset and page if it is still referenced.
 std::shared_ptr<Font> load_font(const std::string &fnt_asset, int page = 0);
 
 // Same as `load_font(fnt_asset, page)` but the given image asset will be
@@ -0,0 +1,419 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#include "tilemap.h"
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "SDL_render.h"
+#include "mathf.h"
+#include "debug.h"
+#include "render.h"
+#include "two.h"
+
+namespace two {
+
+constexpr Tilemap::Tile Tilemap::Empty;
+constexpr int Tilemap::ChunkSize;
+constexpr bool Serializer<Tilemap>::enabled;
+
+static uint64_t next_chunk_version() {
+    // 0 is never used so it can mean "not drawn yet"
+    static std::atomic<uint64_t> counter{0};
+    return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+Tilemap::Tilemap(const std::vector<Sprite> &atlas, const int2 &size)
+    : sprites{atlas} {
+    resize(size);
+}
+
+Tilemap::Tile Tilemap::get(const int2 &tile) const {
+    if (!contains(tile)) {
+        return Empty;
+    }
+    int2 chunk{tile.x / ChunkSize, tile.y / ChunkSize};
+    int2 local{tile.x % ChunkSize, tile.y % ChunkSize};
+    return chunk_tiles(chunk)[local.y * ChunkSize + local.x];
+}
+
+void Tilemap::set(const int2 &tile, Tile value) {
+    ASSERTS(contains(tile), "Tile (%d, %d) is outside of the tilemap",
+            tile.x, tile.y);
+    int2 chunk{tile.x / ChunkSize, tile.y / ChunkSize};
+    int2 local{tile.x % ChunkSize, tile.y % ChunkSize};
+    auto index = chunk_index(chunk);
+    auto &dst = tiles[index * ChunkSize * ChunkSize
+                      + size_t(local.y * ChunkSize + local.x)];
+    if (dst != value) {
+        dst = value;
+        versions[index] = next_chunk_version();
+    }
+}
+
+void Tilemap::fill(Tile value) {
+    for (int y = 0; y < map_size.y; ++y) {
+        for (int x = 0; x < map_size.x; ++x) {
+            set(int2{x, y}, value);
+        }
+    }
+}
+
+void Tilemap::resize(const int2 &size) {
+    ASSERT(size.x >= 0 && size.y >= 0);
+    Tilemap resized;
+    resized.map_size = size;
+    resized.chunk_grid = int2{(size.x + ChunkSize - 1) / ChunkSize,
+                              (size.y + ChunkSize - 1) / ChunkSize};
+    auto chunks = size_t(resized.chunk_grid.x) * size_t(resized.chunk_grid.y);
+    resized.tiles.resize(chunks * ChunkSize * ChunkSize, Empty);
+    resized.versions.resize(chunks);
+    for (auto &version : resized.versions) {
+        version = next_chunk_version();
+    }
+
+    int2 keep{std::min(size.x, map_size.x), std::min(size.y, map_size.y)};
+    for (int y = 0; y < keep.y; ++y) {
+        for (int x = 0; x < keep.x; ++x) {
+            resized.set(int2{x, y}, get(int2{x, y}));
+        }
+    }
+    map_size = resized.map_size;
+    chunk_grid = resized.chunk_grid;
+    tiles = std::move(resized.tiles);
+    versions = std::move(resized.versions);
+}
+
+void Tilemap::set_atlas(const std::vector<Sprite> &atlas) {
+    sprites = atlas;
+    for (auto &version : versions) {
+        version = next_chunk_version();
+    }
+}
+
+void Serializer<Tilemap>::save(SnapshotWriter &writer,
+                               const Tilemap *items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        const auto &tilemap = items[i];
+        writer.write(tilemap.color);
+        writer.write(tilemap.layer);
+
+        const auto &atlas = tilemap.atlas();
+        writer.write(uint32_t(atlas.size()));
+        Serializer<Sprite>::save(writer, atlas.data(), atlas.size());
+
+        const auto &size = tilemap.size();
+        writer.write(size);
+        for (int y = 0; y < size.y; ++y) {
+            for (int x = 0; x < size.x; ++x) {
+                writer.write(tilemap.get(int2{x, y}));
+            }
+        }
+    }
+}
+
+void Serializer<Tilemap>::load(SnapshotReader &reader,
+                               Tilemap *items, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        auto &tilemap = items[i];
+        auto color = reader.read<Color>();
+        auto layer = reader.read<SpriteLayer>();
+
+        // Counts are checked against the data left so a corrupt snapshot
+        // can't make us allocate more than it could hold
+        auto atlas_size = reader.read<uint32_t>();
+        if (!reader.ok()
+            || atlas_size > reader.remaining() / Serializer<Sprite>::size) {
+            return;
+        }
+        std::vector<Sprite> atlas(atlas_size);
+        Serializer<Sprite>::load(reader, atlas.data(), atlas.size());
+
+        auto size = reader.read<int2>();
+        if (!reader.ok() || size.x < 0 || size.y < 0
+            || uint64_t(size.x) * uint64_t(size.y)
+               > reader.remaining() / sizeof(Tilemap::Tile)) {
+            return;
+        }
+        tilemap = Tilemap{atlas, size};
+        tilemap.color = color;
+        tilemap.layer = layer;
+        for (int y = 0; y < size.y && reader.ok(); ++y) {
+            for (int x = 0; x < size.x; ++x) {
+                tilemap.set(int2{x, y}, reader.read<Tilemap::Tile>());
+            }
+        }
+    }
+}
+
+void TilemapRenderer::draw(World *world) {
+    TWO_PROFILE_FUNC();
+    auto &camera = world->unpack_one<Camera>();
+    auto cam_scale = camera.scale;
+    auto tilesizef = float2(camera.tilesize) * cam_scale;
+    auto cam_offset = int2(camera.position * tilesizef);
+
+    int screen_w = render_info().screen_size.x;
+    int screen_h = render_info().screen_size.y;
+    int2 offset = int2{screen_w / 2, screen_h / 2} - cam_offset;
+
+    // Screen in world units, with a pixel of margin for rounding
+    float2 screen_min{float(-1 - offset.x) / tilesizef.x,
+                      float(-1 - offset.y) / tilesizef.y};
+    float2 screen_max{float(screen_w + 1 - offset.x) / tilesizef.x,
+                      float(screen_h + 1 - offset.y) / tilesizef.y};
+
+    bool targets = render_info().render_targets;
+    constexpr int N = Tilemap::ChunkSize;
+
+    ++frame;
+    render_stats = TilemapRenderStats{};
+    bake_items.clear();
+    draw_items.clear();
+    auto &list = render_list();
+    list.begin_pass();
+
+    for (auto entity : world->view<Transform, Tilemap>()) {
+        auto &transform = world->read<Transform>(entity);
+        auto &tilemap = world->read<Tilemap>(entity);
+        const auto &atlas = tilemap.atlas();
+        const auto &size = tilemap.size();
+        auto scale = transform.scale;
+        if (atlas.empty() || size.x == 0 || size.y == 0
+                || scale.x <= 0.0f || scale.y <= 0.0f) {
+            continue;
+        }
+
+        auto &map_cache = caches[entity];
+        map_cache.last_seen = frame;
+        auto &chunk_count = tilemap.chunk_count();
+        map_cache.chunks.resize(size_t(chunk_count.x) * size_t(chunk_count.y));
+
+        int2 tile_px{int(atlas[0].rect.w), int(atlas[0].rect.h)};
+        float w = scale.x * float(tile_px.x) * cam_scale;
+        float h = scale.y * float(tile_px.y) * cam_scale;
+
+        // Same projection as a sprite centered on the tile
+        auto tile_rect = [&](const int2 &tile) {
+            float2 center = transform.position + float2(tile) * scale;
+            float ws_x = float(int(center.x * tilesizef.x) + offset.x);
+            float ws_y = float(int(center.y * tilesizef.y) + offset.y);
+            return SDL_Rect{int(ws_x - 0.5f * w), int(ws_y - 0.5f * h),
+                            int(w), int(h)};
+        };
+
+        // Tiles that could be on screen, then shrunk to the exact range
+        float2 extent{0.5f * w / tilesizef.x, 0.5f * h / tilesizef.y};
+        float2 first = (screen_min - extent - transform.position) / scale;
+        float2 last = (screen_max + extent - transform.position) / scale;
+        int2 tile_min{int(clamp(floorf(first.x), 0.0f, float(size.x))),
+                      int(clamp(floorf(first.y), 0.0f, float(size.y)))};
+        int2 tile_max{int(clamp(ceilf(last.x), -1.0f, float(size.x - 1))),
+                      int(clamp(ceilf(last.y), -1.0f, float(size.y - 1)))};
+        for (; tile_min.x <= tile_max.x; ++tile_min.x) {
+            auto r = tile_rect(int2{tile_min.x, 0});
+            if (r.x + r.w > 0) {
+                break;
+            }
+        }
+        for (; tile_max.x >= tile_min.x; --tile_max.x) {
+            if (tile_rect(int2{tile_max.x, 0}).x < screen_w) {
+                break;
+            }
+        }
+        for (; tile_min.y <= tile_max.y; ++tile_min.y) {
+            auto r = tile_rect(int2{0, tile_min.y});
+            if (r.y + r.h > 0) {
+                break;
+            }
+        }
+        for (; tile_max.y >= tile_min.y; --tile_max.y) {
+            if (tile_rect(int2{0, tile_max.y}).y < screen_h) {
+                break;
+            }
+        }
+        if (tile_min.x > tile_max.x || tile_min.y > tile_max.y) {
+            continue;
+        }
+
+        for (int cy = tile_min.y / N; cy <= tile_max.y / N; ++cy) {
+            for (int cx = tile_min.x / N; cx <= tile_max.x / N; ++cx) {
+                int2 chunk{cx, cy};
+                int2 origin{cx * N, cy * N};
+
+                // Only the tiles on screen are drawn, so a chunk starts on
+                // the same pixel as its first visible tile
+                int2 begin{std::max(tile_min.x, origin.x) - origin.x,
+                           std::max(tile_min.y, origin.y) - origin.y};
+                int2 end{std::min(tile_max.x, origin.x + N - 1) - origin.x + 1,
+                         std::min(tile_max.y, origin.y + N - 1) - origin.y + 1};
+                ++render_stats.chunks;
+
+                if (targets) {
+                    auto &cache = map_cache.chunks[tilemap.chunk_index(chunk)];
+                    if (cache.texture == nullptr
+                            || cache.version != tilemap.chunk_version(chunk)) {
+                        bake_items.push_back(BakeItem{&cache, &tilemap, chunk});
+                    }
+                    cache.last_drawn = frame;
+
+                    auto dst = tile_rect(origin + begin);
+                    dst.w = int(w * float(end.x - begin.x));
+                    dst.h = int(h * float(end.y - begin.y));
+                    SDL_Rect src{begin.x * tile_px.x, begin.y * tile_px.y,
+                                 (end.x - begin.x) * tile_px.x,
+                                 (end.y - begin.y) * tile_px.y};
+                    draw_items.push_back(DrawItem{&cache, src, dst,
+                                             tilemap.color, tilemap.layer});
+                    continue;
+                }
+
+                // Without render targets each tile is drawn like a sprite
+                const auto *chunk_tiles = tilemap.chunk_tiles(chunk);
+                for (int ty = begin.y; ty < end.y; ++ty) {
+                    for (int tx = begin.x; tx < end.x; ++tx) {
+                        auto tile = chunk_tiles[ty * N + tx];
+                        if (tile >= atlas.size()) {
+                            continue;
+                        }
+                        auto &sprite = atlas[tile];
+                        SDL_Rect src{int(sprite.rect.x), int(sprite.rect.y),
+                                     int(sprite.rect.w), int(sprite.rect.h)};
+                        list.draw(RenderCommand::copy(
+                                      sprite.texture.get(), src,
+                                      tile_rect(origin + int2{tx, ty}),
+                                      tilemap.color),
+                                  tilemap.layer);
+                        ++render_stats.tiles;
+                    }
+                }
+            }
+        }
+    }
+
+    // Forget tilemaps that were removed and chunks that went out of view
+    for (auto it = caches.begin(); it != caches.end();) {
+        if (it->second.last_seen != frame) {
+            it = caches.erase(it);
+            continue;
+        }
+        for (auto &cache : it->second.chunks) {
+            if (cache.texture != nullptr
+                    && frame - cache.last_drawn > evict_frames) {
+                cache.texture = nullptr;
+                cache.version = 0;
+            }
+        }
+        ++it;
+    }
+
+    if (!bake_items.empty()) {
+        render_stats.baked = uint32_t(bake_items.size());
+        run_on_main_thread([this]() { bake_chunks(); });
+    }
+
+    for (auto &item : draw_items) {
+        if (item.cache->texture == nullptr) {
+            continue;
+        }
+        list.draw(RenderCommand::copy(item.cache->texture.get(), item.src,
+                                      item.dst, item.color),
+                  item.layer);
+    }
+}
+
+void TilemapRenderer::bake_chunks() {
+    TWO_PROFILE_FUNC();
+    constexpr int N = Tilemap::ChunkSize;
+    auto *previous_target = SDL_GetRenderTarget(gfx);
+
+    for (auto &item : bake_items) {
+        const auto &atlas = item.tilemap->atlas();
+        int2 tile_px{int(atlas[0].rect.w), int(atlas[0].rect.h)};
+        int2 texture_px{tile_px.x * N, tile_px.y * N};
+
+        auto *target = item.cache->texture.get();
+        int target_w = 0, target_h = 0;
+        if (target != nullptr) {
+            SDL_QueryTexture(target, nullptr, nullptr, &target_w, &target_h);
+        }
+        if (target_w != texture_px.x || target_h != texture_px.y) {
+            target = SDL_CreateTexture(gfx, SDL_PIXELFORMAT_RGBA8888,
+                                       SDL_TEXTUREACCESS_TARGET,
+                                       texture_px.x, texture_px.y);
+            if (target == nullptr) {
+                log_error("Could not create chunk texture: %s",
+                          SDL_GetError());
+                item.cache->texture = nullptr;
+                continue;
+            }
+            SDL_SetTextureBlendMode(target, SDL_BLENDMODE_BLEND);
+            item.cache->texture = make_texture(target);
+        }
+
+        SDL_SetRenderTarget(gfx, target);
+        SDL_SetRenderDrawColor(gfx, 0, 0, 0, 0);
+        SDL_RenderClear(gfx);
+
+        // Tiles do not overlap, copying them without blending keeps their
+        // alpha so the chunk blends the same way the tiles would.
+        SDL_Texture *bound = nullptr;
+        SDL_BlendMode bound_mode = SDL_BLENDMODE_BLEND;
+        const auto *tiles = item.tilemap->chunk_tiles(item.chunk);
+        for (int y = 0; y < N; ++y) {
+            for (int x = 0; x < N; ++x) {
+                auto tile = tiles[y * N + x];
+                if (tile >= atlas.size()) {
+                    continue;
+                }
+                auto &sprite = atlas[tile];
+                auto *texture = sprite.texture.get();
+                if (texture != bound) {
+                    if (bound != nullptr) {
+                        SDL_SetTextureBlendMode(bound, bound_mode);
+                    }
+                    bound = texture;
+                    SDL_GetTextureBlendMode(bound, &bound_mode);
+                    SDL_SetTextureBlendMode(bound, SDL_BLENDMODE_NONE);
+                    SDL_SetTextureColorMod(bound, 255, 255, 255);
+                    SDL_SetTextureAlphaMod(bound, 255);
+                }
+                SDL_Rect src{int(sprite.rect.x), int(sprite.rect.y),
+                             int(sprite.rect.w), int(sprite.rect.h)};
+                SDL_Rect dst{x * tile_px.x, y * tile_px.y,
+                             tile_px.x, tile_px.y};
+                SDL_RenderCopy(gfx, texture, &src, &dst);
+            }
+        }
+        if (bound != nullptr) {
+            SDL_SetTextureBlendMode(bound, bound_mode);
+        }
+        item.cache->version = item.tilemap->chunk_version(item.chunk);
+    }
+    SDL_SetRenderTarget(gfx, previous_target);
+}
+
+void TilemapRenderer::unload(World *) {
+    caches.clear();
+}
+
+} // two
@@ -0,0 +1,215 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#ifndef TWO_TILEMAP_H
+#define TWO_TILEMAP_H
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+#include "SDL.h"
+#include "mathf.h"
+#include "entity.h"
+#include "snapshot.h"
+#include "sprite.h"
+
+namespace two {
+
+// Tilemap component. A grid of tiles where each tile is an index into an
+// atlas of sprites, usually created with `load_atlas`. Tiles are stored in
+// square chunks of `ChunkSize` tiles so a renderer can draw and cache each
+// chunk as a single quad.
+//
+// Tile (x, y) is centered on `transform.position + (x, y) * transform.scale`,
+// the same place a sprite with the default origin would be drawn, so a
+// tilemap can replace a grid of sprite entities. Rotation is ignored.
+//
+//     auto tiles = load_atlas(im, 8, 8);
+//     Tilemap map{tiles, int2{64, 32}};
+//     map.fill(0);
+//     map.set(int2{3, 4}, 7);
+//     world->pack(e, Transform{float2{0, 0}});
+//     world->pack(e, map);
+//
+class Tilemap {
+public:
+    using Tile = uint16_t;
+
+    // Tile that is not drawn.
+    static constexpr Tile Empty = 0xffff;
+
+    // Width and height of a chunk in tiles.
+    static constexpr int ChunkSize = 16;
+
+    // Apply a color modulation when rendering the tiles.
+    Color color{255, 255, 255, 255};
+
+    // Sorting layer, see `Sprite::layer`.
+    SpriteLayer layer = 0;
+
+    Tilemap() = default;
+
+    // Creates a tilemap with `size` tiles, all of them `Empty`.
+    Tilemap(const std::vector<Sprite> &atlas, const int2 &size);
+
+    // Returns `Empty` if `tile` is outside the map.
+    Tile get(const int2 &tile) const;
+
+    // Sets a tile and marks its chunk as changed. `tile` must be inside
+    // the map.
+    void set(const int2 &tile, Tile value);
+
+    // Sets every tile in the map.
+    void fill(Tile value);
+
+    // Changes the number of tiles, keeping the tiles that are still
+    // inside the map. New tiles are `Empty`.
+    void resize(const int2 &size);
+
+    inline bool contains(const int2 &tile) const {
+        return tile.x >= 0 && tile.y >= 0
+               && tile.x < map_size.x && tile.y < map_size.y;
+    }
+
+    // Width and height in tiles.
+    inline const int2 &size() const { return map_size; }
+
+    // Width and height in chunks.
+    inline const int2 &chunk_count() const { return chunk_grid; }
+
+    // Sprites used for each tile index. Tiles are drawn at the size of the
+    // first sprite in the atlas.
+    inline const std::vector<Sprite> &atlas() const { return sprites; }
+
+    // Replaces the atlas and marks every chunk as changed.
+    void set_atlas(const std::vector<Sprite> &atlas);
+
+    // `ChunkSize * ChunkSize` tiles in row major order. Parts of a chunk
+    // that are outside the map are `Empty`.
+    inline const Tile *chunk_tiles(const int2 &chunk) const {
+        return tiles.data() + chunk_index(chunk) * ChunkSize * ChunkSize;
+    }
+
+    // Changes each time a tile in the chunk changes. Versions are unique
+    // across all tilemaps, so two chunks with the same version have the
+    // same tiles and atlas, even if one tilemap was copied from the other.
+    inline uint64_t chunk_version(const int2 &chunk) const {
+        return versions[chunk_index(chunk)];
+    }
+
+    inline size_t chunk_index(const int2 &chunk) const {
+        ASSERT(chunk.x >= 0 && chunk.y >= 0
+               && chunk.x < chunk_grid.x && chunk.y < chunk_grid.y);
+        return size_t(chunk.y) * size_t(chunk_grid.x) + size_t(chunk.x);
+    }
+
+private:
+    std::vector<Sprite> sprites;
+    int2 map_size{0, 0};
+    int2 chunk_grid{0, 0};
+    std::vector<Tile> tiles;
+    std::vector<uint64_t> versions;
+};
+
+// Tilemaps are written with their atlas sprites, see `Serializer<Sprite>`.
+// Chunk versions are not saved, loaded chunks always get new versions.
+template <>
+struct Serializer<Tilemap> {
+    static constexpr bool enabled = true;
+    static void save(SnapshotWriter &writer, const Tilemap *items,
+                     size_t count);
+    static void load(SnapshotReader &reader, Tilemap *items, size_t count);
+};
+
+// Counters from the last frame drawn by a `TilemapRenderer`.
+struct TilemapRenderStats {
+    // Chunks that were drawn.
+    uint32_t chunks;
+
+    // Chunks that were drawn into their cached texture this frame.
+    uint32_t baked;
+
+    // Tiles drawn individually because render targets are not supported.
+    uint32_t tiles;
+};
+
+// Requires a Transform component and a Tilemap component. Only chunks that
+// overlap the screen are drawn, each with a single command. A chunk is
+// drawn into a target texture the first time it is visible and again only
+// after one of its tiles changes, so a static map costs a handful of draw
+// calls no matter how many tiles it has. Textures of chunks that have not
+// been visible for a while are released.
+//
+// Commands are added to a separate pass of the frame's `RenderList`, add
+// this system before the `SpriteRenderer` to draw tiles under sprites.
+//
+// > Note: The software renderer rounds the source of scaled copies that are
+// cut by the edge of the screen, so with a camera scale other than 1 tiles
+// at the edge may be sampled up to a pixel off compared to sprites.
+class TilemapRenderer : public System {
+public:
+    // Frames a chunk can stay outside the screen before its texture is
+    // released.
+    uint32_t evict_frames = 300;
+
+    void draw(World *world) override;
+    void unload(World *world) override;
+
+    inline const TilemapRenderStats &stats() const { return render_stats; }
+
+private:
+    struct ChunkCache {
+        Texture texture;
+        uint64_t version = 0;
+        uint32_t last_drawn = 0;
+    };
+
+    struct MapCache {
+        std::vector<ChunkCache> chunks;
+        uint32_t last_seen = 0;
+    };
+
+    struct BakeItem {
+        ChunkCache *cache;
+        const Tilemap *tilemap;
+        int2 chunk;
+    };
+
+    struct DrawItem {
+        const ChunkCache *cache;
+        SDL_Rect src;
+        SDL_Rect dst;
+        Color color;
+        SpriteLayer layer;
+    };
+
+    std::unordered_map<Entity, MapCache> caches;
+    std::vector<BakeItem> bake_items;
+    std::vector<DrawItem> draw_items;
+    uint32_t frame = 0;
+    TilemapRenderStats render_stats{};
+
+    // Runs on the main thread, SDL render targets are renderer state.
+    void bake_chunks();
+};
+
+} // two
+
+#endif // TWO_TILEMAP_H
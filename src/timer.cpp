@@ -0,0 +1,307 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#include "timer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "debug.h"
+
+namespace two {
+
+constexpr int TimerWheel::Levels;
+constexpr int TimerWheel::SlotBits;
+constexpr int TimerWheel::SlotCount;
+constexpr int32_t TimerWheel::Nil;
+
+TimerWheel::TimerWheel(float resolution) : resolution{resolution} {
+    ASSERT(resolution > 0.0f);
+    for (int level = 0; level < Levels; ++level) {
+        std::fill(slots[level], slots[level] + SlotCount, Nil);
+        occupied[level] = 0;
+    }
+}
+
+Timer TimerWheel::schedule(float delay, float interval,
+                           const std::function<void()> &callback,
+                           size_t owner) {
+    ASSERT(callback != nullptr);
+    int32_t index;
+    if (free_list != Nil) {
+        index = free_list;
+        free_list = nodes[index].next;
+    } else {
+        index = int32_t(nodes.size());
+        nodes.emplace_back();
+    }
+    auto &node = nodes[index];
+    node.callback = callback;
+    node.expires = tick + std::max<uint64_t>(to_ticks(delay), 1);
+    node.interval = interval > 0.0f ? std::max<uint64_t>(to_ticks(interval), 1)
+                                    : 0;
+    node.owner = owner;
+    node.sequence = next_sequence++;
+    node.used = true;
+    insert(index, tick);
+    if (owner != 0) {
+        link_owner(index);
+    }
+    ++pending;
+    return Timer{uint32_t(index), node.generation};
+}
+
+bool TimerWheel::active(Timer timer) const {
+    return timer.index < nodes.size()
+           && nodes[timer.index].used
+           && nodes[timer.index].generation == timer.generation;
+}
+
+bool TimerWheel::cancel(Timer timer) {
+    if (!active(timer)) {
+        return false;
+    }
+    auto index = int32_t(timer.index);
+    if (nodes[index].level >= 0) {
+        unlink(index);
+    }
+    release(index);
+    return true;
+}
+
+void TimerWheel::cancel_owner(size_t owner) {
+    if (owner >= owner_heads.size()) {
+        return;
+    }
+    while (owner_heads[owner] != Nil) {
+        auto index = owner_heads[owner];
+        cancel(Timer{uint32_t(index), nodes[index].generation});
+    }
+}
+
+void TimerWheel::advance(float dt) {
+    TWO_PROFILE_FUNC();
+    remainder += dt;
+    auto ticks = uint64_t(remainder / resolution);
+    remainder -= double(ticks) * resolution;
+    auto target = tick + ticks;
+    constexpr uint64_t SlotMask = SlotCount - 1;
+
+    while (tick < target) {
+        if (pending == 0) {
+            tick = target;
+            break;
+        }
+        uint64_t t = tick + 1;
+        if ((t & SlotMask) != 0) {
+            // Skip empty slots up to the next cascade
+            auto rest = occupied[0] >> (t & SlotMask);
+            if (rest == 0) {
+                tick = std::min(target, t | SlotMask);
+                continue;
+            }
+            while ((rest & 1) == 0) {
+                rest >>= 1;
+                ++t;
+            }
+            if (t > target) {
+                tick = target;
+                break;
+            }
+        } else {
+            // Higher levels first so their timers can move down more
+            // than one level
+            for (int level = Levels - 1; level > 0; --level) {
+                auto span = uint64_t(1) << (SlotBits * level);
+                if ((t & (span - 1)) == 0) {
+                    cascade(level, t);
+                }
+            }
+        }
+        tick = t;
+        expire(int(t & SlotMask), t);
+    }
+}
+
+void TimerWheel::clear() {
+    for (int32_t i = 0; i < int32_t(nodes.size()); ++i) {
+        if (nodes[i].used) {
+            if (nodes[i].level >= 0) {
+                unlink(i);
+            }
+            release(i);
+        }
+    }
+}
+
+uint64_t TimerWheel::to_ticks(float seconds) const {
+    if (seconds <= 0.0f) {
+        return 0;
+    }
+    return uint64_t(std::ceil(double(seconds) / resolution));
+}
+
+void TimerWheel::insert(int32_t index, uint64_t base) {
+    auto &node = nodes[index];
+    ASSERT(node.expires >= base);
+    auto delta = node.expires - base;
+    auto expires = node.expires;
+
+    int level = 0;
+    while (level < Levels - 1
+           && delta >= (uint64_t(1) << (SlotBits * (level + 1)))) {
+        ++level;
+    }
+    auto range = uint64_t(1) << (SlotBits * Levels);
+    if (delta >= range) {
+        // Beyond the last level, the timer is moved again when its slot
+        // is cascaded
+        expires = base + range - 1;
+    }
+    int slot = int((expires >> (SlotBits * level)) & (SlotCount - 1));
+
+    node.level = int16_t(level);
+    node.slot = int16_t(slot);
+    node.prev = Nil;
+    node.next = slots[level][slot];
+    if (node.next != Nil) {
+        nodes[node.next].prev = index;
+    }
+    slots[level][slot] = index;
+    occupied[level] |= uint64_t(1) << slot;
+}
+
+void TimerWheel::unlink(int32_t index) {
+    auto &node = nodes[index];
+    ASSERT(node.level >= 0);
+    if (node.prev != Nil) {
+        nodes[node.prev].next = node.next;
+    } else {
+        slots[node.level][node.slot] = node.next;
+        if (node.next == Nil) {
+            occupied[node.level] &= ~(uint64_t(1) << node.slot);
+        }
+    }
+    if (node.next != Nil) {
+        nodes[node.next].prev = node.prev;
+    }
+    node.prev = Nil;
+    node.next = Nil;
+    node.level = -1;
+    node.slot = -1;
+}
+
+void TimerWheel::link_owner(int32_t index) {
+    auto owner = nodes[index].owner;
+    if (owner >= owner_heads.size()) {
+        owner_heads.resize(owner + 1, Nil);
+    }
+    auto &node = nodes[index];
+    node.owner_prev = Nil;
+    node.owner_next = owner_heads[owner];
+    if (node.owner_next != Nil) {
+        nodes[node.owner_next].owner_prev = index;
+    }
+    owner_heads[owner] = index;
+}
+
+void TimerWheel::unlink_owner(int32_t index) {
+    auto &node = nodes[index];
+    if (node.owner_prev != Nil) {
+        nodes[node.owner_prev].owner_next = node.owner_next;
+    } else {
+        owner_heads[node.owner] = node.owner_next;
+    }
+    if (node.owner_next != Nil) {
+        nodes[node.owner_next].owner_prev = node.owner_prev;
+    }
+    node.owner_prev = Nil;
+    node.owner_next = Nil;
+}
+
+void TimerWheel::release(int32_t index) {
+    auto &node = nodes[index];
+    if (node.owner != 0) {
+        unlink_owner(index);
+    }
+    node.callback = nullptr;
+    node.used = false;
+    node.owner = 0;
+    if (++node.generation == 0) {
+        node.generation = 1;
+    }
+    node.next = free_list;
+    free_list = index;
+    --pending;
+}
+
+void TimerWheel::cascade(int level, uint64_t t) {
+    int slot = int((t >> (SlotBits * level)) & (SlotCount - 1));
+    while (slots[level][slot] != Nil) {
+        auto index = slots[level][slot];
+        unlink(index);
+        insert(index, t);
+    }
+}
+
+void TimerWheel::expire(int slot, uint64_t t) {
+    // The slot list is not in the order timers were scheduled once they
+    // have cascaded from different levels. Taken from the member so a
+    // callback that advances the wheel does not clobber it.
+    std::vector<Timer> batch;
+    batch.swap(expiring);
+    batch.clear();
+    while (slots[0][slot] != Nil) {
+        auto index = slots[0][slot];
+        unlink(index);
+        ASSERT(nodes[index].expires == t);
+        batch.emplace_back(uint32_t(index), nodes[index].generation);
+    }
+    std::sort(batch.begin(), batch.end(), [this](Timer a, Timer b) {
+        return nodes[a.index].sequence < nodes[b.index].sequence;
+    });
+
+    for (auto timer : batch) {
+        if (!active(timer)) {
+            // Cancelled by an earlier callback
+            continue;
+        }
+        auto index = int32_t(timer.index);
+        // The callback may schedule timers, which can move nodes in
+        // memory, or cancel this timer.
+        auto callback = std::move(nodes[index].callback);
+        callback();
+
+        if (!active(timer)) {
+            // Cancelled by the callback
+            continue;
+        }
+        auto &node = nodes[index];
+        if (node.interval == 0) {
+            release(index);
+            continue;
+        }
+        node.callback = std::move(callback);
+        node.expires = t + node.interval;
+        insert(index, t);
+    }
+    batch.swap(expiring);
+}
+
+} // two
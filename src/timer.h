@@ -0,0 +1,156 @@
+// Copyright (c) 2020 stillwwater
+//
+// This software is provided 'as-is', without any express or implied
+// warranty. In no event will the authors be held liable for any damages
+// arising from the use of this software.
+//
+// Permission is granted to anyone to use this software for any purpose,
+// including commercial applications, and to alter it and redistribute it
+// freely, subject to the following restrictions:
+//
+// 1. The origin of this software must not be misrepresented; you must not
+//    claim that you wrote the original software. If you use this software
+//    in a product, an acknowledgment in the product documentation would be
+//    appreciated but is not required.
+// 2. Altered source versions must be plainly marked as such, and must not be
+//    misrepresented as being the original software.
+// 3. This notice may not be removed or altered from any source distribution.
+
+
+#ifndef TWO_TIMER_H
+#define TWO_TIMER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace two {
+
+// Identifies a timer scheduled with a `TimerWheel`. A timer that has
+// fired or been cancelled is no longer active, the handle can still be
+// passed to `cancel` safely.
+struct Timer {
+    uint32_t index = 0;
+    uint32_t generation = 0;
+
+    Timer() = default;
+    Timer(uint32_t index, uint32_t generation)
+        : index{index}, generation{generation} {}
+};
+
+// Schedules delayed and repeating callbacks. Timers are kept in a
+// hierarchical timing wheel: each level has 64 slots and every slot of a
+// level spans the whole lower level. Timers are moved to lower levels as
+// time passes and are only touched when they expire or move down a level,
+// so advancing the wheel costs O(expired timers) rather than O(pending
+// timers).
+//
+// Time is counted in ticks of `resolution` seconds. Timers fire on the
+// first tick at or after their delay, in the order they expire. Timers
+// that expire on the same tick fire in the order they were scheduled.
+class TimerWheel {
+public:
+    static constexpr int Levels = 4;
+    static constexpr int SlotBits = 6;
+    static constexpr int SlotCount = 1 << SlotBits;
+
+    explicit TimerWheel(float resolution = 0.001f);
+
+    // Calls `callback` after `delay` seconds, then every `interval`
+    // seconds if `interval` is greater than 0. Timers with an `owner`
+    // other than 0 can be cancelled together with `cancel_owner`.
+    Timer schedule(float delay, float interval,
+                   const std::function<void()> &callback, size_t owner = 0);
+
+    // Cancels a timer. Returns false if the timer is no longer active.
+    // Timers may cancel themselves or other timers from their callback.
+    bool cancel(Timer timer);
+
+    // Cancels every timer scheduled with `owner`.
+    void cancel_owner(size_t owner);
+
+    // True if the timer has not fired yet or is repeating.
+    bool active(Timer timer) const;
+
+    // Advances time by `dt` seconds and calls the callbacks of timers
+    // that expire.
+    void advance(float dt);
+
+    // Cancels all timers.
+    void clear();
+
+    // Number of pending timers.
+    inline size_t size() const { return pending; }
+
+    // Seconds elapsed since the wheel was created.
+    inline double time() const { return double(tick) * resolution; }
+
+private:
+    static constexpr int32_t Nil = -1;
+
+    struct Node {
+        std::function<void()> callback;
+        uint64_t expires = 0;
+        uint64_t interval = 0;
+        size_t owner = 0;
+        // Order the timer was scheduled in, kept when it repeats
+        uint64_t sequence = 0;
+        uint32_t generation = 1;
+
+        // Slot list, or the free list when the node is not in use
+        int32_t prev = Nil;
+        int32_t next = Nil;
+
+        // List of timers with the same owner
+        int32_t owner_prev = Nil;
+        int32_t owner_next = Nil;
+
+        int16_t level = -1;
+        int16_t slot = -1;
+        bool used = false;
+    };
+
+    std::vector<Node> nodes;
+    int32_t free_list = Nil;
+
+    int32_t slots[Levels][SlotCount];
+
+    // Bit i is set if slot i of a level has timers
+    uint64_t occupied[Levels];
+
+    // First timer of each owner, indexed by owner
+    std::vector<int32_t> owner_heads;
+
+    double resolution;
+    double remainder = 0.0;
+
+    // Last tick that has been processed
+    uint64_t tick = 0;
+    size_t pending = 0;
+    uint64_t next_sequence = 0;
+
+    // Timers of the slot being expired, reused between ticks
+    std::vector<Timer> expiring;
+
+    uint64_t to_ticks(float seconds) const;
+
+    // Adds a timer to the slot for its expiry relative to `base`.
+    void insert(int32_t index, uint64_t base);
+    void unlink(int32_t index);
+
+    void link_owner(int32_t index);
+    void unlink_owner(int32_t index);
+
+    void release(int32_t index);
+
+    // Moves the timers of a slot to lower levels.
+    void cascade(int level, uint64_t t);
+
+    // Calls the callbacks of timers in a level 0 slot.
+    void expire(int slot, uint64_t t);
+};
+
+} // two
+
+#endif // TWO_TIMER_H
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "timer.h"
+#include "debug.h"
+
+namespace two {
+namespace test {
+
+void run_timer_test() {
+    // One tick per second so delays are exact
+    TimerWheel wheel(1.0f);
+
+    // Delays on every level of the wheel, on both sides of each level's
+    // span, and past the range of the last level
+    std::vector<uint64_t> delays{
+        1, 3, 63, 64, 65, 100, 4095, 4096, 4097, 5000,
+        262143, 262144, 300000, 16777215, 16777216, 20000000,
+    };
+    std::vector<uint64_t> fired;
+    // Scheduled in reverse so the wheel has to order them
+    for (auto it = delays.rbegin(); it != delays.rend(); ++it) {
+        wheel.schedule(float(*it), 0.0f, [&wheel, &fired]() {
+            fired.push_back(uint64_t(wheel.time()));
+        });
+    }
+    ASSERT_ALWAYS(wheel.size() == delays.size());
+
+    int repeats = 0;
+    auto repeating = wheel.schedule(10.0f, 10.0f, [&repeats]() {
+        ++repeats;
+    });
+
+    wheel.advance(99.5f);
+    ASSERT_ALWAYS(repeats == 9);
+    wheel.advance(0.5f);
+    ASSERT_ALWAYS(repeats == 10);
+    ASSERT_ALWAYS(wheel.cancel(repeating));
+    ASSERT_ALWAYS(!wheel.cancel(repeating));
+    ASSERT_ALWAYS(!wheel.active(repeating));
+
+    while (wheel.size() > 0) {
+        wheel.advance(1000000.0f);
+    }
+    ASSERT_ALWAYS(fired == delays);
+
+    // Owners cancel all of their timers, including ones that have moved
+    // down a level
+    int owned = 0;
+    for (int i = 1; i <= 5; ++i) {
+        wheel.schedule(float(i * 1000), 0.0f, [&owned]() { ++owned; }, 7);
+    }
+    auto other = wheel.schedule(2500.0f, 0.0f, [&owned]() { ++owned; }, 8);
+    wheel.advance(1500.0f);
+    ASSERT_ALWAYS(owned == 1);
+    wheel.cancel_owner(7);
+    ASSERT_ALWAYS(wheel.size() == 1 && wheel.active(other));
+    wheel.advance(10000.0f);
+    ASSERT_ALWAYS(owned == 2);
+
+    // A timer may cancel itself and schedule new timers from its callback
+    Timer self;
+    int count = 0;
+    self = wheel.schedule(1.0f, 1.0f, [&]() {
+        if (++count == 3) {
+            wheel.cancel(self);
+            wheel.schedule(64.0f, 0.0f, [&count]() { count = 100; });
+        }
+    });
+    wheel.advance(10.0f);
+    ASSERT_ALWAYS(count == 3);
+    wheel.advance(64.0f);
+    ASSERT_ALWAYS(count == 100 && wheel.size() == 0);
+
+    // Timers that expire on the same tick fire in the order they were
+    // scheduled, including ones that cascaded from a higher level and
+    // ones cancelled by an earlier callback
+    std::vector<int> order;
+    Timer cancelled;
+    wheel.schedule(200.0f, 0.0f, [&order]() { order.push_back(0); });
+    wheel.advance(150.0f);
+    wheel.schedule(50.0f, 0.0f, [&]() {
+        order.push_back(1);
+        wheel.cancel(cancelled);
+    });
+    cancelled = wheel.schedule(50.0f, 0.0f, [&order]() {
+        order.push_back(2);
+    });
+    for (int i = 3; i < 6; ++i) {
+        wheel.schedule(50.0f, 0.0f, [&order, i]() { order.push_back(i); });
+    }
+    wheel.advance(50.0f);
+    ASSERT_ALWAYS((order == std::vector<int>{0, 1, 3, 4, 5}));
+    ASSERT_ALWAYS(wheel.size() == 0);
+}
+
+} // test
+} // two
@@ -19,25 +19,182 @@
 #include "two.h"
 
 #include <chrono>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #include "SDL.h"
 #include "physfs/physfs.h"
 #include "entity.h"
 #include "debug.h"
+#include "job.h"
+#include "sprite.h"
 
 namespace two {
 
+// A world run by the main loop along with the state needed to replace it.
+// The main world is loaded with `load_world`, other worlds with
+// `add_world`.
+struct WorldContext {
+    World *world = nullptr;
+
+    // World that replaces `world` at the start of the next frame.
+    World *queued = nullptr;
+
+    // Unloaded world that is freed at the start of the next frame.
+    World *destroyed = nullptr;
+
+    EventDispatcher events;
+    int draw_order = 0;
+};
+
+static WorldContext main_context;
+
+// Worlds added with add_world.
+static std::vector<std::unique_ptr<WorldContext>> extra_contexts;
+
+// All worlds in the order they are drawn.
+static std::vector<WorldContext *> draw_list{&main_context};
+
+// Worlds may be added or removed while other worlds are updating, so
+// changes are applied at the start of the next frame.
+static std::mutex context_mutex;
+static std::vector<std::unique_ptr<WorldContext>> added_contexts;
+static std::vector<World *> removed_worlds;
+
+// Context of the world being updated on this thread, the main world if
+// null.
+static thread_local WorldContext *current_context = nullptr;
+
+// Set on the thread running load_world_async.
+static thread_local bool async_load_thread = false;
+
+static inline WorldContext &context() {
+    return current_context != nullptr ? *current_context : main_context;
+}
+
 namespace internal {
 
-EventDispatcher events;
+EventDispatcher &events = main_context.events;
+
+EventDispatcher &dispatcher() {
+    return context().events;
+}
 
 } // internal
 
-static World *world = nullptr;
-static World *queued_world = nullptr;
-static World *destroyed_world = nullptr;
 static bool running = 0;
 
+// See set_fixed_timestep, 0 if disabled.
+static float fixed_timestep = 0.0f;
+static float accumulator = 0.0f;
+static float alpha = 1.0f;
+
+// See set_target_framerate, 0 if disabled.
+static int64_t target_frame_micro = 0;
+
+// Commands for the frame being drawn and, when frames are pipelined, the
+// previous frame waiting to be presented.
+static RenderList frame_lists[2];
+static RenderList *drawing_list = &frame_lists[0];
+static RenderList *presenting_list = &frame_lists[1];
+
+// See set_frame_latency, may be set while a worker is updating.
+static std::atomic<int> frame_latency{0};
+
+// True if `presenting_list` holds a frame that has not been presented.
+static bool frame_pending = false;
+
+// Textures released while a pipelined frame could still refer to them.
+// They are destroyed after that frame has been presented.
+static std::mutex texture_mutex;
+static std::vector<SDL_Texture *> released_textures;
+static bool defer_texture_release = false;
+
+// Set by quit() when called during a parallel update, the main loop quits
+// once the update has finished.
+static std::atomic<bool> quit_requested{false};
+
+// True on the main thread while it updates the main world and other worlds
+// are updating on the job pool.
+static bool ticking_in_parallel = false;
+
+// See render_info, only written by the main thread between frames.
+static RenderInfo frame_render_info{int2{0, 0}, int2{0, 0}, false};
+
+RenderList &render_list() {
+    return *drawing_list;
+}
+
+namespace internal {
+
+void release_texture(SDL_Texture *texture) {
+    {
+        std::lock_guard<std::mutex> lock(texture_mutex);
+        if (defer_texture_release) {
+            released_textures.push_back(texture);
+            return;
+        }
+    }
+    run_on_main_thread([texture]() { SDL_DestroyTexture(texture); });
+}
+
+bool is_async_load_thread() {
+    return async_load_thread;
+}
+
+} // internal
+
+// See start_input_recording and start_input_replay.
+static std::unique_ptr<InputRecorder> input_recorder;
+static std::unique_ptr<InputReplay> input_replay;
+
+// False until the mouse position has been read for live input, see
+// internal::mouse_focus_event.
+static bool mouse_position_read = false;
+static std::vector<SDL_Event> replay_events;
+static bool quit_after_replay = true;
+
+static std::thread::id main_thread_id;
+
+struct MainThreadTask {
+    const std::function<void()> *function;
+    bool done;
+};
+
+// Tasks queued with run_on_main_thread. Workers wait on `task_cv` until
+// their task is done, the main thread waits on it for new tasks.
+static std::mutex task_mutex;
+static std::condition_variable task_cv;
+static std::deque<MainThreadTask *> main_thread_tasks;
+
+// Time wait_for_async_load waits for a task from the loading world before
+// checking if it has finished loading.
+static constexpr int64_t AsyncLoadWaitMicro = 4000;
+
+struct AsyncLoad {
+    std::thread thread;
+    // Set once the world has been loaded.
+    std::atomic<bool> ready{false};
+    // Context of the world while it loads, current on the loading thread
+    // so `active_world()` is the new world and events bound by `load()`
+    // are only received once the world is swapped in.
+    WorldContext context;
+};
+
+static std::unique_ptr<AsyncLoad> async_load = nullptr;
+
+// Time left before the next frame below which wait_for_next_frame yields
+// instead of sleeping.
+static constexpr int64_t FrameYieldMicro = 500;
+
+// Frames longer than this are clamped when using a fixed timestep so that
+// a slow frame does not cause even more updates in the next frame.
+static constexpr float MaxFrameTime = 0.25f;
+
 SDL_Window *window;
 SDL_Renderer *gfx;
 
@@ -48,10 +205,17 @@ static void (*profiler_update_callback)() = nullptr;
 #endif
 
 void init(int argc, char *argv[]) {
+    main_thread_id = std::this_thread::get_id();
     PHYSFS_init(argc > 0 ? argv[0] : nullptr);
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
 }
 
+void init_headless(int argc, char *argv[]) {
+    main_thread_id = std::this_thread::get_id();
+    PHYSFS_init(argc > 0 ? argv[0] : nullptr);
+    SDL_Init(SDL_INIT_EVENTS);
+}
+
 void init_profiler(void (*profiler_update)()) {
 #ifdef TWO_PERFORMANCE_PROFILING
     profiler = std::unique_ptr<Profiler>(new Profiler);
@@ -73,7 +237,7 @@ void init_profiler(const char *filename) {
 #endif
 }
 
-void create_window(const char *title, int width, int height) {
+void create_window(const char *title, int width, int height, bool vsync) {
     window = SDL_CreateWindow(title,
                               SDL_WINDOWPOS_UNDEFINED,
                               SDL_WINDOWPOS_UNDEFINED,
@@ -81,36 +245,324 @@ void create_window(const char *title, int width, int height) {
 
     SDL_SetHint(SDL_HINT_RENDER_BATCHING, "1");
     gfx = SDL_CreateRenderer(
-        window, 0, SDL_RENDERER_ACCELERATED | /*SDL_RENDERER_PRESENTVSYNC*/ 0);
+        window, 0, SDL_RENDERER_ACCELERATED
+                   | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
 
     set_logical_size(width, height);
 }
 
+// Queries the renderer for the state read by systems during the frame.
+static void capture_render_info() {
+    RenderInfo info{int2{0, 0}, int2{0, 0}, false};
+    if (gfx != nullptr) {
+        SDL_RenderGetLogicalSize(gfx, &info.screen_size.x,
+                                 &info.screen_size.y);
+        SDL_RendererInfo renderer;
+        if (SDL_GetRendererInfo(gfx, &renderer) == 0) {
+            info.max_texture_size = int2{renderer.max_texture_width,
+                                         renderer.max_texture_height};
+        }
+        info.render_targets = SDL_RenderTargetSupported(gfx);
+    }
+    frame_render_info = info;
+}
+
 void set_logical_size(int width, int height) {
-    SDL_RenderSetLogicalSize(gfx, width, height);
+    run_on_main_thread([width, height]() {
+        SDL_RenderSetLogicalSize(gfx, width, height);
+    });
+    // Other worlds may be reading the current info
+    if (is_main_thread() && !ticking_in_parallel) {
+        capture_render_info();
+    }
 }
 
-static void load_world_finish() {
+const RenderInfo &render_info() {
+    return frame_render_info;
+}
+
+static void load_world_finish(WorldContext &ctx) {
     TWO_PROFILE_FUNC();
     // Cleanup previously loaded world
-    delete destroyed_world;
-    destroyed_world = nullptr;
+    if (ctx.world == ctx.destroyed) {
+        ctx.world = nullptr;
+    }
+    delete ctx.destroyed;
+    ctx.destroyed = nullptr;
 
-    ASSERT(queued_world != nullptr);
-    world = queued_world;
-    queued_world = nullptr;
+    if (ctx.queued == nullptr) {
+        return;
+    }
+    ctx.world = ctx.queued;
+    ctx.queued = nullptr;
 
-    // Load new world
-    world->make_system<BackgroundRenderer>();
-    world->load();
+    // Load new world. Only the main world clears the screen, other worlds
+    // are drawn over it.
+    if (&ctx == &main_context) {
+        ctx.world->make_system<BackgroundRenderer>();
+    }
+    auto *previous = current_context;
+    current_context = &ctx;
+    ctx.world->load();
+    current_context = previous;
 }
 
 void load_world(World *w) {
-    destroy_world(world);
-    queued_world = w;
-    if (world == nullptr) {
-        load_world_finish();
+    auto &ctx = context();
+    destroy_world(ctx.world);
+    ctx.queued = w;
+    if (ctx.world == nullptr) {
+        load_world_finish(ctx);
+    }
+}
+
+void add_world(World *w, int draw_order) {
+    ASSERT(w != nullptr);
+    std::unique_ptr<WorldContext> ctx(new WorldContext);
+    ctx->queued = w;
+    ctx->draw_order = draw_order;
+
+    std::lock_guard<std::mutex> lock(context_mutex);
+    added_contexts.push_back(std::move(ctx));
+}
+
+void remove_world(World *w) {
+    ASSERT(w != nullptr && w != main_context.world);
+    std::lock_guard<std::mutex> lock(context_mutex);
+    removed_worlds.push_back(w);
+}
+
+// Finds the context a world was loaded in. Worlds that are not loaded
+// belong to the context of the calling thread.
+static WorldContext &context_of(World *w) {
+    if (main_context.world == w) {
+        return main_context;
+    }
+    for (auto &ctx : extra_contexts) {
+        if (ctx->world == w) {
+            return *ctx;
+        }
+    }
+    return context();
+}
+
+static void destroy_context(WorldContext &ctx) {
+    destroy_world(ctx.world);
+    if (ctx.world == ctx.destroyed) {
+        ctx.world = nullptr;
+    }
+    delete ctx.destroyed;
+    delete ctx.queued;
+    ctx.destroyed = nullptr;
+    ctx.queued = nullptr;
+}
+
+// Applies calls to add_world and remove_world.
+static void update_contexts() {
+    std::lock_guard<std::mutex> lock(context_mutex);
+    if (added_contexts.empty() && removed_worlds.empty()) {
+        return;
+    }
+    for (auto &ctx : added_contexts) {
+        extra_contexts.push_back(std::move(ctx));
     }
+    added_contexts.clear();
+
+    for (auto *w : removed_worlds) {
+        auto it = std::find_if(
+            extra_contexts.begin(), extra_contexts.end(),
+            [w](const std::unique_ptr<WorldContext> &ctx) {
+                return ctx->world == w || ctx->queued == w;
+            });
+        if (it == extra_contexts.end()) {
+            log_warn("Trying to remove a world that was not added");
+            continue;
+        }
+        destroy_context(**it);
+        extra_contexts.erase(it);
+    }
+    removed_worlds.clear();
+
+    draw_list.clear();
+    draw_list.push_back(&main_context);
+    for (auto &ctx : extra_contexts) {
+        draw_list.push_back(ctx.get());
+    }
+    // The main world is drawn first among worlds with the same order
+    std::stable_sort(draw_list.begin(), draw_list.end(),
+                     [](const WorldContext *a, const WorldContext *b) {
+                         return a->draw_order < b->draw_order;
+                     });
+}
+
+// Unloads and frees all worlds added with add_world.
+static void destroy_extra_worlds() {
+    update_contexts();
+    for (auto &ctx : extra_contexts) {
+        destroy_context(*ctx);
+    }
+    extra_contexts.clear();
+    draw_list.assign(1, &main_context);
+}
+
+// Frees unloaded worlds and loads queued ones. Called at the start of
+// each frame.
+static void begin_frame() {
+    update_contexts();
+    for (auto *ctx : draw_list) {
+        if (ctx->destroyed != nullptr || ctx->queued != nullptr) {
+            load_world_finish(*ctx);
+        }
+    }
+}
+
+bool is_main_thread() {
+    // Before init is called there are no other threads
+    return main_thread_id == std::thread::id()
+           || main_thread_id == std::this_thread::get_id();
+}
+
+void run_on_main_thread(const std::function<void()> &task) {
+    if (is_main_thread()) {
+        task();
+        return;
+    }
+    MainThreadTask queued{&task, false};
+    std::unique_lock<std::mutex> lock(task_mutex);
+    main_thread_tasks.push_back(&queued);
+    task_cv.notify_all();
+    lock.unlock();
+    // The main thread may be waiting on a job group instead of `task_cv`
+    job_pool().wake();
+    lock.lock();
+    task_cv.wait(lock, [&queued]() { return queued.done; });
+}
+
+// Runs tasks queued by other threads and returns once there are none
+// left. While a world is loading this keeps waiting for new tasks until
+// `budget_micro` has passed, since the loading thread waits for each task
+// before queuing the next one. A budget of 0 never waits.
+static void run_main_thread_tasks(int64_t budget_micro) {
+    auto deadline = std::chrono::steady_clock::now()
+                    + std::chrono::microseconds(budget_micro);
+
+    std::unique_lock<std::mutex> lock(task_mutex);
+    for (;;) {
+        while (!main_thread_tasks.empty()) {
+            auto *task = main_thread_tasks.front();
+            main_thread_tasks.pop_front();
+            lock.unlock();
+            (*task->function)();
+            lock.lock();
+            task->done = true;
+            task_cv.notify_all();
+        }
+        if (budget_micro <= 0 || async_load == nullptr || async_load->ready
+            || std::chrono::steady_clock::now() >= deadline) {
+            return;
+        }
+        task_cv.wait_until(lock, deadline);
+    }
+}
+
+// Waits for a job group on the main thread, running tasks queued by its
+// jobs. Sleeps while there is nothing to run.
+static void wait_running_main_thread_tasks(JobGroup &group) {
+    job_pool().wait(group, []() { run_main_thread_tasks(0); });
+}
+
+static void load_world_worker(AsyncLoad *load,
+                              std::function<World *()> make_world) {
+    async_load_thread = true;
+    auto *w = make_world();
+    ASSERT(w != nullptr);
+    load->context.world = w;
+    current_context = &load->context;
+    w->make_system<BackgroundRenderer>();
+    w->load();
+    current_context = nullptr;
+    async_load_thread = false;
+
+    {
+        std::lock_guard<std::mutex> lock(task_mutex);
+        load->ready = true;
+    }
+    // Wake the main thread if it is waiting for tasks
+    task_cv.notify_all();
+}
+
+static void wait_for_async_load() {
+    TWO_PROFILE_FUNC();
+    ASSERT(async_load != nullptr);
+    while (!async_load->ready) {
+        run_main_thread_tasks(AsyncLoadWaitMicro);
+    }
+    async_load->thread.join();
+    while (internal::staged_texture_uploads() > 0) {
+        internal::upload_textures();
+    }
+}
+
+// Destroys a world that was loaded but never swapped in.
+static void discard_async_load() {
+    wait_for_async_load();
+    auto *w = async_load->context.world;
+    current_context = &async_load->context;
+    w->unload();
+    w->destroy_systems();
+    current_context = nullptr;
+    delete w;
+    async_load.reset();
+}
+
+// Replaces the current world with the one loaded by load_world_async.
+static void finish_async_load() {
+    TWO_PROFILE_FUNC();
+    ASSERT(async_load != nullptr && async_load->ready);
+    if (async_load->thread.joinable()) {
+        async_load->thread.join();
+    }
+    // Nothing refers to the current world between frames so it is safe to
+    // free it right away.
+    destroy_world(main_context.world);
+    delete main_context.destroyed;
+    main_context.destroyed = nullptr;
+
+    main_context.world = async_load->context.world;
+    // Other threads may be posting to the main dispatcher, only its
+    // handlers and queued events are replaced.
+    main_context.events.replace(async_load->context.events);
+    async_load.reset();
+}
+
+// Called at the start of each frame.
+static void poll_async_load() {
+    if (async_load == nullptr) {
+        return;
+    }
+    if (main_context.world == nullptr) {
+        // Nothing to run until the first world is loaded
+        wait_for_async_load();
+    }
+    // Textures created while loading are uploaded over the following
+    // frames, the world is swapped in once they are all uploaded
+    if (async_load->ready && internal::staged_texture_uploads() == 0) {
+        finish_async_load();
+    }
+}
+
+void load_world_async(const std::function<World *()> &make_world) {
+    ASSERT(is_main_thread());
+    if (async_load != nullptr) {
+        discard_async_load();
+    }
+    async_load.reset(new AsyncLoad);
+    async_load->thread = std::thread(load_world_worker,
+                                     async_load.get(), make_world);
+}
+
+bool is_loading_world() {
+    return async_load != nullptr;
 }
 
 void destroy_world(World *w) {
@@ -118,20 +570,25 @@ void destroy_world(World *w) {
     if (w == nullptr) {
         return;
     }
+    auto &ctx = context_of(w);
+    auto *previous = current_context;
+    current_context = &ctx;
     w->unload();
     w->destroy_systems();
     clear_event_listeners();
-    destroyed_world = w;
+    current_context = previous;
+    ctx.destroyed = w;
 }
 
 World *active_world() {
-    ASSERT(world != nullptr);
-    return world;
+    auto *w = context().world;
+    ASSERT(w != nullptr);
+    return w;
 }
 
 int2 world_to_screen(const float2 &v, const Camera &camera) {
-    int w, h;
-    SDL_RenderGetLogicalSize(gfx, &w, &h);
+    int w = render_info().screen_size.x;
+    int h = render_info().screen_size.y;
     auto tilesizef = float2(camera.tilesize) * camera.scale;
 
     int2 result;
@@ -143,8 +600,8 @@ int2 world_to_screen(const float2 &v, const Camera &camera) {
 }
 
 float2 screen_to_world(const int2 &v, const Camera &camera) {
-    int w, h;
-    SDL_RenderGetLogicalSize(gfx, &w, &h);
+    int w = render_info().screen_size.x;
+    int h = render_info().screen_size.y;
     auto tilesizef = float2(camera.tilesize) * camera.scale;
 
     float2 result;
@@ -162,71 +619,268 @@ void BackgroundRenderer::draw(World *world) {
     ASSERTS(camera_entity.has_value,
             "Missing an entity with a Camera component");
 
-    auto &camera = world->unpack<Camera>(camera_entity.value());
+    auto &camera = world->read<Camera>(camera_entity.value());
+    Color background{camera.background.r, camera.background.g,
+                     camera.background.b};
+    auto &list = render_list();
+    list.begin_pass();
     if (camera.background_is_clear_color) {
-        SDL_SetRenderDrawColor(gfx, camera.background.r,
-                               camera.background.g, camera.background.b, 255);
-        SDL_RenderClear(gfx);
+        list.draw_ordered(RenderCommand::clear(background));
+        return;
+    }
+    list.draw_ordered(RenderCommand::clear(Color::Black));
+    auto &screen = render_info().screen_size;
+    SDL_Rect dst{0, 0, screen.x, screen.y};
+    list.draw_ordered(RenderCommand::fill(dst, background));
+}
+
+static void tick_context(WorldContext &ctx, float dt) {
+    if (ctx.world == nullptr || ctx.destroyed != nullptr) {
+        // Not loaded yet or unloaded during this frame
         return;
     }
-    SDL_SetRenderDrawColor(gfx, 0, 0, 0, 255);
-    SDL_RenderClear(gfx);
-    SDL_Rect dst{0, 0, 0, 0};
-    SDL_RenderGetLogicalSize(gfx, &dst.w, &dst.h);
-    SDL_SetRenderDrawColor(gfx, camera.background.r,
-                           camera.background.g, camera.background.b, 255);
-    SDL_RenderFillRect(gfx, &dst);
+    ctx.events.dispatch();
+    ctx.world->update_timers(dt);
+    if (ctx.destroyed != nullptr) {
+        // Unloaded by an event handler or timer
+        return;
+    }
+    ctx.world->update(dt);
+    ctx.world->collect_unused_entities();
+    ctx.world->commit_frame();
+}
+
+// Updates every world once. Worlds added with add_world are updated on the
+// job pool while the main world is updated on this thread.
+static void tick(float dt) {
+    if (extra_contexts.empty()) {
+        tick_context(main_context, dt);
+        return;
+    }
+    JobGroup group;
+    for (auto &ctx : extra_contexts) {
+        auto *c = ctx.get();
+        job_pool().run(group, [c, dt]() {
+            current_context = c;
+            tick_context(*c, dt);
+            current_context = nullptr;
+        });
+    }
+    if (!is_main_thread()) {
+        tick_context(main_context, dt);
+        // Pipelined frame, the main thread runs tasks while it waits
+        job_pool().wait(group);
+        return;
+    }
+    ticking_in_parallel = true;
+    tick_context(main_context, dt);
+    // Worlds may create textures while updating
+    wait_running_main_thread_tasks(group);
+    ticking_in_parallel = false;
+}
+
+// Moves events posted from other threads into each world's event queue.
+static void drain_posted_events() {
+    main_context.events.drain_posted();
+    for (auto &ctx : extra_contexts) {
+        ctx->events.drain_posted();
+    }
+}
+
+// Draws every world in draw order.
+static void draw() {
+    auto &frame_list = *drawing_list;
+    frame_list.reset();
+    for (auto *ctx : draw_list) {
+        if (ctx->world == nullptr) {
+            continue;
+        }
+        current_context = ctx == &main_context ? nullptr : ctx;
+        ctx->world->draw_systems();
+    }
+    current_context = nullptr;
+    frame_list.sort();
+}
+
+// Emits an input event to each world starting with the world drawn last,
+// until a handler returns true.
+template <typename Event>
+static void emit_input(const Event &event) {
+    for (auto it = draw_list.rbegin(); it != draw_list.rend(); ++it) {
+        if ((*it)->events.emit(event)) {
+            return;
+        }
+    }
+}
+
+// Runs as many fixed updates as fit in the time since the last frame.
+static void tick_fixed(float dt) {
+    accumulator += std::min(dt, MaxFrameTime);
+    while (accumulator >= fixed_timestep) {
+        tick(fixed_timestep);
+        accumulator -= fixed_timestep;
+        if (!running || quit_requested || main_context.destroyed != nullptr) {
+            // World was unloaded during the update
+            accumulator = 0.0f;
+            break;
+        }
+    }
+    alpha = accumulator / fixed_timestep;
+}
+
+// Microseconds until the target frame time has passed since `frame_begin`.
+static int64_t frame_time_left(
+        std::chrono::high_resolution_clock::time_point frame_begin) {
+    using namespace std::chrono;
+    auto target = frame_begin + microseconds(target_frame_micro);
+    return duration_cast<microseconds>(
+        target - high_resolution_clock::now()).count();
+}
+
+// Sleeps until the target frame time has passed since `frame_begin`.
+static void wait_for_next_frame(
+        std::chrono::high_resolution_clock::time_point frame_begin) {
+    TWO_PROFILE_FUNC();
+    for (;;) {
+        auto remaining = frame_time_left(frame_begin);
+        if (remaining <= 0) {
+            break;
+        }
+        // Sleep is not precise, so the last couple of milliseconds are
+        // slept in 1 ms steps and only the last fraction of a millisecond
+        // is spent yielding.
+        if (remaining > 2000) {
+            SDL_Delay(Uint32((remaining - 1000) / 1000));
+        } else if (remaining > FrameYieldMicro) {
+            SDL_Delay(1);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Updates every world once for a variable timestep or as many times as
+// needed for a fixed timestep.
+static void update_worlds(float dt) {
+    if (fixed_timestep > 0.0f) {
+        tick_fixed(dt);
+    } else {
+        tick(dt);
+    }
+}
+
+// Quits if quit() was called by a worker thread during the update.
+static void poll_quit_request() {
+    if (quit_requested.exchange(false)) {
+        quit();
+    }
+}
+
+// Updates and draws the next frame on the job pool while the previous
+// frame is presented on this thread.
+static void run_pipelined_frame(float dt) {
+    std::vector<SDL_Texture *> retired;
+    {
+        std::lock_guard<std::mutex> lock(texture_mutex);
+        defer_texture_release = true;
+        // Released before the next frame is drawn, so only the frame
+        // being presented can refer to these.
+        retired.swap(released_textures);
+    }
+
+    JobGroup group;
+    job_pool().run(group, [dt]() {
+        TWO_PROFILE_BEGIN("Update");
+        update_worlds(dt);
+        TWO_PROFILE_END();
+
+        TWO_PROFILE_BEGIN("Draw");
+        draw();
+        TWO_PROFILE_END();
+    });
+
+    if (frame_pending) {
+        TWO_PROFILE_BEGIN("Present");
+        presenting_list->submit(gfx);
+        SDL_RenderPresent(gfx);
+        TWO_PROFILE_END();
+    }
+    for (auto *texture : retired) {
+        SDL_DestroyTexture(texture);
+    }
+
+    // The worker may create textures while updating
+    wait_running_main_thread_tasks(group);
+    std::swap(drawing_list, presenting_list);
+    frame_pending = true;
+}
+
+// Drops the frame waiting to be presented and destroys the textures it
+// could refer to.
+static void end_pipeline() {
+    std::vector<SDL_Texture *> retired;
+    {
+        std::lock_guard<std::mutex> lock(texture_mutex);
+        defer_texture_release = false;
+        retired.swap(released_textures);
+    }
+    for (auto *texture : retired) {
+        SDL_DestroyTexture(texture);
+    }
+    frame_pending = false;
+}
+
+void set_fixed_timestep(float dt) {
+    ASSERT(dt >= 0.0f);
+    fixed_timestep = dt;
+    accumulator = 0.0f;
+    alpha = 1.0f;
+}
+
+float render_alpha() {
+    return alpha;
+}
+
+void set_target_framerate(int fps) {
+    ASSERT(fps >= 0);
+    target_frame_micro = fps > 0 ? 1000000 / fps : 0;
+}
+
+void set_frame_latency(int frames) {
+    ASSERTS(frames == 0 || frames == 1, "Frame latency must be 0 or 1");
+    frame_latency = frames;
 }
 
 void clear_event_listeners() {
-    internal::events.clear();
+    internal::dispatcher().clear();
 }
 
 static void push_event(const SDL_Event &e) {
     switch (e.type) {
     case SDL_KEYDOWN:
-         emit(KeyDown{e.key.keysym.sym,
+         emit_input(KeyDown{e.key.keysym.sym,
                       e.key.keysym.scancode,
                       e.key.repeat != 0});
          break;
     case SDL_KEYUP:
-         emit(KeyUp{e.key.keysym.sym,
+         emit_input(KeyUp{e.key.keysym.sym,
                     e.key.keysym.scancode,
                     e.key.repeat != 0});
          break;
     case SDL_MOUSEBUTTONDOWN:
         {
-            // We use button 2 for the secondary click, but SDL uses button 2.
-            int index = e.button.button;
-            switch (index) {
-            case SDL_BUTTON_RIGHT:
-                index = 2;
-                break;
-            case SDL_BUTTON_MIDDLE:
-                index = 3;
-                break;
-            }
             MouseDown res;
-            res.button = index;
+            res.button = internal::mouse_button_index(e.button.button);
             res.position = int2{e.button.x, e.button.y};
-            emit(res);
+            emit_input(res);
         }
         break;
     case SDL_MOUSEBUTTONUP:
         {
-            int index = e.button.button;
-            switch (index) {
-            case SDL_BUTTON_RIGHT:
-                index = 2;
-                break;
-            case SDL_BUTTON_MIDDLE:
-                index = 3;
-                break;
-            }
             MouseUp res;
-            res.button = index;
+            res.button = internal::mouse_button_index(e.button.button);
             res.position = int2{e.button.x, e.button.y};
-            emit(res);
+            emit_input(res);
         }
         break;
     case SDL_MOUSEWHEEL:
@@ -234,10 +888,10 @@ static void push_event(const SDL_Event &e) {
             // Mouse scrolling is inverted
             int dir = e.wheel.direction == SDL_MOUSEWHEEL_FLIPPED ? -1 : 1;
             float2 delta{float(e.wheel.x * dir), float(e.wheel.y * dir)};
-            emit(MouseScroll{delta});
+            emit_input(MouseScroll{delta});
         }
     case SDL_APP_LOWMEMORY:
-        emit(LowMemory{});
+        emit_input(LowMemory{});
         break;
     case SDL_QUIT:
     case SDL_APP_TERMINATING:
@@ -250,31 +904,112 @@ static void push_event(const SDL_Event &e) {
 }
 
 void pump() {
+    pump(0.0f);
+}
+
+float pump(float dt) {
     TWO_PROFILE_EVENT("Pump");
     SDL_Event e;
+    auto &input = internal::input_state();
+    input.begin_frame();
 
-    while (SDL_PollEvent(&e)) {
-        push_event(e);
+    if (input_replay != nullptr) {
+        if (SDL_WasInit(SDL_INIT_EVENTS)) {
+            // Live input is ignored, but the window can still be closed
+            while (SDL_PollEvent(&e)) {
+                if (e.type == SDL_QUIT) {
+                    quit();
+                }
+            }
+        }
+        if (input_replay->next_frame(&dt, &replay_events)) {
+            for (auto &replayed : replay_events) {
+                input.process(replayed);
+                push_event(replayed);
+            }
+        } else {
+            log("Input replay finished after %llu frames",
+                (unsigned long long)input_replay->frame());
+            input_replay.reset();
+            if (quit_after_replay) {
+                quit();
+            }
+        }
+    } else {
+        if (!mouse_position_read) {
+            // The position is otherwise unknown until the mouse moves
+            e = internal::mouse_focus_event();
+            if (input_recorder != nullptr) {
+                input_recorder->record(e);
+            }
+            input.process(e);
+            mouse_position_read = true;
+        }
+        while (SDL_PollEvent(&e)) {
+            if (e.type == SDL_WINDOWEVENT
+                && e.window.event == SDL_WINDOWEVENT_FOCUS_GAINED) {
+                // The mouse may have moved while outside the window
+                e = internal::mouse_focus_event();
+            }
+            if (input_recorder != nullptr) {
+                input_recorder->record(e);
+            }
+            input.process(e);
+            push_event(e);
+        }
+        if (input_recorder != nullptr && !input_recorder->end_frame(dt)) {
+            log_error("Failed to write input log, recording stopped");
+            input_recorder.reset();
+        }
+    }
+    drain_posted_events();
+    return dt;
+}
+
+bool start_input_recording(const std::string &filename) {
+    ASSERT(is_main_thread());
+    stop_input_recording();
+    input_recorder = std::unique_ptr<InputRecorder>(
+        new InputRecorder(filename));
+    if (!input_recorder->open()) {
+        log_error("Could not open %s for input recording", filename.c_str());
+        input_recorder.reset();
+        return false;
+    }
+    // Record the mouse position before the first event
+    mouse_position_read = false;
+    return true;
+}
+
+void stop_input_recording() {
+    if (input_recorder != nullptr) {
+        input_recorder->close();
+        input_recorder.reset();
     }
 }
 
+bool start_input_replay(const std::string &filename, bool quit_at_end) {
+    ASSERT(is_main_thread());
+    auto replay = std::unique_ptr<InputReplay>(new InputReplay(filename));
+    if (!replay->open()) {
+        log_error("Could not open input log %s", filename.c_str());
+        return false;
+    }
+    input_replay = std::move(replay);
+    quit_after_replay = quit_at_end;
+    return true;
+}
+
+bool is_replaying_input() {
+    return input_replay != nullptr;
+}
+
 int2 mouse_position() {
-    int2 state;
-    SDL_GetMouseState(&state.x, &state.y);
-    return state;
+    return input().mouse_position();
 }
 
 bool get_mouse_button(int button) {
-    auto state = SDL_GetMouseState(nullptr, nullptr);
-    switch (button) {
-    case 2:
-        button = SDL_BUTTON_MIDDLE;
-        break;
-    case 3:
-        button = SDL_BUTTON_RIGHT;
-        break;
-    }
-    return SDL_BUTTON(button) & state;
+    return input().mouse_button(button);
 }
 
 int run() {
@@ -284,12 +1019,12 @@ int run() {
     auto frame_end = frame_begin;
     running = true;
 
-    for (;;) {
+    // quit() may be called during an update
+    while (running) {
         TWO_PROFILE_EVENT("Frame");
-        if (destroyed_world != nullptr) {
-            // Cleanup previous world and load resources for new world.
-            load_world_finish();
-        }
+        // Cleanup previous worlds and load resources for new worlds.
+        begin_frame();
+        poll_async_load();
 
         frame_begin = frame_end;
         frame_end = std::chrono::high_resolution_clock::now();
@@ -298,32 +1033,50 @@ int run() {
         float dt = float(double(dt_micro) * 1e-6);
 
         // Handle events
-        pump();
+        dt = pump(dt);
 
         if (!running) {
             // Make sure the application is still running.
             break;
         }
 
-        TWO_PROFILE_BEGIN("Update");
-        ASSERT(world != nullptr);
-        // World's should handle how update is called on their systems.
-        world->update(dt);
-        TWO_PROFILE_END();
+        ASSERT(main_context.world != nullptr);
+        capture_render_info();
+        if (frame_latency > 0) {
+            run_pipelined_frame(dt);
+        } else {
+            if (frame_pending) {
+                // Latency was changed, the pipelined frame is skipped
+                end_pipeline();
+            }
+            TWO_PROFILE_BEGIN("Update");
+            // World's should handle how update is called on their systems.
+            update_worlds(dt);
+            TWO_PROFILE_END();
 
-        TWO_PROFILE_BEGIN("Draw");
-        // Drawing must be done sequentially so draw is called here for
-        // each system.
-        for (auto *system : world->systems()) {
-            system->draw(world);
+            TWO_PROFILE_BEGIN("Draw");
+            // Drawing must be done sequentially so draw is called here for
+            // each system.
+            draw();
+            TWO_PROFILE_END();
+
+            TWO_PROFILE_BEGIN("Present");
+            drawing_list->submit(gfx);
+            SDL_RenderPresent(gfx);
+            TWO_PROFILE_END();
         }
-        TWO_PROFILE_END();
+        poll_quit_request();
 
-        world->collect_unused_entities();
+        run_main_thread_tasks(0);
+        internal::upload_textures();
 
-        TWO_PROFILE_BEGIN("Present");
-        SDL_RenderPresent(gfx);
-        TWO_PROFILE_END();
+        if (target_frame_micro > 0) {
+            // frame_end is the time this frame started. The time left
+            // before the next frame would be spent sleeping, so a world
+            // that is loading gets to use it first.
+            run_main_thread_tasks(frame_time_left(frame_end));
+            wait_for_next_frame(frame_end);
+        }
 
 #ifdef TWO_PERFORMANCE_PROFILING
         TWO_PROFILE_BEGIN("Profiler");
@@ -332,6 +1085,13 @@ int run() {
         TWO_PROFILE_END();
 #endif
     }
+    if (async_load != nullptr) {
+        // May still need the renderer to finish loading
+        discard_async_load();
+    }
+    destroy_extra_worlds();
+    stop_input_recording();
+    end_pipeline();
     SDL_DestroyRenderer(gfx);
     SDL_DestroyWindow(window);
     gfx = nullptr;
@@ -340,9 +1100,70 @@ int run() {
     return 0;
 }
 
+HeadlessStats run_headless(float dt, uint64_t max_ticks) {
+    ASSERT(dt > 0.0f);
+    HeadlessStats stats{0, 0.0, 0.0};
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    running = true;
+
+    while (running && (max_ticks == 0 || stats.ticks < max_ticks)) {
+        TWO_PROFILE_EVENT("Tick");
+        begin_frame();
+        poll_async_load();
+        ASSERT(main_context.world != nullptr);
+        float frame_dt = dt;
+        if (input_replay != nullptr) {
+            frame_dt = pump(dt);
+            if (!running) {
+                break;
+            }
+        } else {
+            drain_posted_events();
+        }
+        tick(frame_dt);
+        poll_quit_request();
+        ++stats.ticks;
+        run_main_thread_tasks(0);
+
+#ifdef TWO_PERFORMANCE_PROFILING
+        ASSERT(profiler_update_callback != nullptr);
+        profiler_update_callback();
+#endif
+    }
+    if (!running) {
+        if (async_load != nullptr) {
+            discard_async_load();
+        }
+        destroy_extra_worlds();
+        stop_input_recording();
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        end - begin).count();
+    stats.seconds = double(elapsed) * 1e-6;
+    if (stats.seconds > 0.0) {
+        stats.ticks_per_second = double(stats.ticks) / stats.seconds;
+    }
+    log("Headless: %llu ticks in %.3fs (%.0f ticks/s)",
+        (unsigned long long)stats.ticks, stats.seconds,
+        stats.ticks_per_second);
+    return stats;
+}
+
 void quit() {
-    emit(Quit{});
-    destroy_world(world);
+    if (!is_main_thread() || ticking_in_parallel) {
+        // Called by a world updating on the job pool, or while other worlds
+        // are. Worlds cannot receive events or be destroyed until their
+        // update is done.
+        quit_requested = true;
+        return;
+    }
+    for (auto *ctx : draw_list) {
+        ctx->events.emit(Quit{});
+    }
+    destroy_world(main_context.world);
     running = false;
 }
 
@@ -19,16 +19,34 @@
 #ifndef TWO_H
 #define TWO_H
 
+#include <functional>
+
 #include "SDL.h"
 #include "entity.h"
 #include "event.h"
 #include "image.h"
+#include "input.h"
+#include "render.h"
 
 namespace two {
 
 namespace internal {
 
-extern EventDispatcher events;
+// Event handlers of the main world.
+extern EventDispatcher &events;
+
+// The dispatcher used by `bind()` and `emit()` on the calling thread. Each
+// world has its own dispatcher, see `add_world`. While a world is loaded
+// by `load_world_async` its thread uses a separate dispatcher that
+// replaces the main world's when the world is swapped in.
+EventDispatcher &dispatcher();
+
+// Destroys a texture on the main thread once no render list waiting to be
+// submitted can refer to it.
+void release_texture(SDL_Texture *texture);
+
+// True on the thread running `load_world_async`.
+bool is_async_load_thread();
 
 } // internal
 
@@ -122,6 +140,10 @@ public:
 // you call before calling any other function in the engine.
 void init(int argc, char *argv[]);
 
+// Initializes the filesystem without a window or renderer, for running
+// worlds with `run_headless()`. Use instead of `init()`.
+void init_headless(int argc, char *argv[]);
+
 // Initializes `two::profiler` if `TWO_PERFORMANCE_PROFILING` is enabled.
 // By default the data collected by the profiler will be written to a json
 // file with the name given.
@@ -134,11 +156,34 @@ void init_profiler(const char *filename);
 // `Profiler::begin_session()` if you will be using `Profiler::save()`.
 void init_profiler(void (*profiler_update)());
 
-// Creates a new window. Must be called after init!
-void create_window(const char *title, int width, int height);
+// Creates a new window. Must be called after init! If `vsync` is true
+// presenting a frame waits for the display refresh.
+void create_window(const char *title, int width, int height,
+                   bool vsync = false);
 
+// Sets the size of the screen in pixels. If called from another thread
+// the size is applied on the main thread and `render_info()` reports it
+// from the next frame.
 void set_logical_size(int width, int height);
 
+struct RenderInfo {
+    // Logical size of the screen in pixels, see `set_logical_size`.
+    int2 screen_size;
+
+    // Largest texture the renderer can create, 0 if there is no limit.
+    int2 max_texture_size;
+
+    // True if textures can be used as render targets.
+    bool render_targets;
+};
+
+// Renderer state captured on the main thread at the start of each frame.
+// Systems may run on worker threads (see `add_world` and
+// `set_frame_latency`), so they use this instead of querying `gfx`.
+const RenderInfo &render_info();
+
+// Replaces the world that is calling this function, or the main world if
+// called outside of a world.
 // Prefer the templated version unless you need to do something different
 // when allocating memory for a World.
 void load_world(World *world);
@@ -148,7 +193,63 @@ void load_world(Args &&...args) {
     load_world(new T(std::forward<Args>(args)...));
 }
 
-// Returns the currently loaded world
+// Creates and loads a world on a worker thread while the current world
+// keeps running. The new world replaces the current world at the start of
+// the first frame after its `load()` returns and the textures it created
+// are uploaded. If no world is loaded yet the main loop waits for it.
+//
+// `World::load` runs on the worker thread and is the active world there.
+// Textures are created and destroyed on the main thread with
+// `run_on_main_thread`, so loading sprites and fonts is safe. The pixels
+// of textures created with `make_texture` are uploaded by the main loop
+// within the budget of `set_texture_upload_budget`. Events bound during
+// `load` are only received once the world is swapped in. Calling this
+// function again before the world is ready discards the previous world.
+void load_world_async(const std::function<World *()> &make_world);
+
+// Prefer the templated version. Arguments are copied to the worker thread.
+template <class T, typename... Args>
+void load_world_async(Args &&...args) {
+    load_world_async([args...]() -> World * { return new T(args...); });
+}
+
+// True while a world is being loaded by `load_world_async`.
+bool is_loading_world();
+
+// True if called from the thread that called `init`.
+bool is_main_thread();
+
+// Runs a function on the main thread and waits for it to return. If called
+// from the main thread the function runs immediately. SDL renderer
+// functions must only be called from the main thread. Tasks are run by
+// the main loop between frames.
+void run_on_main_thread(const std::function<void()> &task);
+
+// Adds a world that runs alongside the main world, such as a UI or a
+// background simulation. The world is loaded at the start of the next
+// frame. Each world has its own systems and event handlers.
+//
+// Worlds are updated in parallel on the job pool (see `job.h`), so a world
+// must not access other worlds while updating. The main world is updated
+// on the main thread. Worlds are drawn in order of `draw_order`, lowest
+// first; the main world has a draw order of 0. Input events are emitted
+// to the world drawn last first, a handler that returns true stops the
+// event from reaching the worlds below it.
+void add_world(World *world, int draw_order);
+
+template <class T, typename... Args>
+T *add_world(int draw_order, Args &&...args) {
+    auto *world = new T(std::forward<Args>(args)...);
+    add_world(world, draw_order);
+    return world;
+}
+
+// Unloads and frees a world added with `add_world` at the start of the
+// next frame.
+void remove_world(World *world);
+
+// Returns the world that is calling this function, or the main world if
+// called outside of a world.
 World *active_world();
 
 // Called when loading a new world. Don't call this unless you have a
@@ -158,9 +259,72 @@ World *active_world();
 // class after calling Scene::unload.
 void destroy_world(World *world);
 
+// Draw commands for the frame being drawn. Draw systems add commands to
+// this list instead of calling SDL, the list is sorted and submitted once
+// all worlds have been drawn. When frames are pipelined (see
+// `set_frame_latency`) this is a different list each frame.
+RenderList &render_list();
+
 // Run it! This will fail if you haven't created a window.
 int run();
 
+// Updates the world with a fixed `dt` instead of the time between frames.
+// The time since the last frame is accumulated and the world is updated
+// as many times as needed to catch up, so the simulation is independent
+// of the frame rate. Use `render_alpha()` to interpolate between updates
+// when drawing. A `dt` of 0 updates once per frame with a variable dt,
+// which is the default.
+//
+//     two::set_fixed_timestep(1.0f / 60.0f);
+//
+void set_fixed_timestep(float dt);
+
+// How far between the last two fixed updates the current frame is, from
+// 0 to 1. Renderers can draw `lerp(previous, current, render_alpha())`
+// for smooth movement when the frame rate is higher than the update rate.
+// Always 1 if there is no fixed timestep.
+float render_alpha();
+
+// Limits the frame rate by sleeping at the end of each frame instead of
+// running as fast as possible. A `fps` of 0 removes the limit.
+void set_target_framerate(int fps);
+
+// Sets how many frames presenting may lag behind updating, either 0 or 1.
+// With a latency of 0, the default, each frame is updated, drawn and then
+// presented. With a latency of 1 the main thread presents the previous
+// frame while the next frame is updated and drawn on the job pool, so a
+// frame takes about as long as the slower of the two instead of both
+// combined, at the cost of showing each frame one frame later.
+//
+// Events from SDL are still handled on the main thread between frames,
+// but `World::update` and draw systems run on a worker thread, the same
+// as worlds added with `add_world`.
+void set_frame_latency(int frames);
+
+struct HeadlessStats {
+    // Number of updates simulated.
+    uint64_t ticks;
+
+    // Real time spent simulating.
+    double seconds;
+
+    double ticks_per_second;
+};
+
+// Updates the loaded world with a fixed `dt` as fast as possible without
+// drawing, until `max_ticks` updates have been simulated or `quit()` is
+// called. A `max_ticks` of 0 runs until `quit()`. Used to run simulations
+// on machines without a display, such as build servers and balancing
+// runs. Worlds run headless must not load textures or fonts since there
+// is no renderer.
+//
+//     two::init_headless(argc, argv);
+//     two::load_world<Simulation>();
+//     auto stats = two::run_headless(1.0f / 60.0f, 100000);
+//
+// May be called again to continue simulating the same world.
+HeadlessStats run_headless(float dt, uint64_t max_ticks = 0);
+
 
 // Convert world to screen (pixel) coordinates.
 int2 world_to_screen(const float2 &v, const Camera &camera);
@@ -173,16 +337,24 @@ float2 screen_to_world(const int2 &v, const Camera &camera);
 //
 //     two::bind<KeyPressed>(&MainWorld::keypressed, this);
 //
+// The returned subscription can be passed to `unbind()` to remove the
+// handler.
 template <typename Event>
-void bind(const std::function<bool(const Event &)> &callback) {
-    internal::events.bind(callback);
+Subscription bind(const std::function<bool(const Event &)> &callback) {
+    return internal::dispatcher().bind(callback);
 }
 
 // Same as `bind(callback)` but allows a member function to be used
 // as an event handler.
 template <typename Event, typename T, class U>
-void bind(T callback, U this_ptr) {
-    internal::events.bind<Event>(callback, this_ptr);
+Subscription bind(T callback, U this_ptr) {
+    return internal::dispatcher().bind<Event>(callback, this_ptr);
+}
+
+// Removes an event handler added with `bind()` or `bind_batch()`. It is
+// safe to call this from inside an event handler.
+inline void unbind(const Subscription &subscription) {
+    internal::dispatcher().unbind(subscription);
 }
 
 // Emits an event to all listeners using the main `EventDispatcher`.
@@ -190,7 +362,61 @@ void bind(T callback, U this_ptr) {
 // considered handled and will not propagate to other listeners.
 template <typename Event>
 void emit(const Event &event) {
-    internal::events.emit(event);
+    internal::dispatcher().emit(event);
+}
+
+// Registers a handler that receives every queued event of a type in a
+// single call. Queued events are dispatched once per frame before the
+// world is updated.
+//
+//     two::bind_batch<Collision>(&Physics::collisions, this);
+//
+template <typename Event>
+Subscription bind_batch(
+        const std::function<void(const std::vector<Event> &)> &callback) {
+    return internal::dispatcher().bind_batch(callback);
+}
+
+// Same as `bind_batch(callback)` but allows a member function to be used
+// as a batch handler.
+template <typename Event, typename T, class U>
+Subscription bind_batch(T callback, U this_ptr) {
+    return internal::dispatcher().bind_batch<Event>(callback, this_ptr);
+}
+
+// Queues an event to be delivered with other events of the same type at
+// the start of the next frame. Use this instead of `emit()` for events
+// that are sent often, handlers can then process them in bulk.
+template <typename Event>
+void queue(const Event &event) {
+    internal::dispatcher().queue(event);
+}
+
+// Emits an event after `seconds` from the calling world's timers. If
+// `entity` is not `NullEntity` the event is cancelled when the entity is
+// destroyed. See `World::after()`.
+template <typename Event>
+Timer emit_after(float seconds, const Event &event,
+                 Entity entity = NullEntity) {
+    return active_world()->after(seconds, [event]() {
+        internal::dispatcher().emit(event);
+    }, entity);
+}
+
+// Posts an event from any thread, such as a job or an asset loading
+// thread. The event is queued on the calling thread's world during
+// `pump()` and delivered with other queued events at the start of the
+// next update. Posting never blocks.
+template <typename Event>
+void post(const Event &event) {
+    internal::dispatcher().post(event);
+}
+
+// Events of a type delivered at the start of this frame. Systems may read
+// the batch during update instead of binding a handler.
+template <typename Event>
+const std::vector<Event> &queued_events() {
+    return internal::dispatcher().batch<Event>();
 }
 
 // Removes all event handlers from the main `EventDispatcher`.
@@ -198,16 +424,44 @@ void emit(const Event &event) {
 // necessary to call it when unloading a World.
 void clear_event_listeners();
 
-// Emits any SDL events. This function is called in the main loop. Only
-// use this if you are using your own main loop and would like SDL events
-// handled. This function should be called at the beggining of every frame.
+// Emits any SDL events and queues events posted from other threads. This
+// function is called in the main loop. Only use this if you are using
+// your own main loop and would like SDL events handled. This function
+// should be called at the beggining of every frame.
 void pump();
 
-// Gets the current mouse position in pixels. To convert to world units
-// use `screen_to_world()`.
+// Same as `pump()` but also writes `dt` to the input log when recording.
+// Returns the time step to use for this frame, which is the recorded
+// time step while replaying input.
+float pump(float dt);
+
+// Records every input event and the time step of each frame to a file in
+// the write directory until `stop_input_recording()` is called. Returns
+// false if the file could not be opened.
+bool start_input_recording(const std::string &filename);
+
+void stop_input_recording();
+
+// Replays input recorded with `start_input_recording()` instead of
+// reading events from SDL. Each frame is updated with its recorded time
+// step so a play session runs the same way every time, including with
+// `run_headless()`. When the log ends the game quits if `quit_at_end` is
+// true, otherwise live input resumes.
+//
+//     two::start_input_replay("session.input");
+//     auto stats = two::run_headless(1.0f / 60.0f);
+//
+bool start_input_replay(const std::string &filename, bool quit_at_end = true);
+
+// True while input is being replayed.
+bool is_replaying_input();
+
+// Gets the mouse position in pixels from the current frame's input
+// state. To convert to world units use `screen_to_world()`.
 int2 mouse_position();
 
-// Returns true if the specified mouse button is currently pressed.
+// Returns true if the specified mouse button is currently pressed. Button
+// 1 is the primary button, 2 is the secondary and 3 is the middle button.
 bool get_mouse_button(int button);
 
 // Stops running the game and cleans up